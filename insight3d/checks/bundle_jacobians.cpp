@@ -0,0 +1,156 @@
+/*
+
+  insight3d - image based 3d modelling software
+  Copyright (C) 2007-2008  Lukas Mach
+                           email: lukas.mach@gmail.com 
+                           web: http://mach.matfyz.cz/
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+  
+*/
+
+// verifies the analytic jacobians of bundle adjustment callbacks against finite 
+// differences using sba's own check (sba_motstr_levmar with itmax == 0) on a small 
+// synthetic scene; exits with nonzero status if any gradient looks suspicious 
+
+#include "../mvg_bundle.h"
+#include "../sba/sba.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+const int CHECK_CAMERAS_COUNT = 4;
+const int CHECK_VERTICES_COUNT = 12;
+
+// uniformly distributed number from [from, to] 
+static double check_random(double from, double to)
+{
+	return from + (to - from) * (rand() / (double)RAND_MAX);
+}
+
+// synthetic metric scene, cameras looking at vertices scattered around the origin 
+// from distance about 10; no parameter is zero, because finite differences are 
+// unreliable there 
+static void check_metric_scene(double * p, Mvg_Bundle_Intrinsics * intrinsics)
+{
+	for (int j = 0; j < CHECK_CAMERAS_COUNT; j++)
+	{
+		double * a = p + j * MVG_BUNDLE_METRIC_CAMERA_PARAMETERS;
+		a[0] = check_random(0.05, 0.3);
+		a[1] = check_random(-0.4, -0.1) + 0.5 * j;
+		a[2] = check_random(0.05, 0.2);
+		a[3] = check_random(0.1, 0.5);
+		a[4] = check_random(-0.5, -0.1);
+		a[5] = check_random(9, 11);
+		a[6] = check_random(700, 900);
+
+		intrinsics[j].aspect = check_random(0.95, 1.05);
+		intrinsics[j].skew = check_random(0.001, 0.01);
+		intrinsics[j].pp_x = check_random(310, 330);
+		intrinsics[j].pp_y = check_random(230, 250);
+	}
+
+	double * b = p + CHECK_CAMERAS_COUNT * MVG_BUNDLE_METRIC_CAMERA_PARAMETERS;
+	for (int i = 0; i < CHECK_VERTICES_COUNT * MVG_BUNDLE_METRIC_POINT_PARAMETERS; i++)
+	{
+		b[i] = (rand() % 2 ? 1 : -1) * check_random(0.2, 2);
+	}
+}
+
+// projective scene with generic cameras and vertices; sba perturbs all parameters 
+// by eps * |p| at once and both P and X are defined only up to scale, so the rows of 
+// P have mixed signs to keep that direction away from the invariant one (p itself) 
+static void check_projective_scene(double * p)
+{
+	for (int j = 0; j < CHECK_CAMERAS_COUNT; j++)
+	{
+		double * P = p + j * MVG_BUNDLE_PROJECTIVE_CAMERA_PARAMETERS;
+		for (int r = 0; r < 3; r++)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				P[r * 4 + c] = (c == r ? -1 : rand() % 2 ? 1 : -1) * check_random(0.2, 1);
+			}
+			P[r * 4 + 3] = check_random(0.2, 1);
+		}
+
+		// keep vertices well in front of the camera 
+		P[2 * 4 + 3] = check_random(4, 6);
+	}
+
+	double * b = p + CHECK_CAMERAS_COUNT * MVG_BUNDLE_PROJECTIVE_CAMERA_PARAMETERS;
+	for (int i = 0; i < CHECK_VERTICES_COUNT; i++)
+	{
+		double * X = b + i * MVG_BUNDLE_PROJECTIVE_POINT_PARAMETERS;
+		X[0] = (rand() % 2 ? 1 : -1) * check_random(0.2, 1);
+		X[1] = (rand() % 2 ? 1 : -1) * check_random(0.2, 1);
+		X[2] = (rand() % 2 ? 1 : -1) * check_random(0.2, 1);
+		X[3] = check_random(0.5, 1);
+	}
+}
+
+// runs sba's jacobian verification for one pair of callbacks; measurements are the 
+// exact projections, every vertex is seen by every camera 
+static bool check_jacobians(
+	const char * name, double * p, int cnp, int pnp, 
+	void (*proj)(int j, int i, double * aj, double * bi, double * xij, void * adata),
+	void (*projac)(int j, int i, double * aj, double * bi, double * Aij, double * Bij, void * adata),
+	void * adata
+)
+{
+	char vmask[CHECK_VERTICES_COUNT * CHECK_CAMERAS_COUNT];
+	double x[CHECK_VERTICES_COUNT * CHECK_CAMERAS_COUNT * 2];
+	for (int i = 0; i < CHECK_VERTICES_COUNT; i++)
+	{
+		for (int j = 0; j < CHECK_CAMERAS_COUNT; j++)
+		{
+			vmask[i * CHECK_CAMERAS_COUNT + j] = 1;
+			proj(j, i, p + j * cnp, p + CHECK_CAMERAS_COUNT * cnp + i * pnp, x + (i * CHECK_CAMERAS_COUNT + j) * 2, adata);
+		}
+	}
+
+	double opts[SBA_OPTSSZ] = { SBA_INIT_MU, SBA_STOP_THRESH, SBA_STOP_THRESH, SBA_STOP_THRESH, 0.0, 1.0, SBA_SOLVER_DENSE }, info[SBA_INFOSZ];
+	const int result = sba_motstr_levmar(
+		CHECK_VERTICES_COUNT, CHECK_CAMERAS_COUNT, 0, vmask, p, cnp, pnp, x, NULL, 2, 
+		proj, projac, adata, 0, 0, opts, info
+	);
+
+	printf("%s jacobian %s\n", name, result == SBA_ERROR ? "FAILED" : "ok");
+	return result != SBA_ERROR;
+}
+
+int main()
+{
+	srand(1);
+	bool ok = true;
+
+	double projective[CHECK_CAMERAS_COUNT * MVG_BUNDLE_PROJECTIVE_CAMERA_PARAMETERS + CHECK_VERTICES_COUNT * MVG_BUNDLE_PROJECTIVE_POINT_PARAMETERS];
+	check_projective_scene(projective);
+	ok = check_jacobians(
+		"projective", projective, MVG_BUNDLE_PROJECTIVE_CAMERA_PARAMETERS, MVG_BUNDLE_PROJECTIVE_POINT_PARAMETERS, 
+		mvg_bundle_projective_projection, mvg_bundle_projective_jacobian, NULL
+	) && ok;
+
+	double metric[CHECK_CAMERAS_COUNT * MVG_BUNDLE_METRIC_CAMERA_PARAMETERS + CHECK_VERTICES_COUNT * MVG_BUNDLE_METRIC_POINT_PARAMETERS];
+	Mvg_Bundle_Intrinsics intrinsics[CHECK_CAMERAS_COUNT];
+	check_metric_scene(metric, intrinsics);
+	ok = check_jacobians(
+		"metric", metric, MVG_BUNDLE_METRIC_CAMERA_PARAMETERS, MVG_BUNDLE_METRIC_POINT_PARAMETERS, 
+		mvg_bundle_metric_projection, mvg_bundle_metric_jacobian, intrinsics
+	) && ok;
+
+	return ok ? 0 : 1;
+}
@@ -68,6 +68,29 @@ double average_value(const double a, const double b)
 	return (a + b) / 2.0;
 }
 
+// pseudo-random number (30 bits) generated from caller's state 
+unsigned int random_number(unsigned int & state)
+{
+	state = state * 1103515245 + 12345; 
+	const unsigned int high = (state >> 16) & 0x7fff; 
+	state = state * 1103515245 + 12345; 
+	return (high << 15) | ((state >> 16) & 0x7fff);
+}
+
+// number of RANSAC trials needed to draw at least one all-inlier sample 
+int ransac_trials(const int inliers_count, const int n, const int sample_size, const double probability, const int max_trials)
+{
+	if (n <= 0 || inliers_count <= 0) return max_trials;
+
+	// probability that a random sample is all-inlier 
+	const double good = pow(inliers_count / (double)n, sample_size);
+	if (good >= 1.0 - CORE_PRECISION) return 1;
+	if (good <= CORE_PRECISION) return max_trials;
+
+	const double trials = ceil(log(1.0 - probability) / log(1.0 - good));
+	return trials < max_trials ? (trials < 1 ? 1 : (int)trials) : max_trials;
+}
+
 // swap values of variables 
 void swap_double(double & a, double & b) 
 {
@@ -361,3 +384,73 @@ bool plane_from_three_points(const double * a, const double * b, const double *
 	double t3 = dot_3(c, normal) + normal[3]; 
 	return true;
 }
+
+// right singular vector of A corresponding to its smallest singular value 
+void smallest_right_singular_vector(double * A, const int m, const int n, double * V, double * x)
+{
+	// V = I 
+	for (int i = 0; i < n * n; i++) V[i] = 0; 
+	for (int i = 0; i < n; i++) V[i * n + i] = 1;
+
+	// rotate pairs of columns of A until all of them are orthogonal, A V then 
+	// stays equal to U S and the rotations are accumulated in V 
+	for (int sweep = 0; sweep < 30; sweep++) 
+	{
+		bool rotated = false;
+		for (int p = 0; p < n - 1; p++) 
+		{
+			for (int q = p + 1; q < n; q++) 
+			{
+				double alpha = 0, beta = 0, gamma = 0; 
+				for (int i = 0; i < m; i++) 
+				{
+					alpha += A[i * n + p] * A[i * n + p];
+					beta += A[i * n + q] * A[i * n + q];
+					gamma += A[i * n + p] * A[i * n + q];
+				}
+
+				if (gamma == 0 || fabs(gamma) <= 1e-15 * sqrt(alpha * beta)) continue;
+				rotated = true;
+
+				const double 
+					zeta = (beta - alpha) / (2 * gamma), 
+					t = (zeta >= 0 ? 1 : -1) / (fabs(zeta) + sqrt(1 + zeta * zeta)), 
+					c = 1 / sqrt(1 + t * t), 
+					s = c * t
+				;
+
+				for (int i = 0; i < m; i++) 
+				{
+					const double a = A[i * n + p], b = A[i * n + q]; 
+					A[i * n + p] = c * a - s * b; 
+					A[i * n + q] = s * a + c * b;
+				}
+
+				for (int i = 0; i < n; i++) 
+				{
+					const double a = V[i * n + p], b = V[i * n + q]; 
+					V[i * n + p] = c * a - s * b; 
+					V[i * n + q] = s * a + c * b;
+				}
+			}
+		}
+
+		if (!rotated) break;
+	}
+
+	// singular values are the norms of columns of A, pick the smallest one 
+	int smallest = 0; 
+	double smallest_norm = -1;
+	for (int j = 0; j < n; j++) 
+	{
+		double norm = 0; 
+		for (int i = 0; i < m; i++) norm += A[i * n + j] * A[i * n + j];
+		if (smallest_norm < 0 || norm < smallest_norm) 
+		{
+			smallest = j; 
+			smallest_norm = norm;
+		}
+	}
+
+	for (int i = 0; i < n; i++) x[i] = V[i * n + smallest];
+}
@@ -52,6 +52,16 @@ double min_value(const double x, const double y);
 // average of two values  
 double average_value(const double a, const double b);
 
+// pseudo-random number (30 bits) generated from caller's state, unlike rand() 
+// it can be used concurrently by several threads and the same seed gives the same 
+// sequence everywhere (kd-trees and vocabulary don't change between runs)
+unsigned int random_number(unsigned int & state);
+
+// number of RANSAC trials needed to draw at least one all-inlier sample of 
+// sample_size points with given probability, when inliers_count out of n 
+// points are inliers; the result is clamped to max_trials
+int ransac_trials(const int inliers_count, const int n, const int sample_size, const double probability, const int max_trials);
+
 // swap values of variables 
 void swap_double(double & a, double & b);
 
@@ -145,4 +155,9 @@ void nearest_point_on_plane(const double * plane, const double * point, double *
 // estimate plane parameters from 3 points (first 3 of the inhomogeneous coordinates are normalized) 
 bool plane_from_three_points(const double * a, const double * b, const double * c, double * normal);
 
+// right singular vector of m x n matrix A (stored by rows) corresponding to its smallest 
+// singular value, i.e., unit x minimizing |Ax|; computed by one-sided Jacobi method without 
+// allocating any memory - A is overwritten and V is n x n scratch space 
+void smallest_right_singular_vector(double * A, const int m, const int n, double * V, double * x);
+
 #endif
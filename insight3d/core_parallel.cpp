@@ -0,0 +1,278 @@
+/*
+
+  insight3d - image based 3d modelling software
+  Copyright (C) 2007-2008  Lukas Mach
+                           email: lukas.mach@gmail.com 
+                           web: http://mach.matfyz.cz/
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+  
+*/
+
+#include "core_parallel.h"
+
+#ifdef LINUX
+#include <unistd.h>
+#else
+#include "windows.h"
+#endif
+
+// state shared by all threads working on one core_parallel_for call 
+struct Core_Parallel_Context 
+{
+	pthread_mutex_t lock; 
+	size_t next, count, chunk;   // next unprocessed item, number of items and how many items to take at once
+	Core_Parallel_Job job; 
+	void * arg;
+};
+
+// argument of worker thread 
+struct Core_Parallel_Worker 
+{
+	Core_Parallel_Context * context; 
+	size_t thread_id;
+};
+
+// number of worker threads to use 
+size_t core_parallel_threads_count(const int requested)
+{
+	if (requested > 0) return requested;
+
+#ifdef LINUX
+	const long processors = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+	SYSTEM_INFO info; 
+	GetSystemInfo(&info);
+	const long processors = info.dwNumberOfProcessors;
+#endif
+
+	return processors > 0 ? processors : 1;
+}
+
+// take chunks of items until there are none left 
+static void core_parallel_run(Core_Parallel_Context * const context, const size_t thread_id) 
+{
+	while (true) 
+	{
+		pthread_mutex_lock(&context->lock);
+		const size_t from = context->next; 
+		const size_t to = context->count - from > context->chunk ? from + context->chunk : context->count;
+		context->next = to;
+		pthread_mutex_unlock(&context->lock);
+
+		if (from >= to) return;
+
+		for (size_t i = from; i < to; i++) 
+		{
+			context->job(context->arg, i, thread_id);
+		}
+	}
+}
+
+// thread function 
+static void * core_parallel_thread_function(void * arg) 
+{
+	Core_Parallel_Worker * const worker = (Core_Parallel_Worker *)arg; 
+	core_parallel_run(worker->context, worker->thread_id);
+	return NULL;
+}
+
+// process items 0 .. count - 1 using threads_count threads 
+void core_parallel_for(const size_t count, const size_t threads_count, Core_Parallel_Job job, void * arg)
+{
+	if (count == 0) return; 
+	const size_t threads = threads_count < count ? threads_count : count; 
+
+	// trivial case, no need to spawn anything 
+	if (threads <= 1) 
+	{
+		for (size_t i = 0; i < count; i++) 
+		{
+			job(arg, i, 0);
+		}
+		return;
+	}
+
+	// small chunks keep the threads busy till the end, but they shouldn't 
+	// be so small that threads spend their time fighting for the lock
+	Core_Parallel_Context context; 
+	pthread_mutex_init(&context.lock, NULL);
+	context.next = 0; 
+	context.count = count;
+	context.chunk = count / (16 * threads); 
+	if (context.chunk < 1) context.chunk = 1; 
+	context.job = job; 
+	context.arg = arg;
+
+	// start the workers, the calling thread is worker number 0
+	pthread_t * const handles = ALLOC(pthread_t, threads);
+	bool * const started = ALLOC(bool, threads);
+	Core_Parallel_Worker * const workers = ALLOC(Core_Parallel_Worker, threads);
+	for (size_t i = 1; i < threads; i++)
+	{
+		workers[i].context = &context; 
+		workers[i].thread_id = i;
+
+		// if the thread can't be created, the remaining ones will simply do more work 
+		started[i] = pthread_create(handles + i, NULL, core_parallel_thread_function, workers + i) == 0;
+	}
+
+	core_parallel_run(&context, 0);
+
+	// wait for the others 
+	for (size_t i = 1; i < threads; i++) 
+	{
+		if (started[i]) pthread_join(handles[i], NULL);
+	}
+
+	FREE(workers);
+	FREE(started);
+	FREE(handles);
+	pthread_mutex_destroy(&context.lock);
+}
+
+// atomically add delta to value 
+size_t core_parallel_fetch_and_add(volatile size_t * value, const size_t delta)
+{
+#ifdef LINUX
+	return __sync_fetch_and_add(value, delta);
+#elif defined(_WIN64)
+	return (size_t)InterlockedExchangeAdd64((volatile LONGLONG *)value, (LONGLONG)delta);
+#else
+	return (size_t)InterlockedExchangeAdd((volatile LONG *)value, (LONG)delta);
+#endif
+}
+
+// * background workers * 
+
+// run job once in this thread 
+static void * core_parallel_background_function(void * arg) 
+{
+	Core_Parallel_Worker * const worker = (Core_Parallel_Worker *)arg; 
+	worker->context->job(worker->context->arg, worker->thread_id, worker->thread_id);
+	return NULL;
+}
+
+// start threads_count threads in background
+size_t core_parallel_start(Core_Parallel_Threads * threads, const size_t threads_count, Core_Parallel_Job job, void * arg)
+{
+	threads->count = threads_count; 
+	threads->started = 0;
+	threads->handles = ALLOC(pthread_t, threads_count);
+	threads->running = ALLOC(bool, threads_count);
+	threads->workers = ALLOC(Core_Parallel_Worker, threads_count);
+	threads->context = ALLOC(Core_Parallel_Context, 1);
+	threads->context->job = job; 
+	threads->context->arg = arg;
+
+	for (size_t i = 0; i < threads_count; i++) 
+	{
+		threads->workers[i].context = threads->context; 
+		threads->workers[i].thread_id = i;
+		threads->running[i] = pthread_create(threads->handles + i, NULL, core_parallel_background_function, threads->workers + i) == 0;
+		if (threads->running[i]) threads->started++;
+	}
+
+	return threads->started;
+}
+
+// wait for threads started by core_parallel_start 
+void core_parallel_join(Core_Parallel_Threads * threads)
+{
+	for (size_t i = 0; i < threads->count; i++) 
+	{
+		if (threads->running[i]) pthread_join(threads->handles[i], NULL);
+	}
+
+	FREE(threads->context);
+	FREE(threads->workers);
+	FREE(threads->running);
+	FREE(threads->handles);
+	threads->count = threads->started = 0;
+}
+
+// * bounded queue * 
+
+// initialize queue 
+void core_parallel_queue_initialize(Core_Parallel_Queue * queue, const size_t capacity)
+{
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->not_empty, NULL);
+	pthread_cond_init(&queue->not_full, NULL);
+	queue->items = ALLOC(void *, capacity > 0 ? capacity : 1);
+	queue->capacity = capacity > 0 ? capacity : 1;
+	queue->first = 0; 
+	queue->count = 0; 
+	queue->closed = false;
+}
+
+// release queue 
+void core_parallel_queue_release(Core_Parallel_Queue * queue)
+{
+	ASSERT(queue->count == 0, "releasing queue which still contains items");
+	FREE(queue->items);
+	pthread_cond_destroy(&queue->not_full);
+	pthread_cond_destroy(&queue->not_empty);
+	pthread_mutex_destroy(&queue->lock);
+}
+
+// append item 
+void core_parallel_queue_push(Core_Parallel_Queue * queue, void * item)
+{
+	pthread_mutex_lock(&queue->lock);
+	ASSERT(!queue->closed, "pushing into closed queue");
+	while (queue->count == queue->capacity) 
+	{
+		pthread_cond_wait(&queue->not_full, &queue->lock);
+	}
+
+	queue->items[(queue->first + queue->count) % queue->capacity] = item; 
+	queue->count++;
+	pthread_cond_signal(&queue->not_empty);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+// take the oldest item 
+bool core_parallel_queue_pop(Core_Parallel_Queue * queue, void * * item)
+{
+	pthread_mutex_lock(&queue->lock);
+	while (queue->count == 0 && !queue->closed) 
+	{
+		pthread_cond_wait(&queue->not_empty, &queue->lock);
+	}
+
+	if (queue->count == 0) 
+	{
+		pthread_mutex_unlock(&queue->lock);
+		return false;
+	}
+
+	*item = queue->items[queue->first]; 
+	queue->first = (queue->first + 1) % queue->capacity;
+	queue->count--;
+	pthread_cond_signal(&queue->not_full);
+	pthread_mutex_unlock(&queue->lock);
+	return true;
+}
+
+// no more items will be pushed 
+void core_parallel_queue_close(Core_Parallel_Queue * queue)
+{
+	pthread_mutex_lock(&queue->lock);
+	queue->closed = true; 
+	pthread_cond_broadcast(&queue->not_empty);
+	pthread_mutex_unlock(&queue->lock);
+}
@@ -0,0 +1,96 @@
+/*
+
+  insight3d - image based 3d modelling software
+  Copyright (C) 2007-2008  Lukas Mach
+                           email: lukas.mach@gmail.com 
+                           web: http://mach.matfyz.cz/
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+  
+*/
+
+#ifndef __CORE_PARALLEL
+#define __CORE_PARALLEL
+
+#include "portability.h"
+#include "core_debug.h"
+#include "pthread.h"
+
+// job processed by worker threads; item is the index of the work item, 
+// thread_id is in range 0 .. threads_count - 1 and can be used to address 
+// per-thread scratch buffers 
+typedef void (* Core_Parallel_Job)(void * arg, const size_t item, const size_t thread_id);
+
+// number of worker threads to use (if requested is 0, we use one thread per processor)
+size_t core_parallel_threads_count(const int requested = 0);
+
+// process items 0 .. count - 1 using threads_count threads (including the calling one);
+// idle threads keep taking the next unprocessed chunk of items from a shared counter, 
+// so uneven items don't leave threads waiting; returns after all items are processed 
+void core_parallel_for(const size_t count, const size_t threads_count, Core_Parallel_Job job, void * arg);
+
+// atomically add delta to value, returns the previous value 
+size_t core_parallel_fetch_and_add(volatile size_t * value, const size_t delta);
+
+// * background workers * 
+
+// group of threads started by core_parallel_start
+struct Core_Parallel_Threads 
+{
+	size_t count, started;       // number of requested threads and how many of them are actually running 
+	pthread_t * handles; 
+	bool * running;
+	struct Core_Parallel_Worker * workers;
+	struct Core_Parallel_Context * context;
+};
+
+// start threads_count threads in background, each of them calls job once with 
+// item equal to it's thread_id; returns number of threads which were started 
+size_t core_parallel_start(Core_Parallel_Threads * threads, const size_t threads_count, Core_Parallel_Job job, void * arg);
+
+// wait for threads started by core_parallel_start and release them 
+void core_parallel_join(Core_Parallel_Threads * threads);
+
+// * bounded queue * 
+
+// fifo of pointers shared between producer and consumer threads; producer 
+// blocks when the queue is full, so that it can't run too far ahead 
+struct Core_Parallel_Queue 
+{
+	pthread_mutex_t lock; 
+	pthread_cond_t not_empty, not_full;
+	void * * items; 
+	size_t capacity, first, count;
+	bool closed;                 // no more items will be pushed 
+};
+
+// initialize queue holding at most capacity items 
+void core_parallel_queue_initialize(Core_Parallel_Queue * queue, const size_t capacity);
+
+// release queue (it has to be empty and no thread may use it anymore)
+void core_parallel_queue_release(Core_Parallel_Queue * queue);
+
+// append item, waits while the queue is full 
+void core_parallel_queue_push(Core_Parallel_Queue * queue, void * item);
+
+// take the oldest item, waits while the queue is empty; returns false if 
+// the queue is empty and closed 
+bool core_parallel_queue_pop(Core_Parallel_Queue * queue, void * * item);
+
+// signal consumers that no more items will be pushed 
+void core_parallel_queue_close(Core_Parallel_Queue * queue);
+
+#endif
@@ -0,0 +1,207 @@
+/*
+
+  insight3d - image based 3d modelling software
+  Copyright (C) 2007-2008  Lukas Mach
+                           email: lukas.mach@gmail.com 
+                           web: http://mach.matfyz.cz/
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+  
+*/
+
+#include "geometry_features_cache.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// format version, bump whenever the layout changes 
+static const char FEATURES_CACHE_MAGIC[8] = { 'I', '3', 'D', 'S', 'I', 'F', 'T', '3' };
+
+// how much of the beginning of image file is hashed (catches modifications which 
+// keep the size and the modification time)
+static const size_t FEATURES_CACHE_HASHED_BYTES = 4096;
+
+// cache file header 
+struct Features_Cache_Header 
+{
+	char magic[8];
+	unsigned int header_size, keypoint_size;     // sizes of structures for sanity checks 
+	unsigned long long image_size; 
+	long long image_mtime; 
+	unsigned long long image_hash;
+	int max_size; 
+	int width, height;                           // size of the image after scaling
+	int keypoints_count, descriptor_length; 
+	double sift_parameters[7];                   // SIFT settings the features were extracted with
+};
+
+// keypoint position, followed in file by all descriptors stored as a keypoints_count x descriptor_length matrix of bytes 
+struct Features_Cache_Keypoint 
+{
+	double x, y;
+};
+
+// fill in the key part of header 
+static void geometry_features_cache_header(Features_Cache_Header & header, const Features_Cache_Key & key)
+{
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, FEATURES_CACHE_MAGIC, sizeof(header.magic));
+	header.header_size = sizeof(Features_Cache_Header); 
+	header.keypoint_size = sizeof(Features_Cache_Keypoint);
+	header.image_size = key.image_size; 
+	header.image_mtime = key.image_mtime; 
+	header.image_hash = key.image_hash; 
+	header.max_size = key.max_size;
+	header.descriptor_length = GEOMETRY_DESCRIPTOR_LENGTH;
+	header.sift_parameters[0] = SIFT_INTVLS; 
+	header.sift_parameters[1] = SIFT_SIGMA; 
+	header.sift_parameters[2] = SIFT_CONTR_THR; 
+	header.sift_parameters[3] = SIFT_CURV_THR; 
+	header.sift_parameters[4] = SIFT_IMG_DBL; 
+	header.sift_parameters[5] = SIFT_DESCR_WIDTH; 
+	header.sift_parameters[6] = SIFT_DESCR_HIST_BINS;
+}
+
+// size and modification time of the image file and hash of it's beginning (64-bit FNV-1a)
+bool geometry_features_cache_key(const char * image_filename, Features_Cache_Key & key)
+{
+	struct stat info; 
+	if (stat(image_filename, &info) != 0) return false;
+	key.image_size = (unsigned long long)info.st_size; 
+	key.image_mtime = (long long)info.st_mtime;
+
+	FILE * f = fopen(image_filename, "rb");
+	if (!f) return false; 
+
+	unsigned char buffer[FEATURES_CACHE_HASHED_BYTES];
+	const size_t read = fread(buffer, 1, sizeof(buffer), f);
+	const bool ok = !ferror(f);
+	fclose(f);
+
+	key.image_hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < read; i++) 
+	{
+		key.image_hash ^= buffer[i]; 
+		key.image_hash *= 1099511628211ULL;
+	}
+
+	return ok;
+}
+
+// filename of the cache
+char * geometry_features_cache_filename(const char * image_filename, const int max_size)
+{
+	const size_t length = strlen(image_filename) + 32;
+	char * filename = ALLOC(char, length); 
+	sprintf(filename, "%s.%d.i3dsift", image_filename, max_size);
+	return filename;
+}
+
+// load cached features 
+bool geometry_features_cache_load(const char * image_filename, const Features_Cache_Key & key, Keypoints & keypoints, int & width, int & height)
+{
+	char * filename = geometry_features_cache_filename(image_filename, key.max_size);
+	FILE * f = fopen(filename, "rb");
+	FREE(filename);
+	if (!f) return false;
+	fseek(f, 0, SEEK_END);
+	const long size = ftell(f); 
+	fseek(f, 0, SEEK_SET);
+
+	// validate the header 
+	Features_Cache_Header expected, header; 
+	geometry_features_cache_header(expected, key);
+	const bool valid = 
+		size >= (long)sizeof(Features_Cache_Header) && 
+		fread(&header, sizeof(header), 1, f) == 1 && 
+		memcmp(header.magic, expected.magic, sizeof(expected.magic)) == 0 && 
+		header.header_size == expected.header_size && 
+		header.keypoint_size == expected.keypoint_size && 
+		header.image_size == expected.image_size && 
+		header.image_mtime == expected.image_mtime && 
+		header.image_hash == expected.image_hash && 
+		header.max_size == expected.max_size && 
+		header.descriptor_length == expected.descriptor_length && 
+		memcmp(header.sift_parameters, expected.sift_parameters, sizeof(expected.sift_parameters)) == 0 && 
+		header.keypoints_count >= 0 && 
+		(size_t)size == sizeof(Features_Cache_Header) + (size_t)header.keypoints_count * (sizeof(Features_Cache_Keypoint) + header.descriptor_length)
+	;
+
+	if (!valid) 
+	{
+		fclose(f);
+		return false;
+	}
+
+	// read the keypoints, the layout matches the in-memory one 
+	const size_t count = header.keypoints_count;
+	geometry_keypoints_allocate(keypoints, header.keypoints_count);
+	const bool read = 
+		fread(keypoints.positions, sizeof(Features_Cache_Keypoint), count, f) == count && 
+		fread(keypoints.descriptors, GEOMETRY_DESCRIPTOR_LENGTH, count, f) == count
+	;
+	fclose(f);
+
+	if (!read) 
+	{
+		geometry_keypoints_release(keypoints);
+		return false;
+	}
+
+	width = header.width; 
+	height = header.height;
+	return true;
+}
+
+// store extracted features 
+bool geometry_features_cache_save(const char * image_filename, const Features_Cache_Key & key, const Keypoints & keypoints, const int width, const int height)
+{
+	Features_Cache_Header header; 
+	geometry_features_cache_header(header, key);
+	header.width = width; 
+	header.height = height; 
+	header.keypoints_count = keypoints.count;
+	const size_t count = keypoints.count;
+
+	// write into temporary file and then replace the old cache, so that interrupted 
+	// write never leaves behind a broken cache 
+	char * filename = geometry_features_cache_filename(image_filename, key.max_size);
+	char * temporary = ALLOC(char, strlen(filename) + 5);
+	sprintf(temporary, "%s.tmp", filename);
+
+	bool ok = false;
+	FILE * f = fopen(temporary, "wb");
+	if (f) 
+	{
+		ok = 
+			fwrite(&header, sizeof(header), 1, f) == 1 && 
+			fwrite(keypoints.positions, sizeof(Features_Cache_Keypoint), count, f) == count && 
+			fwrite(keypoints.descriptors, GEOMETRY_DESCRIPTOR_LENGTH, count, f) == count
+		;
+		ok = fclose(f) == 0 && ok;
+
+		if (ok)
+		{
+			remove(filename); 
+			ok = rename(temporary, filename) == 0;
+		}
+
+		if (!ok) remove(temporary);
+	}
+
+	FREE(temporary);
+	FREE(filename);
+	return ok;
+}
@@ -0,0 +1,62 @@
+/*
+
+  insight3d - image based 3d modelling software
+  Copyright (C) 2007-2008  Lukas Mach
+                           email: lukas.mach@gmail.com 
+                           web: http://mach.matfyz.cz/
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+  
+*/
+
+#ifndef __GEOMETRY_FEATURES_CACHE
+#define __GEOMETRY_FEATURES_CACHE
+
+#include "portability.h"
+#include "core_debug.h"
+#include "geometry_structures.h"
+
+// SIFT features extracted from an image are cached in a binary file next to the image 
+// ("<image filename>.<max size>.i3dsift"); the file consists of fixed size header, 
+// array of keypoint positions and contiguous matrix of 8-bit descriptors, so they 
+// are read straight into the keypoint arrays without any parsing
+
+// identifies data and settings the features were extracted from; the cache is stored 
+// next to the image, so the image's path is part of the key implicitly
+struct Features_Cache_Key
+{
+	unsigned long long image_size;   // size of the image file in bytes 
+	long long image_mtime;           // last modification time of the image file 
+	unsigned long long image_hash;   // hash of the first few kilobytes of the image file 
+	int max_size;                    // image was scaled down below this size before extraction
+};
+
+// fill in the part of the key describing the image file (everything but max_size), 
+// returns false if the file can't be read 
+bool geometry_features_cache_key(const char * image_filename, Features_Cache_Key & key);
+
+// filename of the cache for given image and resolution (caller releases it)
+char * geometry_features_cache_filename(const char * image_filename, const int max_size);
+
+// load cached features; returns false if there is no cache or if it was computed from different 
+// image or with different settings; width and height are the dimensions of the (scaled down) 
+// image the features were extracted from 
+bool geometry_features_cache_load(const char * image_filename, const Features_Cache_Key & key, Keypoints & keypoints, int & width, int & height);
+
+// store extracted features 
+bool geometry_features_cache_save(const char * image_filename, const Features_Cache_Key & key, const Keypoints & keypoints, const int width, const int height);
+
+#endif
@@ -23,6 +23,8 @@
 */
 
 #include "geometry_structures.h"
+#include "mvg_descriptor_index.h"
+#include "core_parallel.h"
 
 DYNAMIC_STRUCTURE(Indices, Index);
 DYNAMIC_STRUCTURE(Double_Indices, Double_Index);
@@ -30,11 +32,10 @@ DYNAMIC_STRUCTURE(Selected_Items, Selected_Item)
 DYNAMIC_STRUCTURE(Points, Point); 
 DYNAMIC_STRUCTURE(Vertices, Vertex);
 DYNAMIC_STRUCTURE(Vertices_Incidence, Vertex_Incidence);
+DYNAMIC_STRUCTURE(Vertices_Polygons, Vertex_Polygons);
 DYNAMIC_STRUCTURE(Polygons_3d, Polygon_3d);
 DYNAMIC_STRUCTURE(Contours, Contour);
 DYNAMIC_STRUCTURE(Shots, Shot);
-DYNAMIC_STRUCTURE(Shot_Pair_Relations, Shot_Pair_Relation);
-DYNAMIC_STRUCTURE(Shots_Relations, Shot_Relations);
 DYNAMIC_STRUCTURE(Calibration_Points_Meta, Calibration_Point_Meta);
 DYNAMIC_STRUCTURE(Calibration_Fundamental_Matrices, Calibration_Fundamental_Matrix);
 DYNAMIC_STRUCTURE(Calibration_Cameras, Calibration_Camera);
@@ -48,6 +49,7 @@ Shots_Relations shots_relations; // relations between groups of shots
 Polygons_3d polygons; // 3d polygons 
 Vertices vertices; // 3d vertices
 Vertices_Incidence vertices_incidence; // incidence
+Vertices_Polygons vertices_polygons; // polygons of every vertex 
 Calibrations calibrations; // calibrations
 std::map<int, std::map<int, unsigned int> > detected_edges; // debug
 
@@ -57,8 +59,9 @@ std::map<int, std::map<int, unsigned int> > detected_edges; // debug
 bool geometry_initialize()
 {
 	DYN_INIT(shots); 
-	DYN_INIT(shots_relations);
+	memset(&shots_relations, 0, sizeof(Shots_Relations));
 	DYN_INIT(polygons); 
+	DYN_INIT(vertices_polygons); 
 	DYN_INIT(vertices);
 	DYN_INIT(calibrations);
 
@@ -88,22 +91,15 @@ void geometry_release()
 	for ALL(shots, i) 
 	{
 		DYN_FREE(shots.data[i].points);
-		if (shots.data[i].keypoints) 
-		{
-			free(shots.data[i].keypoints);
-		}
+		geometry_keypoints_release(shots.data[i].keypoints);
 
-		if (shots.data[i].kd_tree) 
-		{ 
-			kdtree_release(shots.data[i].kd_tree); 
-			shots.data[i].kd_tree = NULL; 
-		}
-		shots.data[i].keypoints_count = 0;
-	}
+		mvg_descriptor_index_release(shots.data[i].descriptor_index); 
+		shots.data[i].descriptor_index = NULL; 
 
-	for ALL(polygons, i) 
-	{
-		DYN_FREE(polygons.data[i].vertices);
+		// matching meta lives as long as the keypoints (the matching tool releases 
+		// it's grid before finishing, so only the image size is left there)
+		if (shots.data[i].matching) FREE(shots.data[i].matching);
+		shots.data[i].matching = NULL;
 	}
 
 	for ALL(calibrations, i) 
@@ -129,10 +125,11 @@ void geometry_release()
 		DYN_FREE(calibrations.data[i].Ps);
 	}
 
+	geometry_release_shots_relations();
 	DYN_FREE(shots);
 	DYN_FREE(vertices_incidence);
 	DYN_FREE(vertices);
-	DYN_FREE(polygons);
+	geometry_release_polygons();
 	DYN_FREE(calibrations);
 }
 
@@ -237,6 +234,15 @@ void geometry_sort_double_indices_secondary_desc(Double_Indices * indices)
 	qsort(indices->data, indices->count, sizeof(Double_Index), geometry_sort_double_indices_secondary_comparator);
 }
 
+int geometry_sort_size_t_comparator(const void * pi, const void * pj) 
+{
+	const size_t i = *(const size_t *)pi, j = *(const size_t *)pj;
+
+	if (i < j) return -1; 
+	else if (i > j) return 1; 
+	else return 0;
+}
+
 // * deleting * 
 
 // delete point
@@ -248,60 +254,102 @@ void geometry_delete_point(size_t shot_id, size_t point_id) // todo remove it fr
 	// remove from incidence structure
 	size_t vertex_id = shots.data[shot_id].points.data[point_id].vertex;
 	ASSERT_IS_SET(vertices_incidence, vertex_id);
-	for ALL(vertices_incidence.data[vertex_id].shot_point_ids, i) 
+	Double_Indices & shot_point_ids = vertices_incidence.data[vertex_id].shot_point_ids;
+	for ALL(shot_point_ids, i) 
 	{
-		Double_Index * index = vertices_incidence.data[vertex_id].shot_point_ids.data + i; 
+		const Double_Index * index = shot_point_ids.data + i; 
 
 		if (index->primary == shot_id && index->secondary == point_id)
 		{
-			index->set = false;
+			// move the last entry here, so that the list doesn't fill up with deleted entries 
+			shot_point_ids.data[i] = LAST(shot_point_ids);
+			shot_point_ids.count--;
+			while (shot_point_ids.count > 0 && !LAST(shot_point_ids).set) shot_point_ids.count--;
+			break;
 		}
 	}
 
 	shots.data[shot_id].points.data[point_id].set = false;
 }
 
+// remove one occurrence of polygon from the list of polygons of a vertex 
+static void geometry_vertex_polygons_remove(const size_t vertex_id, const size_t polygon_id)
+{
+	if (!IS_SET(vertices_polygons, vertex_id)) return;
+
+	Indices & polygon_ids = vertices_polygons.data[vertex_id].polygon_ids; 
+	for ALL(polygon_ids, i) 
+	{
+		if (polygon_ids.data[i].value == polygon_id) 
+		{
+			// move the last entry here 
+			polygon_ids.data[i] = LAST(polygon_ids);
+			polygon_ids.count--;
+			while (polygon_ids.count > 0 && !LAST(polygon_ids).set) polygon_ids.count--;
+			return;
+		}
+	}
+}
+
 // delete polygon
 void geometry_delete_polygon(const size_t polygon_id) 
 {
 	ASSERT_IS_SET(polygons, polygon_id);
+
+	// the polygon no longer belongs to it's vertices 
+	for ALL(polygons.data[polygon_id].vertices, i) 
+	{
+		geometry_vertex_polygons_remove(polygons.data[polygon_id].vertices.data[i].value, polygon_id);
+	}
+
 	polygons.data[polygon_id].set = false; 
 }
 
-// delete vertex (and all it's points, incidence structure, ...) 
-void geometry_delete_vertex(const size_t vertex_id)
+// remove deleted vertices from polygon (either those marked in deleted or, if deleted 
+// is NULL, the single vertex_id); polygon is deleted if it degenerates 
+static void geometry_polygon_remove_deleted(const size_t polygon_id, const bool * deleted, const size_t vertex_id)
 {
-	ASSERT_IS_SET(vertices, vertex_id);
-	ASSERT_IS_SET(vertices_incidence, vertex_id);
+	if (!IS_SET(polygons, polygon_id)) return;
 
-	for ALL(polygons, polygon_id) 
+	Indices & polygon_vertices = polygons.data[polygon_id].vertices;
+	size_t remaining = 0; 
+	for ALL(polygon_vertices, i) 
 	{
-		// try to find the vertex on this polygon
-		size_t id;
-		bool found;
-		LAMBDA_FIND(polygons.data[polygon_id].vertices, id, found, polygons.data[polygon_id].vertices.data[id].value == vertex_id);
-
-		// if it is there, delete it 
-		if (found) 
+		const size_t id = polygon_vertices.data[i].value; 
+		if (deleted ? id < vertices.count && deleted[id] : id == vertex_id) 
 		{
-			polygons.data[polygon_id].vertices.data[id].set = false;
-
-			// is the polygon now degenerated?
-			size_t count = 0;
-			for ALL(polygons.data[polygon_id].vertices, i) 
-			{
-				count++;
-				if (count >= 2) break;
-			}
-
-			if (count < 2)
-			{
-				// delete the polygon
-				geometry_delete_polygon(polygon_id);
-			}
+			polygon_vertices.data[i].set = false;
+		}
+		else
+		{
+			remaining++;
 		}
 	}
 
+	// is the polygon now degenerated?
+	if (remaining < 2)
+	{
+		geometry_delete_polygon(polygon_id);
+	}
+}
+
+// take away the list of polygons of a vertex (caller releases it)
+static Indices geometry_vertex_polygons_detach(const size_t vertex_id)
+{
+	Indices polygon_ids; 
+	DYN_INIT(polygon_ids);
+	if (!IS_SET(vertices_polygons, vertex_id)) return polygon_ids;
+
+	polygon_ids = vertices_polygons.data[vertex_id].polygon_ids;
+	DYN_INIT(vertices_polygons.data[vertex_id].polygon_ids);
+	vertices_polygons.data[vertex_id].set = false;
+	return polygon_ids;
+}
+
+// delete all points of a vertex together with the vertex itself (polygons 
+// are not updated) 
+static void geometry_delete_vertex_points(const size_t vertex_id)
+{
 	for ALL(vertices_incidence.data[vertex_id].shot_point_ids, i)
 	{
 		const Double_Index * index = vertices_incidence.data[vertex_id].shot_point_ids.data + i;
@@ -315,6 +363,60 @@ void geometry_delete_vertex(const size_t vertex_id)
 	vertices_incidence.data[vertex_id].set = false;
 }
 
+// delete vertex (and all it's points, incidence structure, ...) 
+void geometry_delete_vertex(const size_t vertex_id)
+{
+	ASSERT_IS_SET(vertices, vertex_id);
+	ASSERT_IS_SET(vertices_incidence, vertex_id);
+
+	// remove the vertex from all polygons it belongs to 
+	Indices polygon_ids = geometry_vertex_polygons_detach(vertex_id);
+	for ALL(polygon_ids, i) 
+	{
+		geometry_polygon_remove_deleted(polygon_ids.data[i].value, NULL, vertex_id);
+	}
+	DYN_FREE(polygon_ids);
+
+	geometry_delete_vertex_points(vertex_id);
+}
+
+// delete several vertices at once; every affected polygon is updated only once 
+void geometry_delete_vertices(const size_t * vertex_ids, const size_t count)
+{
+	if (count == 0) return;
+
+	// mark vertices being deleted and take away their lists of polygons 
+	bool * deleted = ALLOC(bool, vertices.count);
+	memset(deleted, 0, sizeof(bool) * vertices.count);
+	Indices * polygon_ids = ALLOC(Indices, count);
+	for (size_t i = 0; i < count; i++) 
+	{
+		ASSERT_IS_SET(vertices, vertex_ids[i]);
+		ASSERT_IS_SET(vertices_incidence, vertex_ids[i]);
+		deleted[vertex_ids[i]] = true;
+		polygon_ids[i] = geometry_vertex_polygons_detach(vertex_ids[i]);
+	}
+
+	// remove them from affected polygons, delete polygons which degenerate 
+	// (polygon visited again has no deleted vertices left)
+	for (size_t i = 0; i < count; i++) 
+	{
+		for ALL(polygon_ids[i], j) 
+		{
+			geometry_polygon_remove_deleted(polygon_ids[i].data[j].value, deleted, SIZE_MAX);
+		}
+		DYN_FREE(polygon_ids[i]);
+	}
+	FREE(polygon_ids);
+
+	for (size_t i = 0; i < count; i++) 
+	{
+		if (IS_SET(vertices, vertex_ids[i])) geometry_delete_vertex_points(vertex_ids[i]);
+	}
+
+	FREE(deleted);
+}
+
 // * accessors and modifiers *
 
 // add 2d point vertex incidence
@@ -372,6 +474,24 @@ bool geometry_new_shot(size_t & shot)
 	return true;
 }
 
+// allocate keypoints storage 
+void geometry_keypoints_allocate(Keypoints & keypoints, const int count)
+{
+	keypoints.count = count; 
+	keypoints.positions = ALLOC(double, 2 * count > 0 ? 2 * count : 1);
+	keypoints.descriptors = ALLOC(unsigned char, count > 0 ? count * GEOMETRY_DESCRIPTOR_LENGTH : 1);
+}
+
+// release keypoints storage 
+void geometry_keypoints_release(Keypoints & keypoints)
+{
+	if (keypoints.positions) FREE(keypoints.positions); 
+	if (keypoints.descriptors) FREE(keypoints.descriptors);
+	keypoints.positions = NULL; 
+	keypoints.descriptors = NULL; 
+	keypoints.count = 0;
+}
+
 // initialize containers for camera calibration 
 bool geometry_shot_new_calibration_containers(const size_t shot_id)
 {
@@ -441,9 +561,41 @@ bool geometry_polygon_add_vertex(size_t polygon_id, size_t vertex_index)
 	// add vertex
 	polygons.data[polygon_id].vertices.data[id].value = vertex_index;
 
+	// and remember that the vertex belongs to this polygon 
+	DYN(vertices_polygons, vertex_index);
+	ADD(vertices_polygons.data[vertex_index].polygon_ids);
+	LAST(vertices_polygons.data[vertex_index].polygon_ids).value = polygon_id;
+
 	return true; 
 }
 
+// remove vertex from polygon 
+void geometry_polygon_remove_vertex(const size_t polygon_id, const size_t index)
+{
+	ASSERT_IS_SET(polygons, polygon_id);
+	ASSERT_IS_SET(polygons.data[polygon_id].vertices, index);
+
+	geometry_vertex_polygons_remove(polygons.data[polygon_id].vertices.data[index].value, polygon_id);
+	polygons.data[polygon_id].vertices.data[index].set = false;
+}
+
+// release all polygons 
+void geometry_release_polygons()
+{
+	for ALL(polygons, i) 
+	{
+		DYN_FREE(polygons.data[i].vertices);
+	}
+
+	for ALL(vertices_polygons, i) 
+	{
+		DYN_FREE(vertices_polygons.data[i].polygon_ids);
+	}
+
+	DYN_FREE(polygons);
+	DYN_FREE(vertices_polygons);
+}
+
 // * releasing * 
 
 // release shot calibration 
@@ -470,12 +622,56 @@ void geometry_release_shots_calibrations()
 
 // * builders * 
 
-// for each vertex create list of shots on which said vertex is visible
+// for each vertex create list of shots on which said vertex is visible; 
+// the incidence is kept up to date when points and vertices are created or 
+// deleted, so this is needed only after points were modified directly (e.g., 
+// by bulk loading); every list is allocated with exactly the needed size 
 void geometry_build_vertices_incidence()
 {
-	// initialize dynamic list (we have one entry for each vertex with 
-	// each entry containing another dynamic list of shots)
-	DYN_INIT(vertices_incidence); // todo fix leaking
+	// release the previous lists 
+	for ALL(vertices_incidence, i) 
+	{
+		DYN_FREE(vertices_incidence.data[i].shot_point_ids);
+	}
+	DYN_FREE(vertices_incidence);
+
+	// count observations of every vertex 
+	size_t count = vertices.count;
+	for ALL(shots, i)
+	{
+		for ALL(shots.data[i].points, j)
+		{
+			if (shots.data[i].points.data[j].vertex >= count) count = shots.data[i].points.data[j].vertex + 1;
+		}
+	}
+
+	if (count == 0) return;
+	size_t * const observations = ALLOC(size_t, count);
+	memset(observations, 0, sizeof(size_t) * count);
+	for ALL(shots, i)
+	{
+		for ALL(shots.data[i].points, j)
+		{
+			observations[shots.data[i].points.data[j].vertex]++;
+		}
+	}
+
+	// allocate one entry for each vertex with each entry containing the list of it's shots 
+	vertices_incidence.data = ALLOC(Vertex_Incidence, count);
+	memset(vertices_incidence.data, 0, sizeof(Vertex_Incidence) * count);
+	vertices_incidence.allocated = vertices_incidence.count = count;
+	for (size_t i = 0; i < count; i++) 
+	{
+		if (observations[i] == 0 && !IS_SET(vertices, i)) continue;
+
+		Vertex_Incidence * const incidence = vertices_incidence.data + i;
+		incidence->set = true;
+		if (observations[i] == 0) continue;
+		incidence->shot_point_ids.data = ALLOC(Double_Index, observations[i]);
+		incidence->shot_point_ids.allocated = observations[i];
+	}
+
+	FREE(observations);
 
 	// go through all shots 
 	for ALL(shots, i)
@@ -488,56 +684,159 @@ void geometry_build_vertices_incidence()
 			const Point * point = shot->points.data + j; 
 
 			// save information about the fact that we can see this vertex on i-th shot
-			DYN(vertices_incidence, point->vertex);
-			ADD(vertices_incidence.data[point->vertex].shot_point_ids);
+			Double_Indices & shot_point_ids = vertices_incidence.data[point->vertex].shot_point_ids;
+			Double_Index * const index = shot_point_ids.data + shot_point_ids.count++;
 
 			// save the shot and point indices
-			LAST(vertices_incidence.data[point->vertex].shot_point_ids).primary = i; 
-			LAST(vertices_incidence.data[point->vertex].shot_point_ids).secondary = j; 
+			index->set = true;
+			index->primary = i; 
+			index->secondary = j; 
 		}
 	}
 }
 
-// for each shot compute how many correspondences this shot has
-// with the other ones 
-void geometry_build_shots_relations()
+// row of the shots relations graph computed by one thread 
+struct Geometry_Relations_Row 
 {
-	DYN_FREE(shots_relations);
-	DYN_INIT(shots_relations);
+	size_t count; 
+	size_t * neighbours, * correspondences_count;
+};
 
-	// initialize to zeros 
-	// note that this will eat up unnecessary amount of memory 
-	// on large sparsely connected scenes 
-	for ALL(shots, i) 
+// state shared by threads building rows of the shots relations graph 
+struct Geometry_Relations_Job 
+{
+	Geometry_Relations_Row * rows; 
+	size_t * * counters;           // per-thread counters of correspondences with every shot (zeroed between rows)
+	size_t * * touched;            // per-thread lists of shots with non-zero counters 
+};
+
+// count correspondences of one shot with all other shots, called from worker threads 
+void geometry_build_shots_relations_job(void * arg, const size_t item, const size_t thread_id)
+{
+	Geometry_Relations_Job * const job = (Geometry_Relations_Job *)arg; 
+	Geometry_Relations_Row * const row = job->rows + item; 
+	size_t * const counters = job->counters[thread_id], * const touched = job->touched[thread_id]; 
+	size_t touched_count = 0;
+	row->count = 0;
+	row->neighbours = row->correspondences_count = NULL;
+	if (!IS_SET(shots, item)) return;
+
+	// every point of the shot adds one correspondence with the other shots its vertex is visible on 
+	const Shot * const shot = shots.data + item; 
+	for ALL(shot->points, i) 
 	{
-		DYN(shots_relations, i);
-		Shot_Relations * const relations = shots_relations.data + i;
+		const size_t vertex_id = shot->points.data[i].vertex; 
+		if (!IS_SET(vertices_incidence, vertex_id)) continue;
+		const Vertex_Incidence * const incidence = vertices_incidence.data + vertex_id; 
 
-		for ALL(shots, j) 
+		for ALL(incidence->shot_point_ids, j) 
 		{
-			DYN(relations->pair_relations, j); 
-			relations->pair_relations.data[j].correspondences_count = 0; 			
+			const size_t shot_id = incidence->shot_point_ids.data[j].primary; 
+			if (shot_id == item) continue; 
+			ASSERT(shot_id < shots.count, "incidence refers to invalid shot");
+
+			if (counters[shot_id]++ == 0) touched[touched_count++] = shot_id;
 		}
 	}
 
-	// now count the correspondences 
-	for ALL(vertices_incidence, i) 
+	// store the row sorted by shot id and reset the counters 
+	if (touched_count == 0) return;
+	qsort(touched, touched_count, sizeof(size_t), geometry_sort_size_t_comparator);
+	row->count = touched_count; 
+	row->neighbours = ALLOC(size_t, touched_count); 
+	row->correspondences_count = ALLOC(size_t, touched_count); 
+	for (size_t k = 0; k < touched_count; k++) 
+	{
+		row->neighbours[k] = touched[k]; 
+		row->correspondences_count[k] = counters[touched[k]]; 
+		counters[touched[k]] = 0;
+	}
+}
+
+// for each shot compute how many correspondences this shot has
+// with the other ones 
+void geometry_build_shots_relations(const size_t threads_count /*= 1*/)
+{
+	geometry_release_shots_relations();
+	const size_t n = shots.count;
+
+	// compute rows in parallel 
+	Geometry_Relations_Job job; 
+	job.rows = ALLOC(Geometry_Relations_Row, n > 0 ? n : 1);
+	job.counters = ALLOC(size_t *, threads_count); 
+	job.touched = ALLOC(size_t *, threads_count);
+	for (size_t t = 0; t < threads_count; t++) 
+	{
+		job.counters[t] = ALLOC(size_t, n > 0 ? n : 1);
+		memset(job.counters[t], 0, sizeof(size_t) * n);
+		job.touched[t] = ALLOC(size_t, n > 0 ? n : 1);
+	}
+
+	core_parallel_for(n, threads_count, geometry_build_shots_relations_job, &job);
+
+	// concatenate them 
+	shots_relations.shots_count = n; 
+	shots_relations.first = ALLOC(size_t, n + 1);
+	shots_relations.first[0] = 0;
+	for (size_t i = 0; i < n; i++) 
+	{
+		shots_relations.first[i + 1] = shots_relations.first[i] + job.rows[i].count;
+	}
+
+	const size_t entries = shots_relations.first[n];
+	shots_relations.neighbours = ALLOC(size_t, entries > 0 ? entries : 1);
+	shots_relations.correspondences_count = ALLOC(size_t, entries > 0 ? entries : 1);
+	for (size_t i = 0; i < n; i++) 
 	{
-		const Vertex_Incidence * const vertex_incidence = vertices_incidence.data + i; 
+		Geometry_Relations_Row * const row = job.rows + i;
+		if (row->count == 0) continue;
+		memcpy(shots_relations.neighbours + shots_relations.first[i], row->neighbours, sizeof(size_t) * row->count);
+		memcpy(shots_relations.correspondences_count + shots_relations.first[i], row->correspondences_count, sizeof(size_t) * row->count);
+		FREE(row->neighbours);
+		FREE(row->correspondences_count);
+	}
+
+	// release memory 
+	for (size_t t = 0; t < threads_count; t++) 
+	{
+		FREE(job.counters[t]);
+		FREE(job.touched[t]);
+	}
+	FREE(job.counters);
+	FREE(job.touched);
+	FREE(job.rows);
+}
 
-		for ALL(vertex_incidence->shot_point_ids, j) 
+// release the graph of shots relations 
+void geometry_release_shots_relations()
+{
+	if (shots_relations.first) FREE(shots_relations.first);
+	if (shots_relations.neighbours) FREE(shots_relations.neighbours);
+	if (shots_relations.correspondences_count) FREE(shots_relations.correspondences_count);
+	memset(&shots_relations, 0, sizeof(Shots_Relations));
+}
+
+// number of correspondences between two shots 
+size_t geometry_shots_correspondences(const size_t shot_id1, const size_t shot_id2)
+{
+	if (shot_id1 >= shots_relations.shots_count) return 0;
+
+	// binary search in the row of the first shot 
+	size_t low = shots_relations.first[shot_id1], high = shots_relations.first[shot_id1 + 1];
+	while (low < high) 
+	{
+		const size_t middle = low + (high - low) / 2; 
+		if (shots_relations.neighbours[middle] < shot_id2) 
+		{
+			low = middle + 1; 
+		}
+		else
 		{
-			const Double_Index * const index1 = vertex_incidence->shot_point_ids.data + j;
-
-			for ALL(vertex_incidence->shot_point_ids, k) 
-			{
-				if (j == k) continue; 
-				const Double_Index * const index2 = vertex_incidence->shot_point_ids.data + k; 
-				
-				shots_relations.data[index1->primary].pair_relations.data[index2->primary].correspondences_count++;
-			}
+			high = middle;
 		}
 	}
+
+	return low < shots_relations.first[shot_id1 + 1] && shots_relations.neighbours[low] == shot_id2 ? shots_relations.correspondences_count[low] : 0;
 }
 
 
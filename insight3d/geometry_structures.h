@@ -117,6 +117,13 @@ struct Vertex_Incidence {
 	Double_Indices shot_point_ids;
 }; 
 
+// stores which polygons each vertex belongs to (polygon is listed once for every 
+// occurrence of the vertex in it)
+struct Vertex_Polygons { 
+	bool set; 
+	Indices polygon_ids; 
+}; 
+
 // 3d polygon
 struct Polygon_3d {
 	bool set;
@@ -138,9 +145,26 @@ struct Contour {
 DYNAMIC_STRUCTURE_DECLARATIONS(Points, Point); 
 DYNAMIC_STRUCTURE_DECLARATIONS(Vertices, Vertex);
 DYNAMIC_STRUCTURE_DECLARATIONS(Vertices_Incidence, Vertex_Incidence);
+DYNAMIC_STRUCTURE_DECLARATIONS(Vertices_Polygons, Vertex_Polygons);
 DYNAMIC_STRUCTURE_DECLARATIONS(Polygons_3d, Polygon_3d);
 DYNAMIC_STRUCTURE_DECLARATIONS(Contours, Contour);
 
+// length of keypoint descriptors 
+const int GEOMETRY_DESCRIPTOR_LENGTH = 128;
+
+// keypoints extracted from an image, stored as structure of arrays; SIFT descriptors 
+// consist of integers from 0 to 255, so they are kept as bytes in one contiguous 
+// count x GEOMETRY_DESCRIPTOR_LENGTH matrix 
+struct Keypoints
+{
+	int count; 
+	double * positions;          // x and y coordinates of i-th keypoint are at 2 * i and 2 * i + 1 
+	unsigned char * descriptors; // descriptor of i-th keypoint starts at GEOMETRY_DESCRIPTOR_LENGTH * i 
+};
+
+// index for searching keypoint descriptors (see mvg_descriptor_index.h)
+struct Descriptor_Index;
+
 // photograph metainformation
 struct Shot {
 
@@ -170,9 +194,8 @@ struct Shot {
 	Image_Loader_Request_Handle image_loader_request; 
 
 	// extracted keypoints
-	feature * keypoints;   // SIFT keypoints
-	int keypoints_count;
-	kd_node * kd_tree;     // root node of kd-tree containing nodes
+	Keypoints keypoints;   // SIFT keypoints
+	Descriptor_Index * descriptor_index; // index over their descriptors 
 	void * matching;       // additional info for matching tool
 
 	// visualization values
@@ -198,24 +221,18 @@ struct Shot {
 // dynamic array of photographs
 DYNAMIC_STRUCTURE_DECLARATIONS(Shots, Shot);
 
-// shot pair relation describes relations between pair of shots 
-// (like number of correspondences between the pair)
-struct Shot_Pair_Relation 
+// covisibility graph of shots, for every shot it holds the other shots sharing 
+// vertices with it together with the number of correspondences between the pair; 
+// stored as compressed sparse rows (neighbours of shot i are entries first[i] .. 
+// first[i + 1] - 1, sorted by shot id)
+struct Shots_Relations 
 {
-	bool set; 
-	size_t correspondences_count;    // number of correspondences
+	size_t shots_count; 
+	size_t * first;                  // shots_count + 1 entries 
+	size_t * neighbours;             // ids of neighbouring shots 
+	size_t * correspondences_count;  // number of correspondences with the neighbour 
 };
 
-DYNAMIC_STRUCTURE_DECLARATIONS(Shot_Pair_Relations, Shot_Pair_Relation); 
-
-struct Shot_Relations
-{
-	bool set; 
-	Shot_Pair_Relations pair_relations;
-}; 
-
-DYNAMIC_STRUCTURE_DECLARATIONS(Shots_Relations, Shot_Relations);
-
 // * calibrations *
 
 struct Calibration_Point_Meta 
@@ -280,6 +297,7 @@ extern Shots_Relations shots_relations; // relations between shots (usualy pairs
 extern Polygons_3d polygons; // 3d polygons 
 extern Vertices vertices; // 3d vertices
 extern Vertices_Incidence vertices_incidence; // incidence
+extern Vertices_Polygons vertices_polygons; // polygons of every vertex 
 extern Calibrations calibrations; // calibrations
 extern std::map<int, std::map<int, unsigned int> > detected_edges;
 
@@ -318,6 +336,7 @@ int geometry_sort_double_indices_primary_comparator_desc(const void * pi, const
 void geometry_sort_double_indices_primary_desc(Double_Indices * indices);
 int geometry_sort_double_indices_secondary_comparator_desc(const void * pi, const void * pj);
 void geometry_sort_double_indices_secondary_desc(Double_Indices * indices);
+int geometry_sort_size_t_comparator(const void * pi, const void * pj);
 
 // * deleting * 
 
@@ -327,6 +346,9 @@ void geometry_delete_point(size_t shot_id, size_t point_id);
 // delete vertex (and all it's points, incidence structure, ...) 
 void geometry_delete_vertex(size_t vertex_id);
 
+// delete several vertices at once (duplicate ids are allowed)
+void geometry_delete_vertices(const size_t * vertex_ids, const size_t count);
+
 // delete polygon
 void geometry_delete_polygon(const size_t polygon_id);
 
@@ -361,11 +383,23 @@ bool geometry_new_point(size_t & point_id, double x, double y, size_t shot_id, s
 // create new polygon 
 bool geometry_new_polygon(size_t & id);
 
+// allocate keypoints storage (previous content is not released)
+void geometry_keypoints_allocate(Keypoints & keypoints, const int count);
+
+// release keypoints storage 
+void geometry_keypoints_release(Keypoints & keypoints);
+
 // * modifying polygons *
 
 // add vertex to polygon 
 bool geometry_polygon_add_vertex(size_t polygon_id, size_t vertex_index);
 
+// remove vertex from polygon (index is the position of the vertex in polygon's list)
+void geometry_polygon_remove_vertex(const size_t polygon_id, const size_t index);
+
+// release all polygons 
+void geometry_release_polygons();
+
 // * releasing * 
 
 // release calibration matrices
@@ -376,12 +410,20 @@ void geometry_release_shots_calibrations();
 
 // * builders * 
 
-// for each vertex create list of shots on which said vertex is visible
+// for each vertex create list of shots on which said vertex is visible (the list 
+// is maintained by routines creating and deleting points and vertices, rebuild 
+// it only after modifying points directly)
 void geometry_build_vertices_incidence();
 
 // for each shot compute how many correspondences this shot has 
 // with the other ones 
-void geometry_build_shots_relations();
+void geometry_build_shots_relations(const size_t threads_count = 1);
+
+// release the graph of shots relations 
+void geometry_release_shots_relations();
+
+// number of correspondences between two shots (according to the last built relations)
+size_t geometry_shots_correspondences(const size_t shot_id1, const size_t shot_id2);
 
 #endif
 
@@ -0,0 +1,256 @@
+/*
+
+  insight3d - image based 3d modelling software
+  Copyright (C) 2007-2008  Lukas Mach
+                           email: lukas.mach@gmail.com 
+                           web: http://mach.matfyz.cz/
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+  
+*/
+
+#include "mvg_bundle.h"
+
+// projection using projective camera 
+void mvg_bundle_projective_projection(int j, int i, double * aj, double * bi, double * xij, void * adata)
+{
+	double w = aj[2 * 4 + 0] * bi[0] + aj[2 * 4 + 1] * bi[1] + aj[2 * 4 + 2] * bi[2] + aj[2 * 4 + 3] * bi[3];
+	if (w == 0) w = 0e-8; // note dirty...
+	xij[0] = (aj[0 * 4 + 0] * bi[0] + aj[0 * 4 + 1] * bi[1] + aj[0 * 4 + 2] * bi[2] + aj[0 * 4 + 3] * bi[3]) / w;
+	xij[1] = (aj[1 * 4 + 0] * bi[0] + aj[1 * 4 + 1] * bi[1] + aj[1 * 4 + 2] * bi[2] + aj[1 * 4 + 3] * bi[3]) / w;
+}
+
+// jacobian of projection using projective camera; for x = p0.X / p2.X, the derivatives 
+// are dx/dp0 = X / w, dx/dp2 = -x X / w and dx/dX = (p0 - x p2) / w (similarly for y)
+void mvg_bundle_projective_jacobian(int j, int i, double * aj, double * bi, double * Aij, double * Bij, void * adata)
+{
+	const double w = aj[2 * 4 + 0] * bi[0] + aj[2 * 4 + 1] * bi[1] + aj[2 * 4 + 2] * bi[2] + aj[2 * 4 + 3] * bi[3];
+	const double inv_w = 1 / w;
+	const double x = (aj[0 * 4 + 0] * bi[0] + aj[0 * 4 + 1] * bi[1] + aj[0 * 4 + 2] * bi[2] + aj[0 * 4 + 3] * bi[3]) * inv_w;
+	const double y = (aj[1 * 4 + 0] * bi[0] + aj[1 * 4 + 1] * bi[1] + aj[1 * 4 + 2] * bi[2] + aj[1 * 4 + 3] * bi[3]) * inv_w;
+
+	for (int k = 0; k < 4; k++) 
+	{
+		// derivatives by camera parameters 
+		Aij[0 * 12 + 0 * 4 + k] = bi[k] * inv_w; 
+		Aij[0 * 12 + 1 * 4 + k] = 0;
+		Aij[0 * 12 + 2 * 4 + k] = -x * bi[k] * inv_w; 
+		Aij[1 * 12 + 0 * 4 + k] = 0;
+		Aij[1 * 12 + 1 * 4 + k] = bi[k] * inv_w; 
+		Aij[1 * 12 + 2 * 4 + k] = -y * bi[k] * inv_w; 
+
+		// derivatives by vertex coordinates
+		Bij[0 * 4 + k] = (aj[0 * 4 + k] - x * aj[2 * 4 + k]) * inv_w;
+		Bij[1 * 4 + k] = (aj[1 * 4 + k] - y * aj[2 * 4 + k]) * inv_w;
+	}
+}
+
+// rotation matrix of angle-axis vector (Rodrigues' formula), derivatives are computed 
+// using formula from Gallego and Yezzi, A compact formula for the derivative of a 3-D 
+// rotation in exponential coordinates 
+void mvg_bundle_rotation(const double w[3], double R[9], double * dR)
+{
+	const double theta_sq = w[0] * w[0] + w[1] * w[1] + w[2] * w[2];
+	const double theta = sqrt(theta_sq);
+
+	// cross product matrix of w and it's square 
+	const double W[9] = { 0, -w[2], w[1], w[2], 0, -w[0], -w[1], w[0], 0 };
+	double W2[9];
+	for (int r = 0; r < 3; r++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			W2[3 * r + c] = W[3 * r + 0] * W[0 + c] + W[3 * r + 1] * W[3 + c] + W[3 * r + 2] * W[6 + c];
+		}
+	}
+
+	// R = I + sin(theta) / theta [w]x + (1 - cos(theta)) / theta^2 [w]x^2 (using series for small angles)
+	double a, b;
+	if (theta < 1e-4) 
+	{
+		a = 1 - theta_sq / 6;
+		b = 0.5 - theta_sq / 24;
+	}
+	else
+	{
+		a = sin(theta) / theta;
+		b = (1 - cos(theta)) / theta_sq;
+	}
+
+	for (int k = 0; k < 9; k++) 
+	{
+		R[k] = a * W[k] + b * W2[k] + (k % 4 == 0 ? 1 : 0);
+	}
+
+	if (!dR) return;
+
+	// for small angles dR/dw_i = [e_i]x 
+	if (theta < 1e-8) 
+	{
+		for (int k = 0; k < 27; k++) dR[k] = 0;
+		for (int i = 0; i < 3; i++)
+		{
+			const double e[3] = { i == 0 ? 1.0 : 0.0, i == 1 ? 1.0 : 0.0, i == 2 ? 1.0 : 0.0 };
+			double * const D = dR + 9 * i; 
+			D[1] = -e[2]; D[2] = e[1]; 
+			D[3] = e[2]; D[5] = -e[0]; 
+			D[6] = -e[1]; D[7] = e[0];
+		}
+
+		return;
+	}
+
+	// dR/dw_i = (w_i [w]x + [w x (I - R) e_i]x) R / theta^2 
+	for (int i = 0; i < 3; i++)
+	{
+		// v = w x ((I - R) e_i)
+		const double c[3] = { (i == 0 ? 1 : 0) - R[0 + i], (i == 1 ? 1 : 0) - R[3 + i], (i == 2 ? 1 : 0) - R[6 + i] };
+		const double v[3] = { w[1] * c[2] - w[2] * c[1], w[2] * c[0] - w[0] * c[2], w[0] * c[1] - w[1] * c[0] };
+		const double M[9] = { 
+			0,                 -w[i] * w[2] - v[2], w[i] * w[1] + v[1], 
+			w[i] * w[2] + v[2], 0,                  -w[i] * w[0] - v[0], 
+			-w[i] * w[1] - v[1], w[i] * w[0] + v[0], 0 
+		};
+
+		double * const D = dR + 9 * i; 
+		for (int r = 0; r < 3; r++)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				D[3 * r + c] = (M[3 * r + 0] * R[0 + c] + M[3 * r + 1] * R[3 + c] + M[3 * r + 2] * R[6 + c]) / theta_sq;
+			}
+		}
+	}
+}
+
+// angle-axis vector of rotation matrix 
+void mvg_bundle_rotation_vector(const double R[9], double w[3])
+{
+	const double cos_theta = (R[0] + R[4] + R[8] - 1) / 2;
+	const double s[3] = { R[7] - R[5], R[2] - R[6], R[3] - R[1] }; // 2 sin(theta) axis
+
+	if (cos_theta > 1 - 1e-12) 
+	{
+		// nearly identity, w is approximately the skew symmetric part
+		w[0] = s[0] / 2; 
+		w[1] = s[1] / 2; 
+		w[2] = s[2] / 2;
+		return;
+	}
+
+	const double theta = acos(cos_theta < -1 ? -1 : cos_theta);
+	if (theta < 3.14159265358979 - 1e-4) 
+	{
+		const double k = theta / (2 * sin(theta));
+		w[0] = k * s[0]; 
+		w[1] = k * s[1]; 
+		w[2] = k * s[2];
+		return;
+	}
+
+	// theta close to pi, axis is taken from the largest diagonal element of R + I
+	int d = 0; 
+	if (R[4] > R[0]) d = 1; 
+	if (R[8] > R[4 * d]) d = 2;
+	double axis[3];
+	axis[d] = sqrt((R[4 * d] + 1) / 2);
+	for (int k = 0; k < 3; k++)
+	{
+		if (k != d) axis[k] = (R[3 * k + d] + R[3 * d + k]) / (4 * axis[d]);
+	}
+
+	// pick the sign consistent with the antisymmetric part 
+	if (axis[0] * s[0] + axis[1] * s[1] + axis[2] * s[2] < 0) 
+	{
+		axis[0] = -axis[0]; 
+		axis[1] = -axis[1]; 
+		axis[2] = -axis[2];
+	}
+
+	w[0] = theta * axis[0]; 
+	w[1] = theta * axis[1]; 
+	w[2] = theta * axis[2];
+}
+
+// projection using metric camera 
+void mvg_bundle_metric_projection(int j, int i, double * aj, double * bi, double * xij, void * adata)
+{
+	const Mvg_Bundle_Intrinsics * const K = (const Mvg_Bundle_Intrinsics *)adata + j;
+	double R[9];
+	mvg_bundle_rotation(aj, R, NULL);
+
+	// transform into camera coordinate frame and project 
+	const double 
+		X = R[0] * bi[0] + R[1] * bi[1] + R[2] * bi[2] + aj[3],
+		Y = R[3] * bi[0] + R[4] * bi[1] + R[5] * bi[2] + aj[4],
+		Z = R[6] * bi[0] + R[7] * bi[1] + R[8] * bi[2] + aj[5]
+	;
+
+	const double f = aj[6];
+	xij[0] = f * (X + K->skew * Y) / Z + K->pp_x;
+	xij[1] = f * K->aspect * Y / Z + K->pp_y;
+}
+
+// jacobian of projection using metric camera 
+void mvg_bundle_metric_jacobian(int j, int i, double * aj, double * bi, double * Aij, double * Bij, void * adata)
+{
+	const Mvg_Bundle_Intrinsics * const K = (const Mvg_Bundle_Intrinsics *)adata + j;
+	double R[9], dR[27];
+	mvg_bundle_rotation(aj, R, dR);
+
+	const double 
+		X = R[0] * bi[0] + R[1] * bi[1] + R[2] * bi[2] + aj[3],
+		Y = R[3] * bi[0] + R[4] * bi[1] + R[5] * bi[2] + aj[4],
+		Z = R[6] * bi[0] + R[7] * bi[1] + R[8] * bi[2] + aj[5]
+	;
+
+	// derivatives of the projection by the point in camera coordinate frame 
+	const double f = aj[6], inv_Z = 1 / Z;
+	const double dx[3] = { f * inv_Z, f * K->skew * inv_Z, -f * (X + K->skew * Y) * inv_Z * inv_Z };
+	const double dy[3] = { 0, f * K->aspect * inv_Z, -f * K->aspect * Y * inv_Z * inv_Z };
+
+	// by rotation 
+	for (int k = 0; k < 3; k++)
+	{
+		const double * const D = dR + 9 * k;
+		const double dX[3] = {
+			D[0] * bi[0] + D[1] * bi[1] + D[2] * bi[2],
+			D[3] * bi[0] + D[4] * bi[1] + D[5] * bi[2],
+			D[6] * bi[0] + D[7] * bi[1] + D[8] * bi[2]
+		};
+
+		Aij[0 * 7 + k] = dx[0] * dX[0] + dx[1] * dX[1] + dx[2] * dX[2];
+		Aij[1 * 7 + k] = dy[0] * dX[0] + dy[1] * dX[1] + dy[2] * dX[2];
+	}
+
+	// by translation 
+	for (int k = 0; k < 3; k++)
+	{
+		Aij[0 * 7 + 3 + k] = dx[k];
+		Aij[1 * 7 + 3 + k] = dy[k];
+	}
+
+	// by focal length 
+	Aij[0 * 7 + 6] = (X + K->skew * Y) * inv_Z;
+	Aij[1 * 7 + 6] = K->aspect * Y * inv_Z;
+
+	// by point coordinates 
+	for (int k = 0; k < 3; k++)
+	{
+		Bij[0 * 3 + k] = dx[0] * R[0 + k] + dx[1] * R[3 + k] + dx[2] * R[6 + k];
+		Bij[1 * 3 + k] = dy[0] * R[0 + k] + dy[1] * R[3 + k] + dy[2] * R[6 + k];
+	}
+}
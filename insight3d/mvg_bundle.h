@@ -0,0 +1,69 @@
+/*
+
+  insight3d - image based 3d modelling software
+  Copyright (C) 2007-2008  Lukas Mach
+                           email: lukas.mach@gmail.com 
+                           web: http://mach.matfyz.cz/
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+  
+*/
+
+#ifndef __MVG_BUNDLE
+#define __MVG_BUNDLE
+
+#include "core_debug.h"
+#include <math.h>
+
+// projection functions and their jacobians in the form expected by sba_motstr_levmar, 
+// all jacobians are 2 x cnp (Aij) and 2 x pnp (Bij) matrices stored row by row 
+
+// projective camera, aj is the 3 x 4 camera matrix stored row by row and bi is the 
+// vertex in homogeneous coordinates
+const int MVG_BUNDLE_PROJECTIVE_CAMERA_PARAMETERS = 12;
+const int MVG_BUNDLE_PROJECTIVE_POINT_PARAMETERS = 4;
+
+void mvg_bundle_projective_projection(int j, int i, double * aj, double * bi, double * xij, void * adata);
+void mvg_bundle_projective_jacobian(int j, int i, double * aj, double * bi, double * Aij, double * Bij, void * adata);
+
+// metric camera K[R|t], aj holds rotation as angle-axis vector, translation and focal 
+// length; the rest of the internal calibration matrix 
+// 
+//   K = [f  s*f  pp_x; 0  a*f  pp_y; 0  0  1] 
+// 
+// stays fixed and is passed in adata as an array of Mvg_Bundle_Intrinsics (one for 
+// every camera); bi is the vertex in inhomogeneous coordinates
+const int MVG_BUNDLE_METRIC_CAMERA_PARAMETERS = 7;
+const int MVG_BUNDLE_METRIC_POINT_PARAMETERS = 3;
+
+struct Mvg_Bundle_Intrinsics 
+{
+	double aspect;                   // ratio of focal lengths in y and x direction 
+	double skew;                     // skew relative to focal length 
+	double pp_x, pp_y;               // principal point in pixels
+};
+
+void mvg_bundle_metric_projection(int j, int i, double * aj, double * bi, double * xij, void * adata);
+void mvg_bundle_metric_jacobian(int j, int i, double * aj, double * bi, double * Aij, double * Bij, void * adata);
+
+// rotation matrix R (stored row by row) of angle-axis vector w; if dR isn't NULL, 
+// derivatives of R by the components of w are stored there (3 matrices one after another)
+void mvg_bundle_rotation(const double w[3], double R[9], double * dR);
+
+// angle-axis vector of rotation matrix R (stored row by row) 
+void mvg_bundle_rotation_vector(const double R[9], double w[3]);
+
+#endif
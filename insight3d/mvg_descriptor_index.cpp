@@ -0,0 +1,117 @@
+/*
+
+  insight3d - image based 3d modelling software
+  Copyright (C) 2007-2008  Lukas Mach
+                           email: lukas.mach@gmail.com 
+                           web: http://mach.matfyz.cz/
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+  
+*/
+
+#include "mvg_descriptor_index.h"
+
+// build index 
+Descriptor_Index * mvg_descriptor_index_build(const Keypoints & keypoints, const Descriptor_Index_Parameters & parameters)
+{
+	if (keypoints.count <= 0 || !keypoints.descriptors) return NULL;
+
+	Descriptor_Index * const index = ALLOC(Descriptor_Index, 1);
+	index->parameters = parameters;
+	index->descriptors = keypoints.descriptors;
+	index->count = keypoints.count;
+	index->forest = NULL; 
+
+	if (parameters.trees_count > 0) 
+	{
+		index->forest = mvg_kdtree_build(keypoints, parameters.trees_count);
+		if (!index->forest) 
+		{
+			FREE(index);
+			return NULL;
+		}
+	}
+
+	return index;
+}
+
+// release index 
+void mvg_descriptor_index_release(Descriptor_Index * index)
+{
+	if (!index) return;
+	mvg_kdtree_release(index->forest);
+	FREE(index);
+}
+
+// exact search, distances to all indexed descriptors are computed in one batch per query 
+static void mvg_descriptor_index_linear_knn(const Descriptor_Index * index, const unsigned char * queries, const int queries_count, const int k, int * neighbours, int * distances, int * found)
+{
+	int * const ids = ALLOC(int, index->count); 
+	int * const all_distances = ALLOC(int, index->count); 
+	for (int i = 0; i < index->count; i++)
+	{
+		ids[i] = i;
+	}
+
+	for (int q = 0; q < queries_count; q++)
+	{
+		mvg_descriptor_distances(queries + q * GEOMETRY_DESCRIPTOR_LENGTH, index->descriptors, ids, index->count, all_distances);
+
+		// keep k smallest distances sorted (on ties the lower id wins)
+		int * const query_neighbours = neighbours + q * k, * const query_distances = distances + q * k; 
+		int query_found = 0;
+		for (int i = 0; i < index->count; i++)
+		{
+			const int distance = all_distances[i];
+			if (query_found == k && distance >= query_distances[k - 1]) continue;
+
+			int j = query_found < k ? query_found++ : k - 1; 
+			while (j > 0 && query_distances[j - 1] > distance)
+			{
+				query_distances[j] = query_distances[j - 1];
+				query_neighbours[j] = query_neighbours[j - 1];
+				j--;
+			}
+
+			query_distances[j] = distance; 
+			query_neighbours[j] = i;
+		}
+
+		found[q] = query_found;
+	}
+
+	FREE(all_distances);
+	FREE(ids);
+}
+
+// find k nearest neighbours of several descriptors 
+void mvg_descriptor_index_knn(const Descriptor_Index * index, const unsigned char * queries, const int queries_count, const int k, int * neighbours, int * distances, int * found)
+{
+	if (queries_count <= 0) return;
+
+	if (!index || k <= 0) 
+	{
+		memset(found, 0, sizeof(int) * queries_count);
+	}
+	else if (index->forest) 
+	{
+		mvg_kdtree_knn(index->forest, queries, queries_count, k, index->parameters.checks, neighbours, distances, found);
+	}
+	else
+	{
+		mvg_descriptor_index_linear_knn(index, queries, queries_count, k, neighbours, distances, found);
+	}
+}
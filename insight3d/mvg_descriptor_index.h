@@ -0,0 +1,64 @@
+/*
+
+  insight3d - image based 3d modelling software
+  Copyright (C) 2007-2008  Lukas Mach
+                           email: lukas.mach@gmail.com 
+                           web: http://mach.matfyz.cz/
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+  
+*/
+
+#ifndef __MVG_DESCRIPTOR_INDEX
+#define __MVG_DESCRIPTOR_INDEX
+
+#include "core_debug.h"
+#include "geometry_structures.h"
+#include "mvg_kdtree.h"
+#include "mvg_descriptors.h"
+
+// index answering nearest neighbour queries over descriptors of one image; it's built 
+// once per shot and then queried with all keypoints of every other shot matched with it, 
+// depending on parameters it's either a forest of randomized kd-trees (approximate) or 
+// plain linear scan (exact)
+
+struct Descriptor_Index_Parameters
+{
+	int trees_count;                 // number of randomized kd-trees, 0 means exact linear search 
+	int checks;                      // number of descriptors compared with each query in kd-trees 
+};
+
+struct Descriptor_Index
+{
+	Descriptor_Index_Parameters parameters;
+	const unsigned char * descriptors; // indexed descriptors (not owned by the index) 
+	int count;
+	Keypoints_Tree * forest;         // NULL for linear search 
+};
+
+// build index over keypoints' descriptors, returns NULL if there are no keypoints
+Descriptor_Index * mvg_descriptor_index_build(const Keypoints & keypoints, const Descriptor_Index_Parameters & parameters);
+
+// release index 
+void mvg_descriptor_index_release(Descriptor_Index * index);
+
+// find k nearest neighbours of queries_count descriptors stored one after another in 
+// queries; for i-th query, ids of found keypoints and their squared distances are stored 
+// into neighbours and distances starting at i * k (in increasing order of distance) and 
+// their number into found[i]; can be called from multiple threads at once
+void mvg_descriptor_index_knn(const Descriptor_Index * index, const unsigned char * queries, const int queries_count, const int k, int * neighbours, int * distances, int * found);
+
+#endif
@@ -0,0 +1,261 @@
+/*
+
+  insight3d - image based 3d modelling software
+  Copyright (C) 2007-2008  Lukas Mach
+                           email: lukas.mach@gmail.com 
+                           web: http://mach.matfyz.cz/
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+  
+*/
+
+#include "mvg_descriptors.h"
+
+// decide which vector kernels can be compiled 
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define MVG_DESCRIPTORS_SSE2
+#if __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || defined(__clang__)
+#define MVG_DESCRIPTORS_AVX2
+#define MVG_DESCRIPTORS_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define MVG_DESCRIPTORS_SSE2
+#if _MSC_VER >= 1800
+#define MVG_DESCRIPTORS_AVX2
+#define MVG_DESCRIPTORS_AVX2_TARGET
+#endif
+#include <intrin.h>
+#endif
+
+#ifdef MVG_DESCRIPTORS_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef MVG_DESCRIPTORS_AVX2
+#include <immintrin.h>
+#endif
+
+// * scalar kernels *
+
+static int mvg_descriptor_distance_scalar(const unsigned char * a, const unsigned char * b)
+{
+	int distance = 0;
+	for (int i = 0; i < GEOMETRY_DESCRIPTOR_LENGTH; i++)
+	{
+		const int d = (int)a[i] - (int)b[i];
+		distance += d * d;
+	}
+
+	return distance;
+}
+
+static void mvg_descriptor_distances_scalar(const unsigned char * query, const unsigned char * descriptors, const int * ids, const int count, int * distances)
+{
+	for (int i = 0; i < count; i++)
+	{
+		distances[i] = mvg_descriptor_distance_scalar(query, descriptors + ids[i] * GEOMETRY_DESCRIPTOR_LENGTH);
+	}
+}
+
+// * SSE2 kernels *
+
+#ifdef MVG_DESCRIPTORS_SSE2
+
+// sum of four 32-bit integers 
+static inline int mvg_descriptor_sum_sse2(__m128i sum)
+{
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(sum);
+}
+
+// distance of a descriptor to query widened to 16-bit values (16 registers of 8 values)
+static inline int mvg_descriptor_distance_widened_sse2(const __m128i * query, const unsigned char * b)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i sum = _mm_setzero_si128();
+	for (int i = 0; i < GEOMETRY_DESCRIPTOR_LENGTH / 16; i++)
+	{
+		const __m128i vb = _mm_loadu_si128((const __m128i *)(b + 16 * i));
+		const __m128i 
+			lo = _mm_sub_epi16(query[2 * i + 0], _mm_unpacklo_epi8(vb, zero)),
+			hi = _mm_sub_epi16(query[2 * i + 1], _mm_unpackhi_epi8(vb, zero))
+		;
+		sum = _mm_add_epi32(sum, _mm_madd_epi16(lo, lo));
+		sum = _mm_add_epi32(sum, _mm_madd_epi16(hi, hi));
+	}
+
+	return mvg_descriptor_sum_sse2(sum);
+}
+
+static inline void mvg_descriptor_widen_sse2(const unsigned char * a, __m128i * widened)
+{
+	const __m128i zero = _mm_setzero_si128();
+	for (int i = 0; i < GEOMETRY_DESCRIPTOR_LENGTH / 16; i++)
+	{
+		const __m128i va = _mm_loadu_si128((const __m128i *)(a + 16 * i));
+		widened[2 * i + 0] = _mm_unpacklo_epi8(va, zero);
+		widened[2 * i + 1] = _mm_unpackhi_epi8(va, zero);
+	}
+}
+
+static int mvg_descriptor_distance_sse2(const unsigned char * a, const unsigned char * b)
+{
+	__m128i query[GEOMETRY_DESCRIPTOR_LENGTH / 8];
+	mvg_descriptor_widen_sse2(a, query);
+	return mvg_descriptor_distance_widened_sse2(query, b);
+}
+
+static void mvg_descriptor_distances_sse2(const unsigned char * query, const unsigned char * descriptors, const int * ids, const int count, int * distances)
+{
+	// the query is widened only once for all candidates 
+	__m128i widened[GEOMETRY_DESCRIPTOR_LENGTH / 8];
+	mvg_descriptor_widen_sse2(query, widened);
+	for (int i = 0; i < count; i++)
+	{
+		distances[i] = mvg_descriptor_distance_widened_sse2(widened, descriptors + ids[i] * GEOMETRY_DESCRIPTOR_LENGTH);
+	}
+}
+
+#endif
+
+// * AVX2 kernels *
+
+#ifdef MVG_DESCRIPTORS_AVX2
+
+// distance of a descriptor to query widened to 16-bit values (8 registers of 16 values)
+MVG_DESCRIPTORS_AVX2_TARGET static inline int mvg_descriptor_distance_widened_avx2(const __m256i * query, const unsigned char * b)
+{
+	__m256i sum = _mm256_setzero_si256();
+	for (int i = 0; i < GEOMETRY_DESCRIPTOR_LENGTH / 16; i++)
+	{
+		const __m256i d = _mm256_sub_epi16(query[i], _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(b + 16 * i))));
+		sum = _mm256_add_epi32(sum, _mm256_madd_epi16(d, d));
+	}
+
+	__m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+	half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+	half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(half);
+}
+
+MVG_DESCRIPTORS_AVX2_TARGET static inline void mvg_descriptor_widen_avx2(const unsigned char * a, __m256i * widened)
+{
+	for (int i = 0; i < GEOMETRY_DESCRIPTOR_LENGTH / 16; i++)
+	{
+		widened[i] = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(a + 16 * i)));
+	}
+}
+
+MVG_DESCRIPTORS_AVX2_TARGET static int mvg_descriptor_distance_avx2(const unsigned char * a, const unsigned char * b)
+{
+	__m256i query[GEOMETRY_DESCRIPTOR_LENGTH / 16];
+	mvg_descriptor_widen_avx2(a, query);
+	return mvg_descriptor_distance_widened_avx2(query, b);
+}
+
+MVG_DESCRIPTORS_AVX2_TARGET static void mvg_descriptor_distances_avx2(const unsigned char * query, const unsigned char * descriptors, const int * ids, const int count, int * distances)
+{
+	// the query is widened only once for all candidates 
+	__m256i widened[GEOMETRY_DESCRIPTOR_LENGTH / 16];
+	mvg_descriptor_widen_avx2(query, widened);
+	for (int i = 0; i < count; i++)
+	{
+		distances[i] = mvg_descriptor_distance_widened_avx2(widened, descriptors + ids[i] * GEOMETRY_DESCRIPTOR_LENGTH);
+	}
+}
+
+#endif
+
+// * dispatch *
+
+// set of kernels for one instruction set 
+struct Mvg_Descriptor_Kernels 
+{
+	const char * name; 
+	int (* distance)(const unsigned char * a, const unsigned char * b);
+	void (* distances)(const unsigned char * query, const unsigned char * descriptors, const int * ids, const int count, int * distances);
+};
+
+// check if the processor (and operating system) supports given instruction set
+#ifdef MVG_DESCRIPTORS_SSE2
+static bool mvg_descriptor_cpu_supports(const bool avx2)
+{
+#ifdef __GNUC__
+	__builtin_cpu_init();
+	return avx2 ? __builtin_cpu_supports("avx2") != 0 : __builtin_cpu_supports("sse2") != 0;
+#else
+	int info[4]; 
+	__cpuid(info, 0); 
+	const int max_leaf = info[0];
+	__cpuid(info, 1);
+	if (!avx2) return (info[3] & (1 << 26)) != 0;
+
+	// AVX2 needs the operating system to save ymm registers 
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	if (max_leaf < 7 || !osxsave || (_xgetbv(0) & 6) != 6) return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#endif
+}
+#endif
+
+// choose the best kernels available 
+static Mvg_Descriptor_Kernels mvg_descriptor_select_kernels()
+{
+	Mvg_Descriptor_Kernels kernels = { "scalar", mvg_descriptor_distance_scalar, mvg_descriptor_distances_scalar };
+
+#ifdef MVG_DESCRIPTORS_SSE2
+	if (mvg_descriptor_cpu_supports(false))
+	{
+		kernels.name = "SSE2"; 
+		kernels.distance = mvg_descriptor_distance_sse2; 
+		kernels.distances = mvg_descriptor_distances_sse2;
+	}
+#endif
+
+#ifdef MVG_DESCRIPTORS_AVX2
+	if (mvg_descriptor_cpu_supports(true))
+	{
+		kernels.name = "AVX2"; 
+		kernels.distance = mvg_descriptor_distance_avx2; 
+		kernels.distances = mvg_descriptor_distances_avx2;
+	}
+#endif
+
+	return kernels;
+}
+
+// selected during static initialization, i.e. before any matching thread is started 
+static const Mvg_Descriptor_Kernels mvg_descriptor_kernels = mvg_descriptor_select_kernels();
+
+// squared distance of two descriptors 
+int mvg_descriptor_distance(const unsigned char * a, const unsigned char * b)
+{
+	return mvg_descriptor_kernels.distance(a, b);
+}
+
+// squared distances of query to candidates 
+void mvg_descriptor_distances(const unsigned char * query, const unsigned char * descriptors, const int * ids, const int count, int * distances)
+{
+	mvg_descriptor_kernels.distances(query, descriptors, ids, count, distances);
+}
+
+// name of the used instruction set 
+const char * mvg_descriptor_kernels_name()
+{
+	return mvg_descriptor_kernels.name;
+}
@@ -0,0 +1,45 @@
+/*
+
+  insight3d - image based 3d modelling software
+  Copyright (C) 2007-2008  Lukas Mach
+                           email: lukas.mach@gmail.com 
+                           web: http://mach.matfyz.cz/
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+  
+*/
+
+#ifndef __MVG_DESCRIPTORS
+#define __MVG_DESCRIPTORS
+
+#include "core_debug.h"
+#include "geometry_structures.h"
+
+// distance kernels for byte descriptors; SSE2 or AVX2 implementation is chosen 
+// at startup depending on what the processor supports (with scalar fallback), 
+// all of them return exactly the same values
+
+// squared euclidean distance of two descriptors
+int mvg_descriptor_distance(const unsigned char * a, const unsigned char * b);
+
+// squared distances of query descriptor to several candidates; i-th candidate's 
+// descriptor starts at descriptors + ids[i] * GEOMETRY_DESCRIPTOR_LENGTH
+void mvg_descriptor_distances(const unsigned char * query, const unsigned char * descriptors, const int * ids, const int count, int * distances);
+
+// name of the instruction set used by the kernels 
+const char * mvg_descriptor_kernels_name();
+
+#endif
@@ -0,0 +1,326 @@
+/*
+
+  insight3d - image based 3d modelling software
+  Copyright (C) 2007-2008  Lukas Mach
+                           email: lukas.mach@gmail.com 
+                           web: http://mach.matfyz.cz/
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+  
+*/
+
+#include "mvg_kdtree.h"
+#include "core_math_routines.h"
+#include "mvg_descriptors.h"
+
+// randomized trees choose the partition key index from this many dimensions of the greatest variance
+static const int MVG_KDTREE_RANDOM_DIMENSIONS = 5;
+
+// unexplored branch waiting in the priority queue of Best Bin First search 
+struct Keypoints_Tree_Branch
+{
+	int priority;                    // lower bound of squared distance of the query from the branch
+	int node;
+};
+
+// scratch memory of one search, reused for all queries of a batch 
+struct Keypoints_Tree_Search 
+{
+	Keypoints_Tree_Branch * heap;    // binary min-heap of branches 
+	int heap_count, heap_capacity;
+	unsigned int * visited;          // for every keypoint the last query which checked it (the same keypoint is in every tree)
+	unsigned int stamp;              // id of the current query 
+};
+
+// build subtree over a range of the order array, returns id of it's root; state 
+// is the state of the random generator of randomized trees (NULL for the first tree)
+static int mvg_kdtree_build_node(Keypoints_Tree * tree, const int first, const int count, unsigned int * state)
+{
+	const int id = tree->nodes_count++;
+	Keypoints_Tree_Node * const node = tree->nodes + id;
+	node->ki = -1; 
+	node->kv = 0;
+	node->first = first; 
+	node->count = count; 
+	node->left = node->right = -1;
+	if (count <= 1) return id;
+
+	int * const order = tree->order + first;
+
+	// find dimensions with the greatest variance (n^2 multiple of variance is computed, 
+	// which is exact for byte values), they're kept sorted by decreasing variance 
+	int candidates[MVG_KDTREE_RANDOM_DIMENSIONS]; 
+	unsigned long long candidates_var[MVG_KDTREE_RANDOM_DIMENSIONS]; 
+	int candidates_count = 0;
+	const int wanted = state ? MVG_KDTREE_RANDOM_DIMENSIONS : 1;
+	for (int j = 0; j < GEOMETRY_DESCRIPTOR_LENGTH; j++)
+	{
+		unsigned long long sum = 0, sum_sq = 0;
+		for (int i = 0; i < count; i++)
+		{
+			const unsigned long long value = tree->descriptors[order[i] * GEOMETRY_DESCRIPTOR_LENGTH + j];
+			sum += value;
+			sum_sq += value * value;
+		}
+
+		// dimensions with zero variance can't split anything
+		const unsigned long long var = count * sum_sq - sum * sum;
+		if (var == 0 || (candidates_count == wanted && var <= candidates_var[wanted - 1])) continue;
+
+		int position = candidates_count < wanted ? candidates_count++ : wanted - 1;
+		while (position > 0 && candidates_var[position - 1] < var) 
+		{
+			candidates[position] = candidates[position - 1]; 
+			candidates_var[position] = candidates_var[position - 1]; 
+			position--;
+		}
+
+		candidates[position] = j; 
+		candidates_var[position] = var;
+	}
+
+	// if all descriptors are the same, this is a leaf
+	if (candidates_count == 0) return id;
+	const int ki = candidates[state ? random_number(*state) % candidates_count : 0];
+
+	// partition key value is the median of values in that dimension (found using histogram)
+	int histogram[256]; 
+	memset(histogram, 0, sizeof(histogram));
+	for (int i = 0; i < count; i++)
+	{
+		histogram[tree->descriptors[order[i] * GEOMETRY_DESCRIPTOR_LENGTH + ki]]++;
+	}
+
+	const int median_rank = (count - 1) / 2;
+	int kv = 0, below = histogram[0]; 
+	while (below <= median_rank) 
+	{
+		below += histogram[++kv];
+	}
+
+	// if the median is the greatest value, split below it instead; the dimension 
+	// isn't constant, so some smaller value is present 
+	if (below == count) 
+	{
+		do 
+		{
+			kv--;
+		}
+		while (histogram[kv] == 0);
+	}
+
+	// move keypoints with values not greater than median to the front 
+	int left_count = 0;
+	for (int i = 0; i < count; i++)
+	{
+		if (tree->descriptors[order[i] * GEOMETRY_DESCRIPTOR_LENGTH + ki] <= kv)
+		{
+			const int t = order[i]; 
+			order[i] = order[left_count]; 
+			order[left_count++] = t;
+		}
+	}
+
+	ASSERT(left_count > 0 && left_count < count, "partition left one of the subtrees empty");
+
+	node->ki = ki; 
+	node->kv = kv; 
+	const int left = mvg_kdtree_build_node(tree, first, left_count, state);
+	const int right = mvg_kdtree_build_node(tree, first + left_count, count - left_count, state);
+	tree->nodes[id].left = left; 
+	tree->nodes[id].right = right; 
+
+	return id;
+}
+
+// build the forest 
+Keypoints_Tree * mvg_kdtree_build(const Keypoints & keypoints, const int trees_count)
+{
+	if (keypoints.count <= 0 || !keypoints.descriptors || trees_count <= 0) return NULL; 
+
+	Keypoints_Tree * const tree = ALLOC(Keypoints_Tree, 1); 
+	tree->descriptors = keypoints.descriptors; 
+	tree->count = keypoints.count;
+	tree->trees_count = trees_count;
+	tree->roots = ALLOC(int, trees_count);
+	tree->order = ALLOC(int, trees_count * keypoints.count); 
+
+	// every split produces two nonempty children, so there are less than 2 * count nodes in a tree
+	tree->nodes = ALLOC(Keypoints_Tree_Node, 2 * trees_count * keypoints.count); 
+	tree->nodes_count = 0;
+
+	for (int t = 0; t < trees_count; t++)
+	{
+		int * const order = tree->order + t * keypoints.count;
+		for (int i = 0; i < keypoints.count; i++)
+		{
+			order[i] = i; 
+		}
+
+		unsigned int state = t;
+		tree->roots[t] = mvg_kdtree_build_node(tree, t * keypoints.count, keypoints.count, t == 0 ? NULL : &state);
+	}
+
+	return tree;
+}
+
+// release the forest 
+void mvg_kdtree_release(Keypoints_Tree * tree)
+{
+	if (!tree) return;
+	FREE(tree->roots);
+	FREE(tree->order); 
+	FREE(tree->nodes); 
+	FREE(tree);
+}
+
+// insert branch into binary min-heap 
+static void mvg_kdtree_push(Keypoints_Tree_Search * search, const int priority, const int node)
+{
+	if (search->heap_count == search->heap_capacity) 
+	{
+		search->heap_capacity *= 2; 
+		search->heap = (Keypoints_Tree_Branch *)realloc(search->heap, sizeof(Keypoints_Tree_Branch) * search->heap_capacity);
+	}
+
+	Keypoints_Tree_Branch * const heap = search->heap;
+	int i = search->heap_count++;
+	while (i > 0 && heap[(i - 1) / 2].priority > priority) 
+	{
+		heap[i] = heap[(i - 1) / 2]; 
+		i = (i - 1) / 2;
+	}
+
+	heap[i].priority = priority; 
+	heap[i].node = node;
+}
+
+// remove branch with the lowest priority from binary min-heap 
+static int mvg_kdtree_pop(Keypoints_Tree_Search * search, int & priority)
+{
+	Keypoints_Tree_Branch * const heap = search->heap;
+	const int node = heap[0].node; 
+	priority = heap[0].priority;
+	const Keypoints_Tree_Branch last = heap[--search->heap_count];
+
+	int i = 0; 
+	while (2 * i + 1 < search->heap_count) 
+	{
+		int child = 2 * i + 1; 
+		if (child + 1 < search->heap_count && heap[child + 1].priority < heap[child].priority) child++;
+		if (heap[child].priority >= last.priority) break;
+		heap[i] = heap[child]; 
+		i = child;
+	}
+
+	heap[i] = last;
+	return node;
+}
+
+// find approximate k nearest neighbours of one descriptor, returns their number 
+static int mvg_kdtree_knn_query(const Keypoints_Tree * tree, Keypoints_Tree_Search * search, const unsigned char * descriptor, const int k, const int max_checks, int * neighbours, int * distances)
+{
+	// new query id, the marks of visited keypoints have to be cleared when it overflows 
+	if (++search->stamp == 0) 
+	{
+		memset(search->visited, 0, sizeof(unsigned int) * tree->count); 
+		search->stamp = 1;
+	}
+
+	search->heap_count = 0; 
+	for (int t = 0; t < tree->trees_count; t++)
+	{
+		mvg_kdtree_push(search, 0, tree->roots[t]);
+	}
+
+	int found = 0, checks = 0; 
+	while (search->heap_count > 0 && checks < max_checks) 
+	{
+		// descend into the leaf, remember the branches not taken (the bound is increased by 
+		// the squared distance from the splitting hyperplane)
+		int bound;
+		int id = mvg_kdtree_pop(search, bound);
+		while (tree->nodes[id].ki >= 0) 
+		{
+			const Keypoints_Tree_Node * const node = tree->nodes + id;
+			const int value = descriptor[node->ki];
+			if (value <= node->kv) 
+			{
+				mvg_kdtree_push(search, bound + (node->kv + 1 - value) * (node->kv + 1 - value), node->right); 
+				id = node->left; 
+			}
+			else
+			{
+				mvg_kdtree_push(search, bound + (value - node->kv) * (value - node->kv), node->left); 
+				id = node->right;
+			}
+		}
+
+		// try keypoints in the leaf (unless another tree already offered them)
+		const Keypoints_Tree_Node * const leaf = tree->nodes + id;
+		for (int i = leaf->first; i < leaf->first + leaf->count && checks < max_checks; i++)
+		{
+			const int keypoint = tree->order[i];
+			if (search->visited[keypoint] == search->stamp) continue;
+			search->visited[keypoint] = search->stamp;
+			checks++;
+
+			const int distance = mvg_descriptor_distance(descriptor, tree->descriptors + keypoint * GEOMETRY_DESCRIPTOR_LENGTH);
+			if (found == k && distance >= distances[k - 1]) continue;
+
+			// insert into sorted array of neighbours
+			int j = found < k ? found++ : k - 1;
+			while (j > 0 && distances[j - 1] > distance) 
+			{
+				distances[j] = distances[j - 1]; 
+				neighbours[j] = neighbours[j - 1]; 
+				j--;
+			}
+
+			distances[j] = distance; 
+			neighbours[j] = keypoint;
+		}
+	}
+
+	return found;
+}
+
+// find approximate k nearest neighbours of several descriptors 
+void mvg_kdtree_knn(const Keypoints_Tree * tree, const unsigned char * queries, const int queries_count, const int k, const int max_checks, int * neighbours, int * distances, int * found)
+{
+	if (!tree || k <= 0) 
+	{
+		if (queries_count > 0) memset(found, 0, sizeof(int) * queries_count);
+		return; 
+	}
+
+	// the scratch memory is shared by all queries 
+	Keypoints_Tree_Search search; 
+	search.heap_count = 0; 
+	search.heap_capacity = 64; 
+	search.heap = ALLOC(Keypoints_Tree_Branch, search.heap_capacity); 
+	search.visited = ALLOC(unsigned int, tree->count); 
+	memset(search.visited, 0, sizeof(unsigned int) * tree->count);
+	search.stamp = 0;
+
+	for (int q = 0; q < queries_count; q++)
+	{
+		found[q] = mvg_kdtree_knn_query(tree, &search, queries + q * GEOMETRY_DESCRIPTOR_LENGTH, k, max_checks, neighbours + q * k, distances + q * k);
+	}
+
+	FREE(search.visited); 
+	FREE(search.heap);
+}
@@ -0,0 +1,72 @@
+/*
+
+  insight3d - image based 3d modelling software
+  Copyright (C) 2007-2008  Lukas Mach
+                           email: lukas.mach@gmail.com 
+                           web: http://mach.matfyz.cz/
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+  
+*/
+
+#ifndef __MVG_KDTREE
+#define __MVG_KDTREE
+
+#include "core_debug.h"
+#include "geometry_structures.h"
+
+// randomized kd-trees over keypoint descriptors (Silpa-Anan and Hartley) searched 
+// using Best Bin First method (Beis and Lowe); all trees of the forest are searched 
+// at once using single priority queue ordered by lower bound of the distance of the 
+// branch from the query; the first tree always splits the dimension of the greatest 
+// variance, the other ones choose randomly from several dimensions with the greatest 
+// variance; the forest doesn't modify nor copy the keypoints and it can be searched 
+// from multiple threads at once
+
+// node of a tree, every node covers a contiguous range of the forest's order array
+struct Keypoints_Tree_Node 
+{
+	int ki;                          // partition key index (-1 for leaves)
+	int kv;                          // partition key value, descriptors having value <= kv at ki go to the left subtree 
+	int first, count;                // range of keypoints covered by this node
+	int left, right;                 // children (only for internal nodes)
+};
+
+struct Keypoints_Tree 
+{
+	const unsigned char * descriptors; // descriptors of indexed keypoints (not owned by the forest)
+	int count;                       // number of indexed keypoints 
+	int trees_count; 
+	int * roots;                     // root node of every tree 
+	int * order;                     // ids of keypoints, trees_count blocks of count ids ordered so that each node covers a contiguous range 
+	Keypoints_Tree_Node * nodes;     // nodes of all trees
+	int nodes_count;
+};
+
+// build forest of trees_count kd-trees over keypoints' descriptors, returns NULL if there are no keypoints 
+Keypoints_Tree * mvg_kdtree_build(const Keypoints & keypoints, const int trees_count);
+
+// release the forest
+void mvg_kdtree_release(Keypoints_Tree * tree);
+
+// find approximate k nearest neighbours of queries_count descriptors stored one after another 
+// in queries; for i-th query, ids of found keypoints and their squared descriptor distances 
+// are stored into neighbours and distances starting at i * k (in increasing order of distance) 
+// and their number into found[i]; search of each query stops after it's been compared 
+// with max_checks keypoints 
+void mvg_kdtree_knn(const Keypoints_Tree * tree, const unsigned char * queries, const int queries_count, const int k, const int max_checks, int * neighbours, int * distances, int * found);
+
+#endif
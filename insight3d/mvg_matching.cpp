@@ -24,214 +24,228 @@
 
 #include "mvg_matching.h"
 
-size_t * mvg_index_buckets(MVG_FEATURE * features, double scale, size_t count, int bucket_size, int bucket_cols, int bucket_rows)
+// sort keypoints into buckets 
+Keypoints_Grid * mvg_build_grid(const Keypoints & keypoints, const double scale, const int width, const int height, const int bucket_size)
 {
-	size_t * index = ALLOC(size_t, bucket_cols * bucket_rows + 1);
-	int current_bucket = -1;
-
-	size_t i;
-	for (i = 0; i < count; i++)
+	Keypoints_Grid * const grid = ALLOC(Keypoints_Grid, 1);
+	grid->bucket_size = bucket_size; 
+	grid->buckets_x = width / bucket_size + 1; // note that this implies more buckets than really needed in rare cases
+	grid->buckets_y = height / bucket_size + 1;
+	grid->scale = scale;
+
+	const int buckets_count = grid->buckets_x * grid->buckets_y;
+	grid->order = ALLOC(int, keypoints.count > 0 ? keypoints.count : 1);
+	grid->index = ALLOC(int, buckets_count + 1);
+	memset(grid->index, 0, sizeof(int) * (buckets_count + 1));
+
+	// find the bucket of every keypoint and count keypoints in each bucket 
+	int * const buckets = ALLOC(int, keypoints.count > 0 ? keypoints.count : 1);
+	for (int i = 0; i < keypoints.count; i++)
 	{
-		int 
-			col = scale * features[i].x / bucket_size,
-			row = scale * features[i].y / bucket_size
+		const int 
+			col = scale * keypoints.positions[2 * i + 0] / bucket_size,
+			row = scale * keypoints.positions[2 * i + 1] / bucket_size
 		;
 
 		// skip features out of picture (perhaps manually created by the user or malformed import)
-		if (col < 0 || row < 0 || col >= bucket_cols || row >= bucket_rows) continue;
-
-		int point_bucket = row * bucket_cols + col;
-
-		// if the vertices are not ordered in buckets, terminate 
-		if (point_bucket < current_bucket)
+		if (col < 0 || row < 0 || col >= grid->buckets_x || row >= grid->buckets_y) 
 		{
-			FREE(index);
-			return NULL;
-		}
-		// if the vertex is in a bucket in a gallaxy far far away
-		else if (point_bucket > current_bucket)
-		{
-			current_bucket++;
-			while (current_bucket < point_bucket)
-			{
-				index[current_bucket++] = i;
-			}
-			index[current_bucket] = i;
+			buckets[i] = -1;
+			continue;
 		}
+
+		buckets[i] = row * grid->buckets_x + col;
+		grid->index[buckets[i] + 1]++;
+	}
+
+	// convert the counts into positions of buckets 
+	for (int j = 0; j < buckets_count; j++)
+	{
+		grid->index[j + 1] += grid->index[j];
 	}
 
-	// mark the rest of the buckets as empty
-	while (current_bucket <= bucket_cols * bucket_rows) 
+	// place the keypoints, they stay sorted by id inside buckets 
+	int * const next = ALLOC(int, buckets_count > 0 ? buckets_count : 1);
+	memcpy(next, grid->index, sizeof(int) * buckets_count);
+	for (int i = 0; i < keypoints.count; i++)
 	{
-		index[current_bucket++] = count;
+		if (buckets[i] >= 0) 
+		{
+			grid->order[next[buckets[i]]++] = i;
+		}
 	}
 
-	return index;
+	FREE(next); 
+	FREE(buckets);
+	return grid;
 }
 
-int mvg_bucket_size = 0;
-double mvg_scale = 0;
+// release the grid 
+void mvg_release_grid(Keypoints_Grid * grid)
+{
+	if (!grid) return; 
+	FREE(grid->order);
+	FREE(grid->index); 
+	FREE(grid);
+}
 
-int mvg_buckets_compare(const void * p_f1, const void * p_f2) 
+// range of buckets along one axis whose centers may lie between min and max; the range 
+// is one bucket wider on both sides to be safe from rounding, so the caller has to check 
+// the buckets (empty range has last < first)
+static void mvg_bucket_range(const double min, const double max, const int bucket_size, const int buckets, int & first, int & last)
 {
-	MVG_FEATURE * f1 = (MVG_FEATURE *)p_f1, * f2 = (MVG_FEATURE *)p_f2; 
-	size_t 
-		bucket1x = mvg_scale * f1->x / mvg_bucket_size, 
-		bucket1y = mvg_scale * f1->y / mvg_bucket_size, 
-		bucket2x = mvg_scale * f2->x / mvg_bucket_size, 
-		bucket2y = mvg_scale * f2->y / mvg_bucket_size
+	const double 
+		bucket_min = floor((min - bucket_size / 2) / bucket_size) - 1, 
+		bucket_max = ceil((max - bucket_size / 2) / bucket_size) + 1
 	;
 
-	if (bucket1y < bucket2y) // todo can this be optimized
-	{
-		return -1;
-	}
-	else if (bucket1y > bucket2y) 
-	{
-		return 1;
-	}
-	else if (bucket1x < bucket2x) 
-	{
-		return -1;
-	}
-	else if (bucket1x > bucket2x) 
-	{
-		return 1;
-	}
-	else
-	{
-		return 0;
-	}
+	first = bucket_min > 0 ? (bucket_min < buckets ? (int)bucket_min : buckets) : 0;
+	last = bucket_max < buckets - 1 ? (bucket_max >= 0 ? (int)bucket_max : -1) : buckets - 1;
 }
 
-size_t * mvg_build_buckets(MVG_FEATURE * features, const double scale, size_t count, int bucket_size, int buckets_x, int buckets_y) 
+// range of bucket columns in a row whose centers may be within radius from the line 
+// a x + b y + c = 0 (with a^2 + b^2 = 1)
+static void mvg_band_columns(const double * line, const int center_y, const double radius, const int bucket_size, const int buckets_x, int & first, int & last)
 {
-	mvg_bucket_size = bucket_size; 
-	mvg_scale = scale;
-	qsort(features, count, sizeof(MVG_FEATURE), mvg_buckets_compare);
+	const double offset = line[1] * center_y + line[2];
 
-	// verify that it's sorted 
-	/*for (size_t i = 0; i < count; i++) 
+	// nearly horizontal line crosses either whole row or nothing 
+	if (fabs(line[0]) < 1e-9) 
 	{
-		MVG_FEATURE * f = features + i;
-
-		int row = f->y / bucket_size;
-		int col = f->x / bucket_size; 
-
-		printf("%d ", row * buckets_x + col);
+		first = 0; 
+		last = fabs(offset) > radius ? -1 : buckets_x - 1;
+		return;
 	}
 
-	int i;
-	// scanf("%d", &i);*/
+	// solve |a x + offset| <= radius for x and convert it to bucket centers' columns 
+	double 
+		x_min = (-offset - radius) / line[0], 
+		x_max = (-offset + radius) / line[0]
+	;
 
-	return mvg_index_buckets(features, scale, count, bucket_size, buckets_x, buckets_y);
+	if (x_min > x_max) swap_double(x_min, x_max);
+	mvg_bucket_range(x_min, x_max, bucket_size, buckets_x, first, last);
 }
 
 size_t mvg_guided_matching(
-	MVG_FEATURE * features1, const size_t count1, const int width1, const int height1, const double scale1, 
-	MVG_FEATURE * features2, const size_t count2, const int width2, const int height2, const double scale2, 
+	const Keypoints & keypoints1, const int width1, const int height1, const double scale1, 
+	const Keypoints & keypoints2, const Keypoints_Grid * grid2, const int width2, const int height2, const double scale2, 
 	CvMat * F,
 	const double threshold,
 	const double fsor_threshold,
 	int * matches
 )
 {
-	// calculate number of buckets and other constants
-	const int bucket_size = 50; 
+	// constants of the second image's grid 
 	const double fsor_threshold_sq = fsor_threshold * fsor_threshold;
 	const int
-		buckets1_x = width1 / bucket_size + 1,
-		buckets1_y = height1 / bucket_size + 1,
-		buckets2_x = width2 / bucket_size + 1,
-		buckets2_y = height2 / bucket_size + 1 // note that this implies more buckets than really needed in rare cases
+		bucket_size = grid2->bucket_size,
+		buckets2_x = grid2->buckets_x,
+		buckets2_y = grid2->buckets_y
 	;
 
-	// * index the buckets *
-	size_t * index2 = NULL; // mvg_index_buckets(features2, scale2, count2, bucket_size, buckets2_x, buckets2_y);
-	if (!index2)
-	{
-		index2 = mvg_build_buckets(features2, scale2, count2, bucket_size, buckets2_x, buckets2_y); 
-		printf(".");
-	}
+	const int * const order2 = grid2->order, * const index2 = grid2->index;
+	ASSERT(grid2->scale == scale2, "grid was built for different scale");
 
 	// * match features *
 	int matches_count = 0; // number of found matches
+	int 
+		* candidates = ALLOC(int, keypoints2.count > 0 ? keypoints2.count : 1),  // keypoints close enough to the epipolar line or position
+		* candidates_distances = ALLOC(int, keypoints2.count > 0 ? keypoints2.count : 1)
+	;
+
+	// bucket is checked if it's center is closer to the epipolar line than this
+	const double band_radius = 0.5 * sqrt(2.0) * bucket_size + threshold;
+
+	double F_elements[9]; 
+	for (int r = 0; r < 3; r++) 
+	{
+		for (int c = 0; c < 3; c++) 
+		{
+			F_elements[3 * r + c] = OPENCV_ELEM(F, r, c);
+		}
+	}
 
 	// go through all vertices in the first image
-	for (size_t i = 0; i < count1; i++) 
+	for (size_t i = 0; i < keypoints1.count; i++) 
 	{
-		MVG_FEATURE * f1 = features1 + i;
-
-		// calculate the epipolar line
-		CvMat * e = opencv_create_matrix(3, 1);
-		double x = features1[i].x * scale1, y = features1[i].y * scale1;
-		OPENCV_ELEM(e, 0, 0) = x;
-		OPENCV_ELEM(e, 1, 0) = y;
-		OPENCV_ELEM(e, 2, 0) = 1.0;
-		cvMatMul(F, e, e);
-		const double norm = sqrt(sqr_value(OPENCV_ELEM(e, 0, 0)) + sqr_value(OPENCV_ELEM(e, 1, 0)));
-		OPENCV_ELEM(e, 0, 0) *= 1 / norm; 
-		OPENCV_ELEM(e, 1, 0) *= 1 / norm; 
-		OPENCV_ELEM(e, 2, 0) *= 1 / norm; 
-
-		int checked_buckets = 0; // we'll be counting the buckets we checked
-
-		// go through all buckets on the second image, we'll be keeping running min 
+		const double * const f1 = keypoints1.positions + 2 * i;
+		const unsigned char * const descriptor1 = keypoints1.descriptors + i * GEOMETRY_DESCRIPTOR_LENGTH;
+
+		// calculate the epipolar line (normalized, so that it gives distances in pixels)
+		const double x = f1[0] * scale1, y = f1[1] * scale1;
+		double line[3];
+		for (int r = 0; r < 3; r++) 
+		{
+			line[r] = F_elements[3 * r + 0] * x + F_elements[3 * r + 1] * y + F_elements[3 * r + 2];
+		}
+
+		const double norm = sqrt(sqr_value(line[0]) + sqr_value(line[1]));
+		if (norm > 0) 
+		{
+			line[0] /= norm; 
+			line[1] /= norm; 
+			line[2] /= norm;
+		}
+
+		// go through buckets on the second image crossed by the band around the epipolar line, we'll be keeping running min 
 		double min1 = scale2 * scale2 * width2 * height2 + 2, min2 = scale2 * scale2 * width2 * height2 + 3; // note the + 2 is there only for the (unrealistic) case that width and height are both below 1
 		ASSERT(min1 != min2, "image resolution is too large to store the pixel count in double; this should be easy to fix");
 		size_t min1_id = SIZE_MAX, min2_id = SIZE_MAX;
-		size_t checked_features = 0;
-		for (size_t j = 0; j < buckets2_x * buckets2_y; j++)
+		int candidates_count = 0;
+		for (int row = 0; row < buckets2_y && norm > 0; row++)
 		{
-			// decide if the bucket is near the epipolar line
-			const int 
-				bucket_x = (j % buckets2_x) * bucket_size + bucket_size / 2, 
-				bucket_y = (j / buckets2_x) * bucket_size + bucket_size / 2
-			;
-			
-			const double distance = abs(bucket_x * OPENCV_ELEM(e, 0, 0) + bucket_y * OPENCV_ELEM(e, 1, 0) + OPENCV_ELEM(e, 2, 0));
-			if (distance <= (0.5 * sqrt(2.0) * bucket_size + threshold))
+			// find the columns whose bucket centers can be within the band 
+			const int bucket_y = row * bucket_size + bucket_size / 2;
+			int first_column, last_column;
+			mvg_band_columns(line, bucket_y, band_radius, bucket_size, buckets2_x, first_column, last_column);
+
+			for (int column = first_column; column <= last_column; column++)
 			{
-				// checked_buckets++; // todo 
+				// decide if the bucket is near the epipolar line
+				const int 
+					j = row * buckets2_x + column,
+					bucket_x = column * bucket_size + bucket_size / 2
+				;
+
+				const double distance = fabs(bucket_x * line[0] + bucket_y * line[1] + line[2]);
+				if (distance > band_radius) continue;
 
 				// go through all vertices in this bucket
-				for (size_t k = index2[j]; k < index2[j + 1]; k++)
+				for (int k = index2[j]; k < index2[j + 1]; k++)
 				{
-					checked_features++;
+					const int keypoint2 = order2[k];
+					const double * const f2 = keypoints2.positions + 2 * keypoint2; 
+
 					// is it near the epipolar line
-					const double distance = abs(scale2 * features2[k].x * OPENCV_ELEM(e, 0, 0) + scale2 * features2[k].y * OPENCV_ELEM(e, 1, 0) + OPENCV_ELEM(e, 2, 0));
+					const double distance = fabs(scale2 * f2[0] * line[0] + scale2 * f2[1] * line[1] + line[2]);
 					if (distance <= threshold)
 					{
-						// calculate descriptor distance
-						double descriptor_d = 0; 
-						for (int l = 0; l < 128; l += 4) 
-						{
-							descriptor_d += sqr_value(f1->descr[l] - features2[k].descr[l]);
-							descriptor_d += sqr_value(f1->descr[l + 1] - features2[k].descr[l + 1]);
-							descriptor_d += sqr_value(f1->descr[l + 2] - features2[k].descr[l + 2]);
-							descriptor_d += sqr_value(f1->descr[l + 3] - features2[k].descr[l + 3]);
-
-							if (descriptor_d > min2) break;
-						}
-
-						// if it's closer than the running minimum, change it
-						if (descriptor_d < min1) 
-						{
-							min2 = min1; 
-							min2_id = min1_id;
-							min1 = descriptor_d; 
-							min1_id = k;
-						}
-						else if (descriptor_d < min2) 
-						{
-							min2 = descriptor_d;
-							min2_id = k;
-						}
+						candidates[candidates_count++] = keypoint2;
 					}
 				}
 			}
 		}
 
+		// calculate descriptor distances of all candidates at once and keep the two closest ones
+		mvg_descriptor_distances(descriptor1, keypoints2.descriptors, candidates, candidates_count, candidates_distances);
+		for (int k = 0; k < candidates_count; k++) 
+		{
+			const double descriptor_d = candidates_distances[k];
+			if (descriptor_d < min1) 
+			{
+				min2 = min1; 
+				min2_id = min1_id;
+				min1 = descriptor_d; 
+				min1_id = candidates[k];
+			}
+			else if (descriptor_d < min2) 
+			{
+				min2 = descriptor_d;
+				min2_id = candidates[k];
+			}
+		}
+
 		// feature space outlier check
 		if (min1 / min2 <= fsor_threshold_sq) 
 		{
@@ -241,107 +255,110 @@ size_t mvg_guided_matching(
 		}
 	}
 
-	FREE(index2);
+	FREE(candidates);
+	FREE(candidates_distances);
 	return matches_count;
 }
 
 size_t mvg_guided_matching_translation(
-	MVG_FEATURE * features1, const size_t count1, const int width1, const int height1, const double scale1, 
-	MVG_FEATURE * features2, const size_t count2, const int width2, const int height2, const double scale2, 
+	const Keypoints & keypoints1, const int width1, const int height1, const double scale1, 
+	const Keypoints & keypoints2, const Keypoints_Grid * grid2, const int width2, const int height2, const double scale2, 
 	const double T_x, const double T_y,
 	const double threshold,
 	const double fsor_threshold,
 	int * matches
 )
 {
-	// calculate number of buckets and other constants
-	const int bucket_size = 50; 
+	// constants of the second image's grid 
 	const double fsor_threshold_sq = fsor_threshold * fsor_threshold;
 	const int
-		buckets1_x = width1 / bucket_size + 1,
-		buckets1_y = height1 / bucket_size + 1,
-		buckets2_x = width2 / bucket_size + 1,
-		buckets2_y = height2 / bucket_size + 1 // note that this implies more buckets than really needed in rare cases
+		bucket_size = grid2->bucket_size,
+		buckets2_x = grid2->buckets_x,
+		buckets2_y = grid2->buckets_y
 	;
 
-	// * index the buckets *
-	size_t * index2 = NULL; // mvg_index_buckets(features2, scale2, count2, bucket_size, buckets2_x, buckets2_y);
-	if (!index2)
-	{
-		index2 = mvg_build_buckets(features2, scale2, count2, bucket_size, buckets2_x, buckets2_y); 
-		printf(".");
-	}
+	const int * const order2 = grid2->order, * const index2 = grid2->index;
+	ASSERT(grid2->scale == scale2, "grid was built for different scale");
 
 	// * match features *
 	int matches_count = 0; // number of found matches
+	int 
+		* candidates = ALLOC(int, keypoints2.count > 0 ? keypoints2.count : 1),  // keypoints close enough to the epipolar line or position
+		* candidates_distances = ALLOC(int, keypoints2.count > 0 ? keypoints2.count : 1)
+	;
+
+	// bucket is checked if it's center is closer to the approximate position than this
+	const double search_radius = 0.5 * sqrt(2.0) * bucket_size + threshold;
 
 	// go through all vertices in the first image
-	for (size_t i = 0; i < count1; i++) 
+	for (size_t i = 0; i < keypoints1.count; i++) 
 	{
-		MVG_FEATURE * f1 = features1 + i;
+		const double * const f1 = keypoints1.positions + 2 * i;
+		const unsigned char * const descriptor1 = keypoints1.descriptors + i * GEOMETRY_DESCRIPTOR_LENGTH;
 
 		// calculate approximate position on the second image 
 		const double 
-			x = scale1 * f1->x + T_x, 
-			y = scale1 * f1->y + T_y
+			x = scale1 * f1[0] + T_x, 
+			y = scale1 * f1[1] + T_y
 		;
 
-		int checked_buckets = 0; // we'll be counting the buckets we checked
-
-		// go through all buckets on the second image that are close enough, we'll be keeping running min 
+		// go through buckets on the second image that are close enough, we'll be keeping running min 
 		double min1 = scale2 * scale2 * width2 * height2 + 2, min2 = scale2 * scale2 * width2 * height2 + 3; // note the + 2 is there only for the (unrealistic) case that width and height are both below 1
 		ASSERT(min1 != min2, "image resolution is too large to store the pixel count in double; this should be easy to fix");
 		size_t min1_id = SIZE_MAX, min2_id = SIZE_MAX;
-		for (size_t j = 0; j < buckets2_x * buckets2_y; j++)
+		int candidates_count = 0;
+		int first_row, last_row, first_column, last_column; 
+		mvg_bucket_range(y - search_radius, y + search_radius, bucket_size, buckets2_y, first_row, last_row);
+		mvg_bucket_range(x - search_radius, x + search_radius, bucket_size, buckets2_x, first_column, last_column);
+		for (int row = first_row; row <= last_row; row++)
 		{
-			// decide if the bucket is near the approximate position
-			const int 
-				bucket_x = (j % buckets2_x) * bucket_size + bucket_size / 2, 
-				bucket_y = (j / buckets2_x) * bucket_size + bucket_size / 2
-			;
-			
-			const double distance = sqrt(sqr_value(x - bucket_x) + sqr_value(y - bucket_y));
-			if (distance <= (0.5 * sqrt(2.0) * bucket_size + threshold))
+			for (int column = first_column; column <= last_column; column++)
 			{
-				checked_buckets++;
+				// decide if the bucket is near the approximate position
+				const int 
+					j = row * buckets2_x + column,
+					bucket_x = column * bucket_size + bucket_size / 2, 
+					bucket_y = row * bucket_size + bucket_size / 2
+				;
+
+				const double distance = sqrt(sqr_value(x - bucket_x) + sqr_value(y - bucket_y));
+				if (distance > search_radius) continue;
 
 				// go through all vertices in this bucket
-				for (size_t k = index2[j]; k < index2[j + 1]; k++)
+				for (int k = index2[j]; k < index2[j + 1]; k++)
 				{
-					// is it near the epipolar line
-					const double distance = sqrt(sqr_value(x - scale2 * features2[k].x) + sqr_value(y - scale2 * features2[k].y));
+					const int keypoint2 = order2[k];
+					const double * const f2 = keypoints2.positions + 2 * keypoint2; 
+
+					// is it near the approximate position
+					const double distance = sqrt(sqr_value(x - scale2 * f2[0]) + sqr_value(y - scale2 * f2[1]));
 					if (distance <= threshold)
 					{
-						// calculate descriptor distance
-						double descriptor_d = 0;
-						for (int l = 0; l < 128; l += 4)
-						{
-							descriptor_d += sqr_value(f1->descr[l] - features2[k].descr[l]);
-							descriptor_d += sqr_value(f1->descr[l + 1] - features2[k].descr[l + 1]);
-							descriptor_d += sqr_value(f1->descr[l + 2] - features2[k].descr[l + 2]);
-							descriptor_d += sqr_value(f1->descr[l + 3] - features2[k].descr[l + 3]);
-
-							if (descriptor_d > min2) break;
-						}
-
-						// if it's closer than the running minimum, change it
-						if (descriptor_d < min1)
-						{
-							min2 = min1;
-							min2_id = min1_id;
-							min1 = descriptor_d;
-							min1_id = k;
-						}
-						else if (descriptor_d < min2)
-						{
-							min2 = descriptor_d;
-							min2_id = k;
-						}
+						candidates[candidates_count++] = keypoint2;
 					}
 				}
 			}
 		}
 
+		// calculate descriptor distances of all candidates at once and keep the two closest ones
+		mvg_descriptor_distances(descriptor1, keypoints2.descriptors, candidates, candidates_count, candidates_distances);
+		for (int k = 0; k < candidates_count; k++) 
+		{
+			const double descriptor_d = candidates_distances[k];
+			if (descriptor_d < min1) 
+			{
+				min2 = min1; 
+				min2_id = min1_id;
+				min1 = descriptor_d; 
+				min1_id = candidates[k];
+			}
+			else if (descriptor_d < min2) 
+			{
+				min2 = descriptor_d;
+				min2_id = candidates[k];
+			}
+		}
+
 		// feature space outlier check
 		if (min1 / min2 <= fsor_threshold_sq)
 		{
@@ -351,6 +368,7 @@ size_t mvg_guided_matching_translation(
 		}
 	}
 
-	FREE(index2);
+	FREE(candidates);
+	FREE(candidates_distances);
 	return matches_count;
 }
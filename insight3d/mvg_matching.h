@@ -5,31 +5,28 @@
 #include "interface_opencv.h"
 #include "core_math_routines.h"
 #include "geometry_structures.h"
+#include "mvg_descriptors.h"
 
-// we have to reference the type containing the structure
-#define MVG_FEATURE struct feature
+// keypoints of one image sorted into a grid of square buckets; the grid is only read 
+// during matching, so it can be shared by all image pairs and threads
+struct Keypoints_Grid
+{
+	int bucket_size;               // size of bucket in pixels (of the scaled image)
+	int buckets_x, buckets_y;      // number of bucket columns and rows 
+	double scale;                  // keypoint coordinates are multiplied by scale before bucketing
+	int * order;                   // ids of keypoints sorted by buckets (row by row), keypoints outside the grid are left out
+	int * index;                   // keypoints of j-th bucket are order[index[j]] .. order[index[j + 1] - 1]
+};
 
-size_t * mvg_index_buckets(
-	MVG_FEATURE * features, 
-	double scale, 
-	size_t count, 
-	int bucket_size, 
-	int bucket_cols, 
-	int bucket_rows
-);
+// sort keypoints into buckets (using counting sort) 
+Keypoints_Grid * mvg_build_grid(const Keypoints & keypoints, const double scale, const int width, const int height, const int bucket_size);
 
-size_t * mvg_build_buckets(
-	MVG_FEATURE * features, 
-	const double scale, 
-	size_t count, 
-	int bucket_size, 
-	int buckets_x, 
-	int buckets_y
-);
+// release the grid 
+void mvg_release_grid(Keypoints_Grid * grid);
 
 size_t mvg_guided_matching(
-	MVG_FEATURE * features1, const size_t count1, const int width1, const int height1, const double scale1, 
-	MVG_FEATURE * features2, const size_t count2, const int width2, const int height2, const double scale2, 
+	const Keypoints & keypoints1, const int width1, const int height1, const double scale1, 
+	const Keypoints & keypoints2, const Keypoints_Grid * grid2, const int width2, const int height2, const double scale2, 
 	CvMat * F,
 	const double threshold,
 	const double fsor_threshold,
@@ -37,8 +34,8 @@ size_t mvg_guided_matching(
 );
 
 size_t mvg_guided_matching_translation(
-	MVG_FEATURE * features1, const size_t count1, const int width1, const int height1, const double scale1, 
-	MVG_FEATURE * features2, const size_t count2, const int width2, const int height2, const double scale2, 
+	const Keypoints & keypoints1, const int width1, const int height1, const double scale1, 
+	const Keypoints & keypoints2, const Keypoints_Grid * grid2, const int width2, const int height2, const double scale2, 
 	const double T_x, const double T_y,
 	const double threshold,
 	const double fsor_threshold,
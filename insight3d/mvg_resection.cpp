@@ -209,6 +209,49 @@ bool mvg_resection_SVD(
 	}
 }
 
+// decides if the j-th vertex is projected by hypothesis P close enough to its 
+// measured projection 
+static bool mvg_resection_inlier(
+	const CvMat * const P, 
+	const CvMat * const vertices, 
+	const CvMat * const projected, 
+	const bool homogeneous, 
+	const int j, 
+	const double threshold_sq
+)
+{
+	double reprojection[2]; 
+	// note that here we're using "dirty" projection method which is suitable only for visualization; on the upside, it shouldn't matter because 
+	// if a point is projected as infinite, there's something wrong with it anyway
+	if (homogeneous)
+	{
+		opencv_vertex_projection_visualization(
+			P, 
+			OPENCV_ELEM(vertices, 0, j),
+			OPENCV_ELEM(vertices, 1, j),
+			OPENCV_ELEM(vertices, 2, j),
+			OPENCV_ELEM(vertices, 3, j),
+			reprojection
+		);
+	}
+	else
+	{
+		opencv_vertex_projection_visualization(
+			P, 
+			OPENCV_ELEM(vertices, 0, j), 
+			OPENCV_ELEM(vertices, 1, j), 
+			OPENCV_ELEM(vertices, 2, j), 
+			reprojection
+		);
+	}
+
+	const double 
+		dx = reprojection[0] - OPENCV_ELEM(projected, 0, j), 
+		dy = reprojection[1] - OPENCV_ELEM(projected, 1, j);
+
+	return dx * dx + dy * dy <= threshold_sq;
+}
+
 // robustly computes projection matrix P given 3d points X and their projections x = PX
 //
 // computation is done using RANSAC applied to mvg_resection_SVD
@@ -219,7 +262,8 @@ bool mvg_resection_SVD(
 //               of the i-th 3d vertex 
 //   projected - 2 x n matrix with i-th column representing the 2d point 
 //               on which the i-th 3d vertex is projected 
-//   trials    - number of trials/iterations to do
+//   trials    - maximum number of trials/iterations to do, fewer trials are 
+//               done when the inlier ratio allows it (MVG_RANSAC_PROBABILITY)
 //   threshold - maximum value of reprojection error with which the vertex is 
 //               still considered inlier
 //   inliers   - (optional) array of n booleans used to mark which points 
@@ -244,7 +288,8 @@ bool mvg_resection_RANSAC(
 	bool normalize_A /*= false*/,
 	const int trials /*= 500*/, 
 	const double threshold /*= 3.0*/,
-	bool * inliers /*= NULL*/
+	bool * inliers /*= NULL*/,
+	unsigned int * seed /*= NULL*/
 )
 {
 	// transform input
@@ -263,15 +308,19 @@ bool mvg_resection_RANSAC(
 		return false;
 	}
 
-	// do this many times 
-	for (int i = 0; i < trials; i++) 
+	// do this many times; the number of trials is lowered as soon as the 
+	// best consensus set makes it unlikely that more trials would find 
+	// a better one (the sample is considered to have 7 points, since good 
+	// hypotheses also have to pass the preliminary test below)
+	int trials_needed = trials;
+	for (int i = 0; i < trials_needed; i++) 
 	{
 		// pick randomly 6 correspondences 
 		memset(status, 0, sizeof(bool) * n);
 		int samples[6];
 		for (int count = 0; count < 6;)
 		{
-			const int pick = rand() % n; 
+			const int pick = (seed ? random_number(*seed) : rand()) % n; 
 			if (!status[pick])
 			{
 				status[pick] = true; 
@@ -280,51 +329,23 @@ bool mvg_resection_RANSAC(
 			}
 		}
 
-		// calculate using mvg_resection_SVD 
-		if (!mvg_resection_SVD(vertices, projected, P, NULL, NULL, NULL, normalize_A, samples, 6)) continue;
+		// calculate hypothesis (the same way as mvg_resection_SVD does) 
+		double p[12];
+		mvg_resection_DLT<6>(vertices, projected, normalize_A, samples, p);
+		const CvMat hypothesis = cvMat(3, 4, CV_64F, p);
+
+		// preliminary test (T(1,1)), hypothesis is rejected unless one randomly 
+		// chosen correspondence is an inlier 
+		const int test = (seed ? random_number(*seed) : rand()) % n;
+		if (!mvg_resection_inlier(&hypothesis, vertices, projected, homogeneous, test, threshold_sq)) continue;
 
-		// count and mark the inliers 
+		// count and mark the inliers, stop as soon as the hypothesis can't 
+		// beat the best one found so far 
 		int inliers_count = 0; 
-		for (int j = 0; j < n; j++) 
+		for (int j = 0; j < n && inliers_count + n - j > best_inliers_count; j++) 
 		{
-			double reprojection[2]; 
-			// note that here we're using "dirty" projection method which is suitable only for visualization; on the upside, it shouldn't matter because 
-			// if a point is projected as infinite, there's something wrong with it anyway
-			if (homogeneous)
-			{
-				opencv_vertex_projection_visualization(
-					P, 
-					OPENCV_ELEM(vertices, 0, j),
-					OPENCV_ELEM(vertices, 1, j),
-					OPENCV_ELEM(vertices, 2, j),
-					OPENCV_ELEM(vertices, 3, j),
-					reprojection
-				);
-			}
-			else
-			{
-				opencv_vertex_projection_visualization(
-					P, 
-					OPENCV_ELEM(vertices, 0, j), 
-					OPENCV_ELEM(vertices, 1, j), 
-					OPENCV_ELEM(vertices, 2, j), 
-					reprojection
-				);
-			}
-
-			const double 
-				dx = reprojection[0] - OPENCV_ELEM(projected, 0, j), 
-				dy = reprojection[1] - OPENCV_ELEM(projected, 1, j);
-			
-			if (dx * dx + dy * dy <= threshold_sq)
-			{
-				inliers_count++; 
-				status[j] = true; 
-			}
-			else
-			{
-				status[j] = false;
-			}
+			status[j] = mvg_resection_inlier(&hypothesis, vertices, projected, homogeneous, j, threshold_sq);
+			if (status[j]) inliers_count++;
 		}
 
 		// check for best sample 
@@ -334,7 +355,7 @@ bool mvg_resection_RANSAC(
 			best_status = status; 
 			status = temp;
 			best_inliers_count = inliers_count; 
-			// cvCopy(P, best_P);
+			trials_needed = ransac_trials(best_inliers_count, n, 7, MVG_RANSAC_PROBABILITY, trials);
 		}
 
 		// debug 
@@ -27,7 +27,9 @@
 
 #include "core_debug.h"
 #include "interface_opencv.h"
+#include "core_math_routines.h"
 #include "mvg_decomposition.h"
+#include "mvg_thresholds.h"
 
 // computes projection matrix P given 3d points X and their projections x = PX
 //
@@ -69,6 +71,59 @@ bool mvg_resection_SVD(
 	int ns = -1
 );
 
+// computes projection matrix from exactly ns correspondences (like mvg_resection_SVD 
+// without decomposition); all temporary data are kept on stack, so that it's cheap 
+// enough to generate RANSAC hypotheses; P receives the matrix stored by rows 
+template <int ns> 
+void mvg_resection_DLT(
+	const CvMat * const vertices, const CvMat * const projected, const bool normalize_A, 
+	const int * samples, double P[12]
+)
+{
+	const bool homogeneous = vertices->rows == 4;
+	double A[2 * ns * 12], V[12 * 12];
+	for (int j = 0; j < ns; j++) 
+	{
+		const int i = samples[j];
+		const double 
+			X[4] = { 
+				OPENCV_ELEM(vertices, 0, i), 
+				OPENCV_ELEM(vertices, 1, i), 
+				OPENCV_ELEM(vertices, 2, i), 
+				homogeneous ? OPENCV_ELEM(vertices, 3, i) : 1 
+			}, 
+			x = OPENCV_ELEM(projected, 0, i), 
+			y = OPENCV_ELEM(projected, 1, i)
+		;
+
+		double * const row1 = A + (2 * j) * 12, * const row2 = row1 + 12;
+		for (int k = 0; k < 4; k++) 
+		{
+			row1[k] = 0; 
+			row1[4 + k] = -X[k]; 
+			row1[8 + k] = y * X[k];
+			row2[k] = X[k]; 
+			row2[4 + k] = 0; 
+			row2[8 + k] = -x * X[k];
+		}
+
+		// normalize the rows (the same way as mvg_resection_SVD does)
+		if (normalize_A)
+		{
+			for (int r = 0; r < 2; r++) 
+			{
+				double * const row = r == 0 ? row1 : row2; 
+				double norm = 0; 
+				for (int k = 0; k < 12; k++) norm += row[k] * row[k];
+				norm = 1 / norm;
+				for (int k = 0; k < 12; k++) row[k] *= norm;
+			}
+		}
+	}
+
+	smallest_right_singular_vector(A, 2 * ns, 12, V, P);
+}
+
 // robustly computes projection matrix P given 3d points X and their projections x = PX
 //
 // computation is done using RANSAC applied to mvg_resection_SVD
@@ -84,6 +139,9 @@ bool mvg_resection_SVD(
 //               still considered inlier
 //   inliers   - (optional) array of n booleans used to mark which points 
 //               were considered to be inliers
+//   seed      - (optional) state of random number generator used to pick 
+//               samples instead of rand(), so that several resections can 
+//               run concurrently
 //
 // returned value: 
 // 
@@ -104,7 +162,8 @@ bool mvg_resection_RANSAC(
 	bool normalize_A = false,
 	const int trials = 500, 
 	const double threshold = 4.0,
-	bool * inliers = NULL
+	bool * inliers = NULL,
+	unsigned int * seed = NULL
 );
 
 // clamps down some values in internal calibration matrix
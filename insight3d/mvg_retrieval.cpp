@@ -0,0 +1,501 @@
+/*
+
+  insight3d - image based 3d modelling software
+  Copyright (C) 2007-2008  Lukas Mach
+                           email: lukas.mach@gmail.com 
+                           web: http://mach.matfyz.cz/
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+  
+*/
+
+#include "mvg_retrieval.h"
+#include "core_math_routines.h"
+
+// upper bound on the branching factor (so that scratch arrays can live on stack)
+static const int MVG_VOCABULARY_MAX_BRANCHING = 32;
+
+// number of k-means iterations at every node 
+static const int MVG_VOCABULARY_ITERATIONS = 10;
+
+// state shared by threads building subtrees of the vocabulary 
+struct Vocabulary_Build_Job 
+{
+	Vocabulary * vocabulary; 
+	const unsigned char * samples;  // sampled descriptors 
+	int * ids;                      // ids of samples partitioned by root's clusters 
+	int * cluster_first, * cluster_count;
+};
+
+// bag of visual words of one image 
+struct Retrieval_Image 
+{
+	int entries;                    // number of distinct words
+	int * words;                    // sorted ids of words 
+	double * weights;               // term frequency, later TF-IDF weight of the word
+};
+
+// state shared by threads querying the inverted file 
+struct Retrieval_Job 
+{
+	const Vocabulary * vocabulary;
+	const Keypoints * const * keypoints; 
+	Retrieval_Image * images; 
+	int images_count, k; 
+	int * retrieved; 
+	int * postings_first, * postings_image;    // inverted file, images containing word w are postings_image[postings_first[w]] .. 
+	double * postings_weight;
+	double * * scores;              // per-thread accumulators of similarity to all images 
+};
+
+// index of the smallest of count values 
+static int mvg_vocabulary_argmin(const int * values, const int count)
+{
+	int best = 0; 
+	for (int i = 1; i < count; i++)
+	{
+		if (values[i] < values[best]) best = i;
+	}
+
+	return best;
+}
+
+// cluster samples of a node into branching clusters (k-means with k-means++ seeding), 
+// the centers are stored as node's children and ids are partitioned by clusters; 
+// returns false if the node is a leaf 
+static bool mvg_vocabulary_cluster(Vocabulary * vocabulary, const unsigned char * samples, int * ids, const int count, const int node, const int level, int * cluster_first, int * cluster_count)
+{
+	const int branching = vocabulary->branching;
+	if (level >= vocabulary->depth || count < branching) 
+	{
+		vocabulary->leaves[node] = true;
+		return false;
+	}
+
+	unsigned char * const centers = vocabulary->centers + (node * branching + 1) * GEOMETRY_DESCRIPTOR_LENGTH;
+	int center_ids[MVG_VOCABULARY_MAX_BRANCHING], center_distances[MVG_VOCABULARY_MAX_BRANCHING];
+	for (int c = 0; c < branching; c++)
+	{
+		center_ids[c] = c;
+	}
+
+	int * const assignment = ALLOC(int, count); 
+	int * const distances = ALLOC(int, count);
+
+	// choose initial centers, each sample is chosen with probability proportional 
+	// to it's squared distance from the nearest already chosen center 
+	unsigned int state = node + 1;
+	memcpy(centers, samples + ids[random_number(state) % count] * GEOMETRY_DESCRIPTOR_LENGTH, GEOMETRY_DESCRIPTOR_LENGTH);
+	mvg_descriptor_distances(centers, samples, ids, count, distances);
+	for (int c = 1; c < branching; c++)
+	{
+		double total = 0; 
+		for (int i = 0; i < count; i++)
+		{
+			total += distances[i];
+		}
+
+		int chosen = random_number(state) % count;
+		if (total > 0) 
+		{
+			double target = random_number(state) * (total / (1 << 30)); 
+			for (chosen = 0; chosen < count - 1 && target >= distances[chosen]; chosen++)
+			{
+				target -= distances[chosen];
+			}
+		}
+
+		unsigned char * const center = centers + c * GEOMETRY_DESCRIPTOR_LENGTH;
+		memcpy(center, samples + ids[chosen] * GEOMETRY_DESCRIPTOR_LENGTH, GEOMETRY_DESCRIPTOR_LENGTH);
+		for (int i = 0; i < count; i++)
+		{
+			const int distance = mvg_descriptor_distance(center, samples + ids[i] * GEOMETRY_DESCRIPTOR_LENGTH);
+			if (distance < distances[i]) distances[i] = distance;
+		}
+	}
+
+	// Lloyd's iterations 
+	int * const sums = ALLOC(int, branching * GEOMETRY_DESCRIPTOR_LENGTH);
+	for (int i = 0; i < count; i++)
+	{
+		assignment[i] = -1;
+	}
+
+	for (int iteration = 0; ; iteration++)
+	{
+		// assign samples to the nearest centers
+		int changed = 0; 
+		for (int i = 0; i < count; i++)
+		{
+			mvg_descriptor_distances(samples + ids[i] * GEOMETRY_DESCRIPTOR_LENGTH, centers, center_ids, branching, center_distances);
+			const int nearest = mvg_vocabulary_argmin(center_distances, branching);
+			if (nearest != assignment[i]) 
+			{
+				assignment[i] = nearest; 
+				changed++;
+			}
+		}
+
+		if (changed == 0 || iteration == MVG_VOCABULARY_ITERATIONS) break;
+
+		// move centers into the means of their clusters (empty clusters keep their centers)
+		memset(sums, 0, sizeof(int) * branching * GEOMETRY_DESCRIPTOR_LENGTH);
+		memset(cluster_count, 0, sizeof(int) * branching);
+		for (int i = 0; i < count; i++)
+		{
+			const unsigned char * const sample = samples + ids[i] * GEOMETRY_DESCRIPTOR_LENGTH; 
+			int * const sum = sums + assignment[i] * GEOMETRY_DESCRIPTOR_LENGTH;
+			for (int l = 0; l < GEOMETRY_DESCRIPTOR_LENGTH; l++)
+			{
+				sum[l] += sample[l];
+			}
+
+			cluster_count[assignment[i]]++;
+		}
+
+		for (int c = 0; c < branching; c++)
+		{
+			if (cluster_count[c] == 0) continue;
+			for (int l = 0; l < GEOMETRY_DESCRIPTOR_LENGTH; l++)
+			{
+				centers[c * GEOMETRY_DESCRIPTOR_LENGTH + l] = (sums[c * GEOMETRY_DESCRIPTOR_LENGTH + l] + cluster_count[c] / 2) / cluster_count[c];
+			}
+		}
+	}
+
+	// partition samples by clusters 
+	memset(cluster_count, 0, sizeof(int) * branching);
+	for (int i = 0; i < count; i++)
+	{
+		cluster_count[assignment[i]]++;
+	}
+
+	cluster_first[0] = 0; 
+	for (int c = 1; c < branching; c++)
+	{
+		cluster_first[c] = cluster_first[c - 1] + cluster_count[c - 1];
+	}
+
+	int * const next = distances; // reused
+	memcpy(next, cluster_first, sizeof(int) * branching);
+	int * const partitioned = ALLOC(int, count); 
+	for (int i = 0; i < count; i++)
+	{
+		partitioned[next[assignment[i]]++] = ids[i];
+	}
+
+	memcpy(ids, partitioned, sizeof(int) * count);
+
+	FREE(partitioned);
+	FREE(sums);
+	FREE(distances); 
+	FREE(assignment);
+
+	vocabulary->leaves[node] = false;
+	return true;
+}
+
+// build subtree of the vocabulary 
+static void mvg_vocabulary_build_node(Vocabulary * vocabulary, const unsigned char * samples, int * ids, const int count, const int node, const int level)
+{
+	int cluster_first[MVG_VOCABULARY_MAX_BRANCHING], cluster_count[MVG_VOCABULARY_MAX_BRANCHING];
+	if (!mvg_vocabulary_cluster(vocabulary, samples, ids, count, node, level, cluster_first, cluster_count)) return;
+
+	for (int c = 0; c < vocabulary->branching; c++)
+	{
+		mvg_vocabulary_build_node(vocabulary, samples, ids + cluster_first[c], cluster_count[c], node * vocabulary->branching + 1 + c, level + 1);
+	}
+}
+
+// build subtree under one of root's children, called from worker threads 
+static void mvg_vocabulary_build_job(void * arg, const size_t item, const size_t thread_id)
+{
+	Vocabulary_Build_Job * const job = (Vocabulary_Build_Job *)arg; 
+	mvg_vocabulary_build_node(job->vocabulary, job->samples, job->ids + job->cluster_first[item], job->cluster_count[item], 1 + item, 1);
+}
+
+// build vocabulary tree 
+Vocabulary * mvg_vocabulary_build(const Keypoints * const * keypoints, const int images_count, const int branching, const int depth, const int max_samples, const size_t threads_count)
+{
+	ASSERT(branching >= 2 && branching <= MVG_VOCABULARY_MAX_BRANCHING, "unsupported branching factor of vocabulary tree");
+	ASSERT(depth >= 1, "vocabulary tree must have at least one level");
+
+	// allocate complete tree 
+	Vocabulary * const vocabulary = ALLOC(Vocabulary, 1); 
+	vocabulary->branching = branching; 
+	vocabulary->depth = depth; 
+	vocabulary->nodes_count = 0;
+	for (int level = 0, level_size = 1; level <= depth; level++, level_size *= branching)
+	{
+		vocabulary->nodes_count += level_size;
+	}
+
+	vocabulary->centers = ALLOC(unsigned char, vocabulary->nodes_count * GEOMETRY_DESCRIPTOR_LENGTH);
+	memset(vocabulary->centers, 0, vocabulary->nodes_count * GEOMETRY_DESCRIPTOR_LENGTH);
+	vocabulary->leaves = ALLOC(bool, vocabulary->nodes_count);
+	memset(vocabulary->leaves, 0, sizeof(bool) * vocabulary->nodes_count);
+	vocabulary->leaves[0] = true;
+
+	// take every step-th descriptor of all images 
+	size_t total = 0; 
+	for (int i = 0; i < images_count; i++)
+	{
+		total += keypoints[i]->count;
+	}
+
+	const size_t step = total > (size_t)max_samples ? (total + max_samples - 1) / max_samples : 1;
+	const int samples_count = (total + step - 1) / step;
+	if (samples_count == 0) return vocabulary;
+
+	unsigned char * const samples = ALLOC(unsigned char, samples_count * GEOMETRY_DESCRIPTOR_LENGTH);
+	int * const ids = ALLOC(int, samples_count);
+	int sample = 0;
+	size_t position = 0;
+	for (int i = 0; i < images_count; i++)
+	{
+		for (int j = 0; j < keypoints[i]->count; j++, position++)
+		{
+			if (position % step != 0) continue;
+			memcpy(samples + sample * GEOMETRY_DESCRIPTOR_LENGTH, keypoints[i]->descriptors + j * GEOMETRY_DESCRIPTOR_LENGTH, GEOMETRY_DESCRIPTOR_LENGTH);
+			ids[sample] = sample;
+			sample++;
+		}
+	}
+
+	// cluster the root here and root's subtrees in parallel (they don't share any nodes)
+	Vocabulary_Build_Job job; 
+	int cluster_first[MVG_VOCABULARY_MAX_BRANCHING], cluster_count[MVG_VOCABULARY_MAX_BRANCHING];
+	if (mvg_vocabulary_cluster(vocabulary, samples, ids, sample, 0, 0, cluster_first, cluster_count))
+	{
+		job.vocabulary = vocabulary; 
+		job.samples = samples; 
+		job.ids = ids; 
+		job.cluster_first = cluster_first; 
+		job.cluster_count = cluster_count;
+		core_parallel_for(branching, threads_count, mvg_vocabulary_build_job, &job);
+	}
+
+	FREE(ids);
+	FREE(samples);
+	return vocabulary;
+}
+
+// release vocabulary tree 
+void mvg_vocabulary_release(Vocabulary * vocabulary)
+{
+	if (!vocabulary) return;
+	FREE(vocabulary->centers); 
+	FREE(vocabulary->leaves); 
+	FREE(vocabulary);
+}
+
+// visual word of a descriptor 
+int mvg_vocabulary_quantize(const Vocabulary * vocabulary, const unsigned char * descriptor)
+{
+	int center_ids[MVG_VOCABULARY_MAX_BRANCHING], center_distances[MVG_VOCABULARY_MAX_BRANCHING];
+	for (int c = 0; c < vocabulary->branching; c++)
+	{
+		center_ids[c] = c;
+	}
+
+	// descend into the nearest child until we reach a leaf 
+	int node = 0; 
+	while (!vocabulary->leaves[node]) 
+	{
+		const int first_child = node * vocabulary->branching + 1;
+		mvg_descriptor_distances(descriptor, vocabulary->centers + first_child * GEOMETRY_DESCRIPTOR_LENGTH, center_ids, vocabulary->branching, center_distances);
+		node = first_child + mvg_vocabulary_argmin(center_distances, vocabulary->branching);
+	}
+
+	return node;
+}
+
+static int mvg_retrieval_compare_words(const void * a, const void * b)
+{
+	const int wa = *(const int *)a, wb = *(const int *)b; 
+	return wa < wb ? -1 : (wa > wb ? 1 : 0);
+}
+
+// quantize descriptors of one image into histogram of words, called from worker threads 
+static void mvg_retrieval_quantize_job(void * arg, const size_t item, const size_t thread_id)
+{
+	Retrieval_Job * const job = (Retrieval_Job *)arg; 
+	const Keypoints * const keypoints = job->keypoints[item];
+	Retrieval_Image * const image = job->images + item; 
+
+	image->words = ALLOC(int, keypoints->count > 0 ? keypoints->count : 1);
+	image->weights = ALLOC(double, keypoints->count > 0 ? keypoints->count : 1);
+	for (int i = 0; i < keypoints->count; i++)
+	{
+		image->words[i] = mvg_vocabulary_quantize(job->vocabulary, keypoints->descriptors + i * GEOMETRY_DESCRIPTOR_LENGTH);
+	}
+
+	// sort the words and count their occurences 
+	qsort(image->words, keypoints->count, sizeof(int), mvg_retrieval_compare_words);
+	image->entries = 0;
+	for (int i = 0; i < keypoints->count; i++)
+	{
+		if (image->entries > 0 && image->words[image->entries - 1] == image->words[i]) 
+		{
+			image->weights[image->entries - 1] += 1;
+		}
+		else
+		{
+			image->words[image->entries] = image->words[i]; 
+			image->weights[image->entries] = 1;
+			image->entries++;
+		}
+	}
+}
+
+// find the most similar images of one image, called from worker threads 
+static void mvg_retrieval_query_job(void * arg, const size_t item, const size_t thread_id)
+{
+	Retrieval_Job * const job = (Retrieval_Job *)arg; 
+	const Retrieval_Image * const image = job->images + item; 
+	double * const scores = job->scores[thread_id]; 
+	int * const retrieved = job->retrieved + item * job->k;
+
+	// scalar product with all images sharing at least one word
+	memset(scores, 0, sizeof(double) * job->images_count);
+	for (int e = 0; e < image->entries; e++)
+	{
+		const int word = image->words[e];
+		for (int p = job->postings_first[word]; p < job->postings_first[word + 1]; p++)
+		{
+			scores[job->postings_image[p]] += image->weights[e] * job->postings_weight[p];
+		}
+	}
+
+	// keep k best ones (sorted by decreasing score)
+	int found = 0; 
+	for (int j = 0; j < job->images_count; j++)
+	{
+		if (j == item || scores[j] <= 0) continue; 
+		if (found == job->k && scores[j] <= scores[retrieved[found - 1]]) continue;
+
+		int position = found < job->k ? found++ : found - 1; 
+		while (position > 0 && scores[retrieved[position - 1]] < scores[j]) 
+		{
+			retrieved[position] = retrieved[position - 1]; 
+			position--;
+		}
+
+		retrieved[position] = j;
+	}
+
+	for (int i = found; i < job->k; i++)
+	{
+		retrieved[i] = -1;
+	}
+}
+
+// for every image find k most similar images 
+void mvg_retrieve_similar(const Vocabulary * vocabulary, const Keypoints * const * keypoints, const int images_count, const int k, int * retrieved, const size_t threads_count)
+{
+	if (images_count == 0 || k <= 0) return;
+
+	Retrieval_Job job; 
+	job.vocabulary = vocabulary; 
+	job.keypoints = keypoints; 
+	job.images_count = images_count; 
+	job.k = k; 
+	job.retrieved = retrieved;
+	job.images = ALLOC(Retrieval_Image, images_count);
+
+	// build bags of words 
+	core_parallel_for(images_count, threads_count, mvg_retrieval_quantize_job, &job);
+
+	// inverse document frequency of words 
+	int * const documents = ALLOC(int, vocabulary->nodes_count + 1); 
+	memset(documents, 0, sizeof(int) * (vocabulary->nodes_count + 1));
+	for (int i = 0; i < images_count; i++)
+	{
+		for (int e = 0; e < job.images[i].entries; e++)
+		{
+			documents[job.images[i].words[e]]++;
+		}
+	}
+
+	// weight the histograms by TF-IDF and normalize them 
+	for (int i = 0; i < images_count; i++)
+	{
+		Retrieval_Image * const image = job.images + i;
+		double norm = 0; 
+		for (int e = 0; e < image->entries; e++)
+		{
+			image->weights[e] *= log(images_count / (double)documents[image->words[e]]);
+			norm += image->weights[e] * image->weights[e];
+		}
+
+		norm = sqrt(norm);
+		for (int e = 0; e < image->entries; e++)
+		{
+			image->weights[e] = norm > 0 ? image->weights[e] / norm : 0;
+		}
+	}
+
+	// build the inverted file 
+	job.postings_first = ALLOC(int, vocabulary->nodes_count + 1); 
+	job.postings_first[0] = 0; 
+	for (int w = 0; w < vocabulary->nodes_count; w++)
+	{
+		job.postings_first[w + 1] = job.postings_first[w] + documents[w];
+	}
+
+	const int postings_count = job.postings_first[vocabulary->nodes_count];
+	job.postings_image = ALLOC(int, postings_count > 0 ? postings_count : 1); 
+	job.postings_weight = ALLOC(double, postings_count > 0 ? postings_count : 1);
+	int * const next = documents; // reused 
+	memcpy(next, job.postings_first, sizeof(int) * vocabulary->nodes_count);
+	for (int i = 0; i < images_count; i++)
+	{
+		for (int e = 0; e < job.images[i].entries; e++)
+		{
+			const int p = next[job.images[i].words[e]]++;
+			job.postings_image[p] = i;
+			job.postings_weight[p] = job.images[i].weights[e];
+		}
+	}
+
+	// query every image 
+	job.scores = ALLOC(double *, threads_count);
+	for (size_t t = 0; t < threads_count; t++)
+	{
+		job.scores[t] = ALLOC(double, images_count);
+	}
+
+	core_parallel_for(images_count, threads_count, mvg_retrieval_query_job, &job);
+
+	// release memory
+	for (size_t t = 0; t < threads_count; t++)
+	{
+		FREE(job.scores[t]);
+	}
+
+	for (int i = 0; i < images_count; i++)
+	{
+		FREE(job.images[i].words); 
+		FREE(job.images[i].weights);
+	}
+
+	FREE(job.scores);
+	FREE(job.postings_image); 
+	FREE(job.postings_weight); 
+	FREE(job.postings_first);
+	FREE(documents);
+	FREE(job.images);
+}
@@ -0,0 +1,63 @@
+/*
+
+  insight3d - image based 3d modelling software
+  Copyright (C) 2007-2008  Lukas Mach
+                           email: lukas.mach@gmail.com 
+                           web: http://mach.matfyz.cz/
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+  
+*/
+
+#ifndef __MVG_RETRIEVAL
+#define __MVG_RETRIEVAL
+
+#include "core_debug.h"
+#include "core_parallel.h"
+#include "geometry_structures.h"
+#include "mvg_descriptors.h"
+
+// image retrieval using vocabulary tree (Nister and Stewenius): descriptors are 
+// quantized into visual words by hierarchical k-means and images are compared 
+// by TF-IDF weighted histograms of their words using an inverted file 
+
+// vocabulary tree stored as a complete tree, children of node n are nodes 
+// n * branching + 1 .. n * branching + branching; every node where quantization 
+// stops is a visual word (identified by node's id)
+struct Vocabulary 
+{
+	int branching, depth; 
+	int nodes_count; 
+	unsigned char * centers;       // cluster center of every node (nodes_count x GEOMETRY_DESCRIPTOR_LENGTH)
+	bool * leaves;                 // quantization stops at this node 
+};
+
+// build vocabulary tree by hierarchical k-means over (at most max_samples) descriptors 
+// sampled evenly from all images; keypoints contains images_count pointers 
+Vocabulary * mvg_vocabulary_build(const Keypoints * const * keypoints, const int images_count, const int branching, const int depth, const int max_samples, const size_t threads_count);
+
+// release vocabulary tree 
+void mvg_vocabulary_release(Vocabulary * vocabulary);
+
+// visual word of a descriptor 
+int mvg_vocabulary_quantize(const Vocabulary * vocabulary, const unsigned char * descriptor);
+
+// for every image find k most similar other images; retrieved is images_count x k array 
+// filled row by row with ids of retrieved images in decreasing order of similarity 
+// (rows are padded by -1 if there are fewer similar images)
+void mvg_retrieve_similar(const Vocabulary * vocabulary, const Keypoints * const * keypoints, const int images_count, const int k, int * retrieved, const size_t threads_count);
+
+#endif
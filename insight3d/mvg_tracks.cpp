@@ -0,0 +1,152 @@
+/*
+
+  insight3d - image based 3d modelling software
+  Copyright (C) 2007-2008  Lukas Mach
+                           email: lukas.mach@gmail.com 
+                           web: http://mach.matfyz.cz/
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+  
+*/
+
+#include "mvg_tracks.h"
+
+// create singleton tracks for every feature 
+Tracks * mvg_tracks_create(const size_t * features_counts, const int images_count)
+{
+	Tracks * tracks = ALLOC(Tracks, 1);
+	tracks->images_count = images_count; 
+	tracks->refused_count = 0;
+
+	// global index of features 
+	tracks->offsets = ALLOC(size_t, images_count + 1);
+	tracks->offsets[0] = 0;
+	for (int i = 0; i < images_count; i++)
+	{
+		tracks->offsets[i + 1] = tracks->offsets[i] + features_counts[i];
+	}
+
+	const size_t n = tracks->nodes_count = tracks->offsets[images_count];
+	tracks->parent = ALLOC(size_t, n > 0 ? n : 1);
+	tracks->size = ALLOC(size_t, n > 0 ? n : 1);
+	tracks->image = ALLOC(int, n > 0 ? n : 1);
+	tracks->images = ALLOC(int *, n > 0 ? n : 1);
+
+	for (int i = 0; i < images_count; i++)
+	{
+		for (size_t node = tracks->offsets[i]; node < tracks->offsets[i + 1]; node++)
+		{
+			tracks->parent[node] = node;
+			tracks->size[node] = 1;
+			tracks->image[node] = i;
+			tracks->images[node] = NULL;
+		}
+	}
+
+	return tracks;
+}
+
+// release tracks 
+void mvg_tracks_release(Tracks * tracks)
+{
+	if (!tracks) return;
+
+	for (size_t node = 0; node < tracks->nodes_count; node++)
+	{
+		if (tracks->images[node]) FREE(tracks->images[node]);
+	}
+
+	FREE(tracks->offsets);
+	FREE(tracks->parent);
+	FREE(tracks->size);
+	FREE(tracks->image);
+	FREE(tracks->images);
+	FREE(tracks);
+}
+
+// root node of the track containing given node 
+size_t mvg_tracks_find(Tracks * tracks, size_t node)
+{
+	ASSERT(node < tracks->nodes_count, "node out of range");
+
+	size_t root = node;
+	while (tracks->parent[root] != root) root = tracks->parent[root];
+
+	// compress the path, so that all visited nodes point directly to the root 
+	while (tracks->parent[node] != root)
+	{
+		const size_t next = tracks->parent[node];
+		tracks->parent[node] = root;
+		node = next;
+	}
+
+	return root;
+}
+
+// join tracks of two nodes 
+bool mvg_tracks_union(Tracks * tracks, const size_t first, const size_t second)
+{
+	size_t a = mvg_tracks_find(tracks, first), b = mvg_tracks_find(tracks, second);
+	if (a == b) return true;
+
+	// the larger track will be the root of the merged one 
+	if (tracks->size[a] < tracks->size[b]) 
+	{
+		const size_t t = a; a = b; b = t;
+	}
+
+	const size_t a_size = tracks->size[a], b_size = tracks->size[b];
+	const int 
+		* const a_images = a_size == 1 ? tracks->image + a : tracks->images[a], 
+		* const b_images = b_size == 1 ? tracks->image + b : tracks->images[b];
+
+	// refuse the merge if both tracks are visible on the same image 
+	size_t i = 0, j = 0; 
+	while (i < a_size && j < b_size)
+	{
+		if (a_images[i] == b_images[j]) 
+		{
+			tracks->refused_count++;
+			return false;
+		}
+
+		if (a_images[i] < b_images[j]) i++; else j++;
+	}
+
+	// merge sorted lists of images 
+	int * const merged = ALLOC(int, a_size + b_size);
+	size_t k = i = j = 0;
+	while (i < a_size || j < b_size)
+	{
+		if (j == b_size || (i < a_size && a_images[i] < b_images[j])) 
+		{
+			merged[k++] = a_images[i++];
+		}
+		else
+		{
+			merged[k++] = b_images[j++];
+		}
+	}
+
+	if (tracks->images[a]) FREE(tracks->images[a]);
+	if (tracks->images[b]) FREE(tracks->images[b]);
+	tracks->images[a] = merged;
+	tracks->images[b] = NULL;
+	tracks->parent[b] = a; 
+	tracks->size[a] = a_size + b_size;
+
+	return true;
+}
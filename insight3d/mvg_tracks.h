@@ -0,0 +1,69 @@
+/*
+
+  insight3d - image based 3d modelling software
+  Copyright (C) 2007-2008  Lukas Mach
+                           email: lukas.mach@gmail.com 
+                           web: http://mach.matfyz.cz/
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+  
+*/
+
+#ifndef __MVG_TRACKS
+#define __MVG_TRACKS
+
+#include "core_debug.h"
+
+// tracks (classes of corresponding features across images) built by union-find 
+// over a global index of features; feature f of image i is node offsets[i] + f; 
+// tracks are joined by size and paths are compressed on every lookup; merge which 
+// would put two features of the same image into one track is refused, so that 
+// the tracks never have to be cleaned up afterwards 
+struct Tracks 
+{
+	int images_count; 
+	size_t * offsets;              // first node of every image (images_count + 1 entries)
+	size_t nodes_count; 
+	size_t * parent;               // parent of every node, roots point to themselves 
+	size_t * size;                 // number of features in the track (valid for roots)
+	int * image;                   // image of every node 
+	int * * images;                // for roots of tracks with more than one feature sorted 
+	                               // ids of images the track is visible on (size entries)
+	size_t refused_count;          // number of merges refused because of conflicts 
+};
+
+// create singleton tracks for every feature, features_counts holds the number 
+// of features on each image 
+Tracks * mvg_tracks_create(const size_t * features_counts, const int images_count);
+
+// release tracks 
+void mvg_tracks_release(Tracks * tracks);
+
+// node of the f-th feature of an image 
+inline size_t mvg_tracks_node(const Tracks * tracks, const int image, const size_t f)
+{
+	ASSERT(image >= 0 && image < tracks->images_count && tracks->offsets[image] + f < tracks->offsets[image + 1], "feature out of range");
+	return tracks->offsets[image] + f;
+}
+
+// root node of the track containing given node 
+size_t mvg_tracks_find(Tracks * tracks, size_t node);
+
+// join tracks of two nodes, returns false if the merge was refused since both 
+// tracks contain a feature from the same image 
+bool mvg_tracks_union(Tracks * tracks, const size_t first, const size_t second);
+
+#endif
@@ -251,7 +251,9 @@ CvMat * mvg_triangulation_SVD(
 //   min_inliers_to_reconstruct - minimum number of inliers to reliably 
 //                                reconstruct the vertex (used in final 
 //                                triangulation)
-//   trials              - number of trials/iterations to do
+//   trials              - maximum number of trials/iterations to do, fewer 
+//                         trials are done when the inlier ratio allows it 
+//                         (MVG_RANSAC_PROBABILITY)
 //   threshold           - maximum value of reprojection error with which the 
 //                         point is still considered to be inlier
 //   inliers             - array of n bool values used to mark which points 
@@ -272,7 +274,8 @@ CvMat * mvg_triangulation_RANSAC(
 	const int min_inliers_to_triangulate_weaker /*= MVG_MIN_INLIERS_TO_TRIANGULATE_WEAKER*/,
 	const int trials /*= MVG_RANSAC_TRIANGULATION_TRIALS*/,
 	const double threshold /*= MVG_MEASUREMENT_THRESHOLD*/, 
-	bool * inliers /*= NULL*/
+	bool * inliers /*= NULL*/,
+	unsigned int * seed /*= NULL*/
 )
 {
 	// printf("Triangulating: ");
@@ -291,15 +294,19 @@ CvMat * mvg_triangulation_RANSAC(
 	bool * best_status = ALLOC(bool, n), * status = ALLOC(bool, n);
 	int best_inliers_count = -1;
 
-	// do this many times 
-	for (int i = 0; i < trials; i++) 
+	// do this many times; the number of trials is lowered as soon as the 
+	// best consensus set makes it unlikely that more trials would find 
+	// a better one (a point is usually seen only by a handful of cameras, 
+	// so there's no preliminary test as in mvg_resection_RANSAC)
+	int trials_needed = trials;
+	for (int i = 0; i < trials_needed; i++) 
 	{
 		// pick randomly 2 points
 		memset(status, 0, sizeof(bool) * n);
 		int samples[2];
 		for (int count = 0; count < 2;)
 		{
-			const int pick = rand() % n; 
+			const int pick = (seed ? random_number(*seed) : rand()) % n; 
 			if (!status[pick])
 			{
 				status[pick] = true; 
@@ -308,29 +315,32 @@ CvMat * mvg_triangulation_RANSAC(
 			}
 		}
 
-		// calculate using mvg_triangulation_SVD_affine
-		CvMat * X = 
-			affine ? mvg_triangulation_SVD_affine(projection_matrices, projected_points, normalize_A, 2, samples, 2)
-			       : mvg_triangulation_SVD(projection_matrices, projected_points, normalize_A, 2, samples, 2);
-		if (!X)
+		// calculate hypothesis (the same way as mvg_triangulation_SVD_affine or mvg_triangulation_SVD) 
+		double X[4];
+		if (affine) 
 		{
-			continue;
+			if (!mvg_triangulation_DLT_affine<2>(projection_matrices, projected_points, normalize_A, samples, X)) continue;
+		}
+		else
+		{
+			mvg_triangulation_DLT<2>(projection_matrices, projected_points, normalize_A, samples, X);
 		}
 
-		// count and mark the inliers
+		// count and mark the inliers, stop as soon as the hypothesis can't 
+		// beat the best one found so far 
 		int inliers_count = 0;
-		for (int j = 0; j < n; j++)
+		for (int j = 0; j < n && inliers_count + n - j > best_inliers_count; j++)
 		{
 			double reprojection[2];
 			// note that here we're using "dirty" projection method which is suitable only for visualization; on the upside, it shouldn't matter because
 			// if a point is projected on pi_infinity, there's something wrong with it anyway
 			if (affine) 
 			{
-				opencv_vertex_projection_visualization(projection_matrices[j], OPENCV_ELEM(X, 0, 0), OPENCV_ELEM(X, 1, 0), OPENCV_ELEM(X, 2, 0), reprojection);
+				opencv_vertex_projection_visualization(projection_matrices[j], X[0], X[1], X[2], reprojection);
 			}
 			else
 			{
-				opencv_vertex_projection_visualization(projection_matrices[j], OPENCV_ELEM(X, 0, 0), OPENCV_ELEM(X, 1, 0), OPENCV_ELEM(X, 2, 0), OPENCV_ELEM(X, 3, 0), reprojection);
+				opencv_vertex_projection_visualization(projection_matrices[j], X[0], X[1], X[2], X[3], reprojection);
 			}
 
 			const double
@@ -348,8 +358,6 @@ CvMat * mvg_triangulation_RANSAC(
 			}
 		}
 
-		cvReleaseMat(&X);
-
 		// check for the best sample 
 		if (inliers_count > best_inliers_count)
 		{
@@ -357,6 +365,7 @@ CvMat * mvg_triangulation_RANSAC(
 			best_status = status; 
 			status = temp;
 			best_inliers_count = inliers_count; 
+			trials_needed = ransac_trials(best_inliers_count, n, 2, MVG_RANSAC_PROBABILITY, trials);
 		}
 
 		// debug 
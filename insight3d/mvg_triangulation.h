@@ -26,6 +26,7 @@
 #define __MVG_TRIANGULATION
 
 #include "core_debug.h"
+#include "core_math_routines.h"
 #include "interface_opencv.h"
 #include "mvg_thresholds.h"
 
@@ -95,6 +96,98 @@ CvMat * mvg_triangulation_SVD(
 	int ns = -1
 );
 
+// triangulates 3d position of a point from exactly ns of its projections (like 
+// mvg_triangulation_SVD); all temporary data are kept on stack, so that it's 
+// cheap enough to generate RANSAC hypotheses; X receives homogeneous coordinates 
+template <int ns> 
+void mvg_triangulation_DLT(
+	const CvMat * projection_matrices[], const CvMat * projected_points, const bool normalize_A, 
+	const int * samples, double X[4]
+)
+{
+	double A[2 * ns * 4], V[4 * 4];
+	for (int j = 0; j < ns; j++) 
+	{
+		const int i = samples[j]; 
+		const CvMat * const P = projection_matrices[i];
+		for (int r = 0; r < 2; r++) 
+		{
+			double * const row = A + (2 * j + r) * 4; 
+			const double x = OPENCV_ELEM(projected_points, r, i);
+			for (int k = 0; k < 4; k++) row[k] = x * OPENCV_ELEM(P, 2, k) - OPENCV_ELEM(P, r, k);
+
+			// normalize the row
+			if (normalize_A) 
+			{
+				const double norm = 1 / sqrt(row[0] * row[0] + row[1] * row[1] + row[2] * row[2] + row[3] * row[3]);
+				for (int k = 0; k < 4; k++) row[k] *= norm;
+			}
+		}
+	}
+
+	smallest_right_singular_vector(A, 2 * ns, 4, V, X);
+}
+
+// triangulates finite 3d point from exactly ns of its projections (like 
+// mvg_triangulation_SVD_affine) without allocating memory; the least squares 
+// solution is found using normal equations, fails if they're singular 
+template <int ns> 
+bool mvg_triangulation_DLT_affine(
+	const CvMat * projection_matrices[], const CvMat * projected_points, const bool normalize_A, 
+	const int * samples, double X[3]
+)
+{
+	// accumulate normal equations M X = v 
+	double M[9] = { 0, 0, 0, 0, 0, 0, 0, 0, 0 }, v[3] = { 0, 0, 0 };
+	for (int j = 0; j < ns; j++) 
+	{
+		const int i = samples[j]; 
+		const CvMat * const P = projection_matrices[i];
+		for (int r = 0; r < 2; r++) 
+		{
+			const double x = OPENCV_ELEM(projected_points, r, i);
+			double row[3], b = -x * OPENCV_ELEM(P, 2, 3) + OPENCV_ELEM(P, r, 3);
+			for (int k = 0; k < 3; k++) row[k] = x * OPENCV_ELEM(P, 2, k) - OPENCV_ELEM(P, r, k);
+
+			// normalize the row
+			if (normalize_A) 
+			{
+				const double norm = 1 / sqrt(row[0] * row[0] + row[1] * row[1] + row[2] * row[2] + b * b);
+				for (int k = 0; k < 3; k++) row[k] *= norm;
+				b *= norm;
+			}
+
+			for (int k = 0; k < 3; k++) 
+			{
+				for (int l = 0; l < 3; l++) M[3 * k + l] += row[k] * row[l];
+				v[k] += row[k] * b;
+			}
+		}
+	}
+
+	// solve it using Cramer's rule 
+	const double det = 
+		M[0] * (M[4] * M[8] - M[5] * M[7]) - 
+		M[1] * (M[3] * M[8] - M[5] * M[6]) + 
+		M[2] * (M[3] * M[7] - M[4] * M[6])
+	;
+
+	if (nearly_zero(det)) return false;
+
+	for (int k = 0; k < 3; k++) 
+	{
+		double N[9]; 
+		for (int l = 0; l < 9; l++) N[l] = l % 3 == k ? v[l / 3] : M[l];
+		X[k] = (
+			N[0] * (N[4] * N[8] - N[5] * N[7]) - 
+			N[1] * (N[3] * N[8] - N[5] * N[6]) + 
+			N[2] * (N[3] * N[7] - N[4] * N[6])
+		) / det;
+	}
+
+	return true;
+}
+
 // robustly estimates the 3d position of a point given projection matrix of 
 // each camera and the coordinates where the point is visible on each camera image
 // 
@@ -118,6 +211,9 @@ CvMat * mvg_triangulation_SVD(
 //                         point is still considered to be inlier
 //   inliers             - array of n bool values used to mark which points 
 //                         are considered to be inliers
+//   seed                - (optional) state of random number generator used 
+//                         instead of rand(), so that vertices can be 
+//                         triangulated concurrently 
 //
 // returned value: 
 // 
@@ -134,7 +230,8 @@ CvMat * mvg_triangulation_RANSAC(
 	const int min_inliers_to_triangulate_weaker = MVG_MIN_INLIERS_TO_TRIANGULATE_WEAKER,
 	const int trials = MVG_RANSAC_TRIANGULATION_TRIALS,
 	const double threshold = MVG_MEASUREMENT_THRESHOLD, 
-	bool * inliers = NULL
+	bool * inliers = NULL,
+	unsigned int * seed = NULL
 );
 
 #endif
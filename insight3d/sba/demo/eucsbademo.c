@@ -892,6 +892,8 @@ void sba_driver(char *camsfname, char *ptsfname, char *calibfname, int cnp, int
   //opts[3]=0.05*numprojs; // uncomment to force termination if the average reprojection error drops below 0.05
   opts[4]=0.0;
   //opts[4]=1E-05; // uncomment to force termination if the relative reduction in the RMS reprojection error drops below 1E-05
+  opts[5]=1.0; // number of threads used for the per-point computations
+  opts[6]=SBA_SOLVER_DENSE; // or SBA_SOLVER_SPARSE to solve the reduced camera system with block sparse Cholesky
 
   /* Notice the various BA options demonstrated below */
 
@@ -682,7 +682,7 @@ int n, m, mcon, cnp, pnp, mnp, nvars, nprojs, minnvars;
 int status, reftype=BA_MOTSTRUCT, itmax, verbose=0, havejac, havedynproj, havedynprojac;
 int len, nopts, nextra, nreserved, covlen;
 double *p0, *p, *x, *covx=NULL;
-double opts[SBA_OPTSSZ]={SBA_INIT_MU, SBA_STOP_THRESH, SBA_STOP_THRESH, SBA_STOP_THRESH, 0.0};
+double opts[SBA_OPTSSZ]={SBA_INIT_MU, SBA_STOP_THRESH, SBA_STOP_THRESH, SBA_STOP_THRESH, 0.0, 1.0, SBA_SOLVER_DENSE};
 double info[SBA_INFOSZ];
 char *vmask, *str;
 register double *pdbl;
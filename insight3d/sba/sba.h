@@ -43,6 +43,12 @@
 /*#define SBA_DESTROY_COVS */
 
 
+/* define this to build without multithreading support (pthreads); the threads 
+ * count option is then ignored 
+ */
+/*#define SBA_NO_THREADS */
+
+
 /********* End of configuration options, no changes necessary beyond this point *********/
 
 #ifdef __cplusplus
@@ -52,7 +58,7 @@ extern "C" {
 #define SBA_MIN_DELTA     1E-06 // finite differentiation minimum delta
 #define SBA_DELTA_SCALE   1E-04 // finite differentiation delta scale
 
-#define SBA_OPTSSZ        5
+#define SBA_OPTSSZ        7 // [mu, eps1, eps2, eps3, eps4, threads, solver], 5 before 1.5.1
 #define SBA_INFOSZ        10
 #define SBA_ERROR         -1
 #define SBA_INIT_MU       1E-03
@@ -60,7 +66,9 @@ extern "C" {
 #define SBA_CG_NOPREC     0
 #define SBA_CG_JACOBI     1
 #define SBA_CG_SSOR       2
-#define SBA_VERSION       "1.5 (Jul. 2008)"
+#define SBA_SOLVER_DENSE  0 // reduced camera system solved with dense Cholesky (LAPACK)
+#define SBA_SOLVER_SPARSE 1 // reduced camera system solved with block sparse Cholesky
+#define SBA_VERSION       "1.5.1 (Jul. 2008, threaded motstr, sparse solver)"
 
 
 /* Sparse matrix representation using Compressed Row Storage (CRS) format.
@@ -77,6 +85,22 @@ struct sba_crsm{
                    */
 };
 
+/* Symmetric block matrix stored as the nonzero blocks of its lower triangle in Compressed
+ * Column Storage order. Every block column starts with its diagonal block and the rows of
+ * the blocks in a column are increasing. Blocks are bsz x bsz and stored row-by-row
+ */
+
+struct sba_bsm{
+    int nc;       /* #block rows/cols */
+    int bsz;      /* block size */
+    int nnz;      /* number of stored blocks */
+    double *val;  /* storage for the blocks. size: nnz*bsz*bsz */
+    int *rowidx;  /* block row indexes of the stored blocks. size: nnz */
+    int *colptr;  /* locations in rowidx that start a block column. size: nc+1.
+                   * By convention, colptr[nc]=nnz
+                   */
+};
+
 /* sparse LM */
 
 /* simple drivers */
@@ -87,6 +111,14 @@ sba_motstr_levmar(const int n, const int m, const int mcon, char *vmask, double
            void (*projac)(int j, int i, double *aj, double *bi, double *Aij, double *Bij, void *adata),
            void *adata, const int itmax, const int verbose, const double opts[SBA_OPTSSZ], double info[SBA_INFOSZ]);
 
+/* same as sba_motstr_levmar(), with visibility given as a sparse nxm matrix instead of a dense mask */
+extern int
+sba_motstr_levmar_crsm(const int n, const int m, const int mcon, struct sba_crsm *vis, double *p, const int cnp, const int pnp,
+           double *x, double *covx, const int mnp,
+           void (*proj)(int j, int i, double *aj, double *bi, double *xij, void *adata),
+           void (*projac)(int j, int i, double *aj, double *bi, double *Aij, double *Bij, void *adata),
+           void *adata, const int itmax, const int verbose, const double opts[SBA_OPTSSZ], double info[SBA_INFOSZ]);
+
 extern int
 sba_mot_levmar(const int n, const int m, const int mcon, char *vmask, double *p, const int cnp,
            double *x, double *covx, const int mnp,
@@ -110,6 +142,13 @@ sba_motstr_levmar_x(const int n, const int m, const int mcon, char *vmask, doubl
            void (*fjac)(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double *jac, void *adata),
            void *adata, const int itmax, const int verbose, const double opts[SBA_OPTSSZ], double info[SBA_INFOSZ]);
 
+extern int
+sba_motstr_levmar_x_crsm(const int n, const int m, const int mcon, struct sba_crsm *vis, double *p, const int cnp, const int pnp,
+           double *x, double *covx, const int mnp,
+           void (*func)(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double *hx, void *adata),
+           void (*fjac)(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double *jac, void *adata),
+           void *adata, const int itmax, const int verbose, const double opts[SBA_OPTSSZ], double info[SBA_INFOSZ]);
+
 extern int
 sba_mot_levmar_x(const int n, const int m, const int mcon, char *vmask, double *p, const int cnp,
            double *x, double *covx, const int mnp,
@@ -137,16 +176,23 @@ extern int sba_symat_invert_LU(double *A, int m);
 extern int sba_symat_invert_Chol(double *A, int m);
 extern int sba_symat_invert_BK(double *A, int m);
 extern int sba_mat_cholinv(double *A, double *B, int m);
+extern int sba_Axb_BSChol(struct sba_bsm *A, double *B, double *x);
 
 /* CRS sparse matrices manipulation routines */
 extern void sba_crsm_alloc(struct sba_crsm *sm, int nr, int nc, int nnz);
 extern void sba_crsm_free(struct sba_crsm *sm);
+extern void sba_crsm_build_vmask(struct sba_crsm *sm, char *vmask, int nr, int nc);
 extern int sba_crsm_elmidx(struct sba_crsm *sm, int i, int j);
 extern int sba_crsm_elmidxp(struct sba_crsm *sm, int i, int j, int jp, int jpidx);
 extern int sba_crsm_row_elmidxs(struct sba_crsm *sm, int i, int *vidxs, int *jidxs);
 extern int sba_crsm_col_elmidxs(struct sba_crsm *sm, int j, int *vidxs, int *iidxs);
 /* extern int sba_crsm_common_row(struct sba_crsm *sm, int j, int k); */
 
+/* block sparse symmetric matrices manipulation routines */
+extern void sba_bsm_schur_pattern(struct sba_bsm *bm, struct sba_crsm *idxij, int mcon, int bsz, int fill);
+extern void sba_bsm_free(struct sba_bsm *bm);
+extern int sba_bsm_blkidx(struct sba_bsm *bm, int i, int j);
+
 #ifdef __cplusplus
 }
 #endif
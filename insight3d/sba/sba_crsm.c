@@ -92,6 +92,30 @@ register int i, j, k;
   sm->rowptr[nr]=nnz;
 }
 
+/* build a sparse CRS matrix from a dense visibility mask; vals are set to the nonzero element indices */
+void sba_crsm_build_vmask(struct sba_crsm *sm, char *vmask, int nr, int nc)
+{
+int nnz;
+register int i, j, k;
+
+  /* count nonzeros */
+  for(i=nnz=0, k=nr*nc; i<k; ++i)
+    nnz+=(vmask[i]!=0);
+
+  sba_crsm_alloc(sm, nr, nc, nnz);
+
+  /* fill up the sm structure */
+  for(i=k=0; i<nr; ++i){
+    sm->rowptr[i]=k;
+    for(j=0; j<nc; ++j)
+      if(vmask[i*nc+j]){
+        sm->val[k]=k;
+        sm->colidx[k++]=j;
+      }
+  }
+  sm->rowptr[nr]=nnz;
+}
+
 /* returns the index of the (i, j) element. No bounds checking! */
 int sba_crsm_elmidx(struct sba_crsm *sm, int i, int j)
 {
@@ -228,6 +252,155 @@ register int i, k, l;
 }
 ***/
 
+/* comparison function for qsort() on integers */
+static int sba_intcmp(const void *a, const void *b)
+{
+  return *((const int *)a) - *((const int *)b);
+}
+
+/* build the block pattern of the lower triangle of the reduced camera system
+ * S_jk=U_j\delta_jk - \sum_i W_ij V_i^-1 W_ik^T for the cameras mcon..m-1 (i.e., the
+ * columns of idxij), whose block (k, j) is nonzero iff some point is visible in images
+ * j and k. If fill is nonzero, the pattern is extended by the fill-in of the Cholesky
+ * factor of S, so that the factor can overwrite S. Memory for the values is allocated
+ * but left uninitialized
+ */
+void sba_bsm_schur_pattern(struct sba_bsm *bm, struct sba_crsm *idxij, int mcon, int bsz, int fill)
+{
+register int i, j, k, l;
+int nc=idxij->nc-mcon, cnt, maxnz, r;
+int *colpts, *colptsptr, /* points visible in each free image, i.e. the transpose of idxij */
+    *mark, *rows,
+    *head, *next;        /* children of each column in the elimination tree of S */
+
+  bm->nc=nc;
+  bm->bsz=bsz;
+  bm->colptr=(int *)malloc((nc+1)*sizeof(int));
+  colptsptr=(int *)malloc((nc+1)*sizeof(int));
+  mark=(int *)malloc((4*nc+1)*sizeof(int));
+  if(!bm->colptr || !colptsptr || !mark){
+    fprintf(stderr, "SBA: memory allocation request failed in sba_bsm_schur_pattern() [nc=%d]\n", nc);
+    exit(1);
+  }
+  rows=mark+nc; head=rows+nc; next=head+nc;
+
+  /* transpose the free image part of idxij */
+  for(j=0; j<=nc; ++j)
+    colptsptr[j]=0;
+  for(k=0; k<idxij->nnz; ++k)
+    if(idxij->colidx[k]>=mcon) ++colptsptr[idxij->colidx[k]-mcon+1];
+  for(j=0; j<nc; ++j)
+    colptsptr[j+1]+=colptsptr[j];
+  colpts=(int *)malloc((colptsptr[nc]+1)*sizeof(int));
+  if(!colpts){
+    fprintf(stderr, "SBA: memory allocation request failed in sba_bsm_schur_pattern() [nnz=%d]\n", colptsptr[nc]);
+    exit(1);
+  }
+  for(i=0; i<idxij->nr; ++i)
+    for(k=idxij->rowptr[i]; k<idxij->rowptr[i+1]; ++k)
+      if(idxij->colidx[k]>=mcon) colpts[colptsptr[idxij->colidx[k]-mcon]++]=i;
+  for(j=nc; j>0; --j)
+    colptsptr[j]=colptsptr[j-1];
+  colptsptr[0]=0;
+
+  for(j=0; j<nc; ++j)
+    mark[j]=head[j]=-1;
+
+  maxnz=4*nc+1;
+  bm->rowidx=(int *)malloc(maxnz*sizeof(int));
+  bm->colptr[0]=0;
+  for(j=0, bm->nnz=0; j<nc; ++j){
+    /* the diagonal block is always present */
+    mark[j]=j;
+    rows[0]=j; cnt=1;
+
+    /* blocks due to points visible in image j and a later one */
+    for(l=colptsptr[j]; l<colptsptr[j+1]; ++l){
+      i=colpts[l];
+      for(k=idxij->rowptr[i+1]-1; k>=idxij->rowptr[i] && (r=idxij->colidx[k]-mcon)>j; --k)
+        if(mark[r]!=j){
+          mark[r]=j;
+          rows[cnt++]=r;
+        }
+    }
+
+    /* fill-in: column j inherits the rows of its children in the elimination tree */
+    if(fill){
+      for(l=head[j]; l!=-1; l=next[l])
+        for(k=bm->colptr[l]+1; k<bm->colptr[l+1]; ++k)
+          if((r=bm->rowidx[k])>j && mark[r]!=j){
+            mark[r]=j;
+            rows[cnt++]=r;
+          }
+    }
+
+    qsort(rows+1, cnt-1, sizeof(int), sba_intcmp);
+
+    /* the parent of j is the first off diagonal row */
+    if(fill && cnt>1){
+      next[j]=head[rows[1]];
+      head[rows[1]]=j;
+    }
+
+    if(bm->nnz+cnt>maxnz){
+      while(bm->nnz+cnt>maxnz) maxnz*=2;
+      bm->rowidx=(int *)realloc(bm->rowidx, maxnz*sizeof(int));
+    }
+    if(!bm->rowidx){
+      fprintf(stderr, "SBA: memory allocation request failed in sba_bsm_schur_pattern() [nnz=%d]\n", maxnz);
+      exit(1);
+    }
+
+    for(k=0; k<cnt; ++k)
+      bm->rowidx[bm->nnz++]=rows[k];
+    bm->colptr[j+1]=bm->nnz;
+  }
+
+  bm->val=(double *)malloc((bm->nnz*bsz*bsz+1)*sizeof(double));
+  if(!bm->val){
+    fprintf(stderr, "SBA: memory allocation request failed in sba_bsm_schur_pattern() [nnz=%d, bsz=%d]\n", bm->nnz, bsz);
+    exit(1);
+  }
+
+  free(colpts);
+  free(colptsptr);
+  free(mark);
+}
+
+/* free a block sparse symmetric matrix */
+void sba_bsm_free(struct sba_bsm *bm)
+{
+  bm->nc=bm->nnz=-1;
+  free(bm->val);
+  free(bm->rowidx);
+  free(bm->colptr);
+  bm->val=NULL;
+  bm->rowidx=bm->colptr=NULL;
+}
+
+/* returns the index of the (i, j) block, i>=j, -1 if it isn't stored. No bounds checking! */
+int sba_bsm_blkidx(struct sba_bsm *bm, int i, int j)
+{
+register int low, high, mid, diff;
+
+  low=bm->colptr[j];
+  high=bm->colptr[j+1]-1;
+
+  /* binary search for finding the block at row i */
+  while(low<=high){
+    mid=(low+high)>>1;
+    diff=i-bm->rowidx[mid];
+    if(diff<0)
+      high=mid-1;
+    else if(diff>0)
+      low=mid+1;
+    else
+      return mid;
+  }
+
+  return -1; /* not found */
+}
+
 #if 0
 /* returns 1 if there exists a row i having columns j and k,
  * i.e. a row i s.t. elements (i, j) and (i, k) are nonzero;
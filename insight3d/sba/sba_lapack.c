@@ -484,6 +484,157 @@ int info, nrhs=1;
 	return 1;
 }
 
+/*
+ * This function returns the solution of Ax=b for a block sparse A
+ *
+ * The function assumes that A is symmetric & positive definite and employs
+ * the Cholesky decomposition A=L L^T with L block lower triangular, computed
+ * block column by block column (right looking). The pattern of A must already
+ * include the fill-in of L (see sba_bsm_schur_pattern()), A is overwritten
+ * with L. The system is then solved with L y = b and L^T x = y.
+ * Unlike the dense solvers above, no LAPACK routines are involved; since
+ * the reduced camera system of a typical reconstruction is sparse, this is
+ * considerably faster than factoring it as a dense matrix.
+ *
+ * A is nc*bsz x nc*bsz, b is nc*bsz x 1 and isn't modified.
+ *
+ * The function returns 0 in case of error, 1 if successfull
+ *
+ * To avoid repetitive malloc's and free's, allocated memory is retained between
+ * calls and free'd-malloc'ed when not of the appropriate size.
+ * A call with NULL as the first argument forces this memory to be released.
+ */
+int sba_Axb_BSChol(struct sba_bsm *A, double *B, double *x)
+{
+static int *buf=NULL;
+static int buf_sz=0;
+
+int *blkpos; /* position of the blocks of a single column, indexed by their row */
+double *Ljj, *Lrj, *Lkj, *Ark, *xj, *xr;
+register int i, j, k, l, r, p, q, t;
+int nc, bsz, bsz2;
+register double sum;
+
+    if(A==NULL){
+      if(buf) free(buf);
+      buf=NULL;
+      buf_sz=0;
+
+      return 1;
+    }
+
+    nc=A->nc; bsz=A->bsz; bsz2=bsz*bsz;
+    if(nc>buf_sz){ /* insufficient memory */
+      if(buf) free(buf); /* free previously allocated memory */
+
+      buf_sz=nc;
+      buf=(int *)malloc(buf_sz*sizeof(int));
+      if(!buf){
+        fprintf(stderr, "memory allocation in sba_Axb_BSChol() failed!\n");
+        exit(1);
+      }
+    }
+    blkpos=buf;
+
+  /* factorization */
+  for(j=0; j<nc; ++j){
+    /* Cholesky decomposition of the diagonal block, only its lower triangle is used */
+    Ljj=A->val + A->colptr[j]*bsz2;
+    for(k=0; k<bsz; ++k){
+      for(l=0, sum=Ljj[k*bsz+k]; l<k; ++l)
+        sum-=Ljj[k*bsz+l]*Ljj[k*bsz+l];
+      if(sum<=0.0 || !SBA_FINITE(sum)) return 0; /* not positive definite */
+      Ljj[k*bsz+k]=sqrt(sum);
+
+      for(i=k+1; i<bsz; ++i){
+        for(l=0, sum=Ljj[i*bsz+k]; l<k; ++l)
+          sum-=Ljj[i*bsz+l]*Ljj[k*bsz+l];
+        Ljj[i*bsz+k]=sum/Ljj[k*bsz+k];
+      }
+    }
+
+    /* off diagonal blocks L_rj=A_rj L_jj^-T, i.e. solve L_jj L_rj^T = A_rj^T row by row */
+    for(p=A->colptr[j]+1; p<A->colptr[j+1]; ++p){
+      Lrj=A->val + p*bsz2;
+      for(i=0; i<bsz; ++i)
+        for(k=0; k<bsz; ++k){
+          for(l=0, sum=Lrj[i*bsz+k]; l<k; ++l)
+            sum-=Lrj[i*bsz+l]*Ljj[k*bsz+l];
+          Lrj[i*bsz+k]=sum/Ljj[k*bsz+k];
+        }
+    }
+
+    /* update the trailing submatrix: A_rk-=L_rj L_kj^T for all r>=k>j in the pattern of column j */
+    for(q=A->colptr[j]+1; q<A->colptr[j+1]; ++q){
+      k=A->rowidx[q];
+      Lkj=A->val + q*bsz2;
+
+      for(l=A->colptr[k]; l<A->colptr[k+1]; ++l)
+        blkpos[A->rowidx[l]]=l;
+
+      for(p=q; p<A->colptr[j+1]; ++p){
+        r=A->rowidx[p];
+        Lrj=A->val + p*bsz2;
+        Ark=A->val + blkpos[r]*bsz2; /* the fill-in guarantees that block (r, k) is present */
+
+        for(i=0; i<bsz; ++i)
+          for(l=0; l<bsz; ++l){
+            for(t=0, sum=0.0; t<bsz; ++t)
+              sum+=Lrj[i*bsz+t]*Lkj[l*bsz+t];
+            Ark[i*bsz+l]-=sum;
+          }
+      }
+    }
+  }
+
+  /* solve L y = b */
+  for(i=nc*bsz-1; i>=0; --i)
+    x[i]=B[i];
+  for(j=0; j<nc; ++j){
+    Ljj=A->val + A->colptr[j]*bsz2;
+    xj=x + j*bsz;
+    for(k=0; k<bsz; ++k){
+      for(l=0, sum=xj[k]; l<k; ++l)
+        sum-=Ljj[k*bsz+l]*xj[l];
+      xj[k]=sum/Ljj[k*bsz+k];
+    }
+
+    for(p=A->colptr[j]+1; p<A->colptr[j+1]; ++p){
+      Lrj=A->val + p*bsz2;
+      xr=x + A->rowidx[p]*bsz;
+      for(i=0; i<bsz; ++i){
+        for(l=0, sum=0.0; l<bsz; ++l)
+          sum+=Lrj[i*bsz+l]*xj[l];
+        xr[i]-=sum;
+      }
+    }
+  }
+
+  /* solve L^T x = y */
+  for(j=nc-1; j>=0; --j){
+    Ljj=A->val + A->colptr[j]*bsz2;
+    xj=x + j*bsz;
+
+    for(p=A->colptr[j]+1; p<A->colptr[j+1]; ++p){
+      Lrj=A->val + p*bsz2;
+      xr=x + A->rowidx[p]*bsz;
+      for(l=0; l<bsz; ++l){
+        for(i=0, sum=0.0; i<bsz; ++i)
+          sum+=Lrj[i*bsz+l]*xr[i];
+        xj[l]-=sum;
+      }
+    }
+
+    for(k=bsz-1; k>=0; --k){
+      for(l=k+1, sum=xj[k]; l<bsz; ++l)
+        sum-=Ljj[l*bsz+k]*xj[l];
+      xj[k]=sum/Ljj[k*bsz+k];
+    }
+  }
+
+  return 1;
+}
+
 /*
  * This function returns the solution of Ax = b
  *
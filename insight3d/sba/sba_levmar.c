@@ -24,6 +24,10 @@
 #include <math.h>
 #include <float.h>
 
+#ifndef SBA_NO_THREADS
+#include <pthread.h>
+#endif /* SBA_NO_THREADS */
+
 #include "compiler.h"
 #include "sba.h"
 #include "sba_chkjac.h"
@@ -438,6 +442,360 @@ static void sba_fdjac_x(
   free(tmpd);
 }
 
+/* inverts the symmetric positive definite mxm matrix whose upper triangle is stored in A using
+ * its Cholesky decomposition; the lower triangle of the inverse is saved in the lower triangle
+ * of A and the strictly upper triangle is left untouched. Unlike sba_symat_invert_*(), this
+ * routine doesn't retain any memory between calls (work is 2*m*m), so it is safe to be called
+ * from several threads concurrently. Returns 0 if A isn't positive definite, 1 otherwise
+ */
+static int sba_symat_invert_small(double *A, int m, double *work)
+{
+register int i, j, k;
+register double sum;
+double *L=work, *iL=work+m*m;
+
+  /* A=L L^T; note that A_ij, i>=j is stored in A[j*m+i] */
+  for(j=0; j<m; ++j){
+    for(k=0, sum=A[j*m+j]; k<j; ++k)
+      sum-=L[j*m+k]*L[j*m+k];
+    if(sum<=0.0 || !SBA_FINITE(sum)) return 0;
+    L[j*m+j]=sqrt(sum);
+
+    for(i=j+1; i<m; ++i){
+      for(k=0, sum=A[j*m+i]; k<j; ++k)
+        sum-=L[i*m+k]*L[j*m+k];
+      L[i*m+j]=sum/L[j*m+j];
+    }
+  }
+
+  /* L^-1, lower triangular */
+  for(j=0; j<m; ++j){
+    iL[j*m+j]=1.0/L[j*m+j];
+    for(i=j+1; i<m; ++i){
+      for(k=j, sum=0.0; k<i; ++k)
+        sum-=L[i*m+k]*iL[k*m+j];
+      iL[i*m+j]=sum/L[i*m+i];
+    }
+  }
+
+  /* A^-1=L^-T L^-1 */
+  for(i=0; i<m; ++i)
+    for(j=0; j<=i; ++j){
+      for(k=i, sum=0.0; k<m; ++k)
+        sum+=iL[k*m+i]*iL[k*m+j];
+      A[i*m+j]=sum;
+    }
+
+  return 1;
+}
+
+/* data of a thread computing the per-point parts of an iteration of sba_motstr_levmar_x_crsm().
+ * Every thread processes its own range of points; their contributions to the blocks of S and
+ * to the e_j are summed in per-thread accumulators (Spart, Epart), which are afterwards reduced
+ * by block columns of S, again in parallel
+ */
+struct sba_motstr_thread_data_ {
+  int tid;          /* thread index */
+  int first, last;  /* points first, ..., last-1 are processed by this thread */
+  int fcol, lcol;   /* block columns fcol, ..., lcol-1 of S (i.e., images mcon+fcol, ...) are reduced by this thread */
+  int singular;     /* i+1 if V*_i could not be inverted, 0 otherwise */
+
+  /* problem data, the same for all threads */
+  struct sba_crsm *idxij;
+  int m, mcon, nt, cnp, pnp, mnp;
+  double *jac, *e, *U, *V, *W, *ea, *eb, *E, *dpa, *dpb;
+  double mu;
+  struct sba_bsm *S;  /* lower triangle of S, its pattern includes the fill-in if S is factored in place */
+  double *Sdense;     /* S as a dense matrix, NULL if not needed */
+  double *Spart,      /* per-thread accumulators of \sum_i Y_ij W_ik^T, nt*S->nnz blocks */
+         *Epart;      /* per-thread accumulators of \sum_i Y_ij eb_i, nt*m*cnp */
+
+  /* work memory of the thread */
+  double *Y;        /* Y_ij of a single point, size maxCvis*cnp*pnp */
+  double *work;     /* size 2*pnp*pnp + pnp */
+};
+
+/* compute V_i = \sum_j B_ij^T B_ij (its upper triangle), eb_i = \sum_j B_ij^T e_ij and
+ * W_ij = A_ij^T B_ij for the points of a thread
+ */
+static void *sba_motstr_VWeb_thread(void *arg)
+{
+struct sba_motstr_thread_data_ *td=(struct sba_motstr_thread_data_ *)arg;
+struct sba_crsm *idxij=td->idxij;
+const int cnp=td->cnp, pnp=td->pnp, mnp=td->mnp;
+const int Asz=mnp*cnp, ABsz=Asz + mnp*pnp, Vsz=pnp*pnp, Wsz=cnp*pnp;
+register int i, ii, jj, k, l;
+register double *ptr1, *ptr2, *ptr3, *ptr4, sum;
+
+  for(i=td->first; i<td->last; ++i){
+    ptr1=td->V + i*Vsz; // set ptr1 to point to V_i
+    ptr2=td->eb + i*pnp; // set ptr2 to point to eb_i
+    _dblzero(ptr1, Vsz);
+    _dblzero(ptr2, pnp);
+
+    for(l=idxij->rowptr[i]; l<idxij->rowptr[i+1]; ++l){
+      /* set ptr3 to point to B_ij, actual column number in idxij->colidx[l] */
+      ptr3=td->jac + idxij->val[l]*ABsz + Asz;
+
+      /* compute the UPPER TRIANGULAR PART of B_ij^T B_ij and add it to V_i */
+      for(ii=0; ii<pnp; ++ii)
+        for(jj=ii; jj<pnp; ++jj){
+          for(k=0, sum=0.0; k<mnp; ++k)
+            sum+=ptr3[k*pnp+ii]*ptr3[k*pnp+jj];
+          ptr1[ii*pnp+jj]+=sum;
+        }
+
+      ptr4=td->e + idxij->val[l]*mnp; /* set ptr4 to point to e_ij */
+      /* compute B_ij^T e_ij and add it to eb_i */
+      for(ii=0; ii<pnp; ++ii){
+        for(jj=0, sum=0.0; jj<mnp; ++jj)
+          sum+=ptr3[jj*pnp+ii]*ptr4[jj];
+        ptr2[ii]+=sum;
+      }
+
+      /* compute W_ij = A_ij^T B_ij */
+      ptr4=td->W + idxij->val[l]*Wsz; // set ptr4 to point to W_ij
+      if(idxij->colidx[l]<td->mcon){ /* A_ij is zero */
+        _dblzero(ptr4, Wsz);
+        continue;
+      }
+
+      ptr3=td->jac + idxij->val[l]*ABsz; // set ptr3 to point to A_ij, ptr3+Asz points to B_ij
+      for(ii=0; ii<cnp; ++ii)
+        for(jj=0; jj<pnp; ++jj){
+          for(k=0, sum=0.0; k<mnp; ++k)
+            sum+=ptr3[k*cnp+ii]*ptr3[Asz+k*pnp+jj];
+          ptr4[ii*pnp+jj]=sum;
+        }
+    }
+  }
+
+  return NULL;
+}
+
+/* augment and invert V_i, compute Y_ij = W_ij (V*_i)^-1 and accumulate Y_ij W_ik^T and Y_ij eb_i
+ * over the points of a thread
+ */
+static void *sba_motstr_schur_thread(void *arg)
+{
+struct sba_motstr_thread_data_ *td=(struct sba_motstr_thread_data_ *)arg;
+struct sba_crsm *idxij=td->idxij;
+const int cnp=td->cnp, pnp=td->pnp, mcon=td->mcon;
+const int Vsz=pnp*pnp, Wsz=cnp*pnp, Ysz=cnp*pnp, Usz=cnp*cnp;
+double *Spart=td->Spart + td->tid*td->S->nnz*Usz, *Epart=td->Epart + td->tid*td->m*cnp;
+register int i, j, k, ii, jj, l, a, b;
+int first, nnz, p;
+register double *ptr1, *ptr2, *ptr3, *ptr4, sum;
+
+  td->singular=0;
+  _dblzero(Spart, td->S->nnz*Usz);
+  _dblzero(Epart, td->m*cnp);
+
+  for(i=td->first; i<td->last; ++i){
+    /* augment V_i and compute (V*_i)^-1. Recall that only the upper triangle of V*_i is stored,
+     * its inverse is saved in the lower triangle
+     */
+    ptr1=td->V + i*Vsz; // set ptr1 to point to V_i
+    for(j=0; j<pnp; ++j)
+      ptr1[j*pnp+j]+=td->mu;
+    if(!sba_symat_invert_small(ptr1, pnp, td->work)){
+      td->singular=i+1;
+      return NULL;
+    }
+
+    first=idxij->rowptr[i];
+    nnz=idxij->rowptr[i+1]-first;
+
+    /* compute the Y_ij = W_ij (V*_i)^-1 of the point */
+    for(a=0; a<nnz; ++a){
+      if(idxij->colidx[first+a]<mcon) continue; /* W_ij is zero */
+
+      ptr2=td->W + idxij->val[first+a]*Wsz; // set ptr2 to point to W_ij
+      ptr3=td->Y + a*Ysz; // set ptr3 to point to Y_ij
+      for(ii=0; ii<cnp; ++ii){
+        ptr4=ptr2+ii*pnp;
+        for(jj=0; jj<pnp; ++jj){
+          for(k=0, sum=0.0; k<=jj; ++k)
+            sum+=ptr4[k]*ptr1[jj*pnp+k];
+          for( ; k<pnp; ++k)
+            sum+=ptr4[k]*ptr1[k*pnp+jj];
+          ptr3[ii*pnp+jj]=sum;
+        }
+      }
+    }
+
+    /* accumulate Y_ik W_ij^T for all images j<=k of the point into block (k, j) of the lower triangle of S,
+     * images of a point are sorted, thus b>=a implies k>=j
+     */
+    for(a=0; a<nnz; ++a){
+      if((j=idxij->colidx[first+a])<mcon) continue;
+      ptr2=td->W + idxij->val[first+a]*Wsz; // set ptr2 to point to W_ij
+
+      for(b=a; b<nnz; ++b){
+        k=idxij->colidx[first+b];
+        p=sba_bsm_blkidx(td->S, k-mcon, j-mcon);
+        ptr1=Spart + p*Usz; // set ptr1 to point to the accumulator of block (k, j)
+        ptr3=td->Y + b*Ysz; // set ptr3 to point to Y_ik
+
+        for(ii=0; ii<cnp; ++ii){
+          ptr4=ptr3+ii*pnp;
+          for(jj=0; jj<cnp; ++jj){
+            for(l=0, sum=0.0; l<pnp; ++l)
+              sum+=ptr4[l]*ptr2[jj*pnp+l];
+            ptr1[ii*cnp+jj]+=sum;
+          }
+        }
+      }
+
+      /* accumulate Y_ij eb_i */
+      ptr1=Epart + j*cnp;
+      ptr3=td->Y + a*Ysz;
+      ptr4=td->eb + i*pnp;
+      for(ii=0; ii<cnp; ++ii){
+        for(jj=0, sum=0.0; jj<pnp; ++jj)
+          sum+=ptr3[ii*pnp+jj]*ptr4[jj];
+        ptr1[ii]+=sum;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/* reduce the per-thread accumulators into S_jk = U_j\delta_jk - \sum_i Y_ij W_ik^T and
+ * e_j = ea_j - \sum_i Y_ij eb_i for the block columns of a thread
+ */
+static void *sba_motstr_reduce_thread(void *arg)
+{
+struct sba_motstr_thread_data_ *td=(struct sba_motstr_thread_data_ *)arg;
+struct sba_bsm *S=td->S;
+const int cnp=td->cnp, mcon=td->mcon, Usz=cnp*cnp, Sdim=S->nc*cnp;
+const int Sstride=S->nnz*Usz, Estride=td->m*cnp;
+register int c, j, r, p, t, ii, jj;
+register double *ptr1, *ptr2, sum;
+
+  for(c=td->fcol; c<td->lcol; ++c){
+    j=c+mcon;
+    for(p=S->colptr[c]; p<S->colptr[c+1]; ++p){
+      ptr1=S->val + p*Usz; // set ptr1 to point to block (r, c)
+      for(ii=0; ii<Usz; ++ii){
+        ptr2=td->Spart + p*Usz + ii;
+        for(t=0, sum=0.0; t<td->nt; ++t, ptr2+=Sstride)
+          sum+=*ptr2;
+        ptr1[ii]=-sum;
+      }
+
+      if(p==S->colptr[c]){ /* Kronecker */
+        ptr2=td->U + j*Usz; // set ptr2 to point to U_j
+        for(ii=0; ii<Usz; ++ii)
+          ptr1[ii]+=ptr2[ii];
+      }
+
+      /* S is symmetric, thus its storage order doesn't matter */
+      if(td->Sdense){
+        r=S->rowidx[p];
+        for(ii=0; ii<cnp; ++ii)
+          for(jj=0; jj<cnp; ++jj)
+            td->Sdense[(r*cnp+ii)*Sdim + c*cnp+jj]=td->Sdense[(c*cnp+jj)*Sdim + r*cnp+ii]=ptr1[ii*cnp+jj];
+      }
+    }
+
+    ptr1=td->E + j*cnp; // set ptr1 to point to e_j
+    ptr2=td->ea + j*cnp; // set ptr2 to point to ea_j
+    for(ii=0; ii<cnp; ++ii){
+      for(t=0, sum=0.0; t<td->nt; ++t)
+        sum+=td->Epart[t*Estride + j*cnp+ii];
+      ptr1[ii]=ptr2[ii] - sum;
+    }
+  }
+
+  return NULL;
+}
+
+/* compute db_i = (V*_i)^-1 (eb_i - \sum_j W_ij^T da_j) for the points of a thread */
+static void *sba_motstr_db_thread(void *arg)
+{
+struct sba_motstr_thread_data_ *td=(struct sba_motstr_thread_data_ *)arg;
+struct sba_crsm *idxij=td->idxij;
+const int cnp=td->cnp, pnp=td->pnp, Vsz=pnp*pnp, Wsz=cnp*pnp;
+double *Wtda=td->work;
+register int i, ii, jj, l;
+register double *ptr1, *ptr2, *ptr3, *ptr4, sum;
+
+  for(i=td->first; i<td->last; ++i){
+    ptr1=td->dpb + i*pnp; // set ptr1 to point to db_i
+
+    /* compute \sum_j W_ij^T da_j */
+    /* Recall that W_ij is cnp x pnp and da_j is cnp x 1 */
+    _dblzero(Wtda, pnp); /* clear Wtda */
+    for(l=idxij->rowptr[i]; l<idxij->rowptr[i+1]; ++l){
+      if(idxij->colidx[l]<td->mcon) continue; /* W_ij is zero */
+
+      ptr2=td->W + idxij->val[l]*Wsz; // set ptr2 to point to W_ij
+      ptr3=td->dpa + idxij->colidx[l]*cnp; // set ptr3 to point to da_j
+
+      for(ii=0; ii<pnp; ++ii){
+        ptr4=ptr2+ii;
+        for(jj=0, sum=0.0; jj<cnp; ++jj)
+          sum+=ptr4[jj*pnp]*ptr3[jj];
+        Wtda[ii]+=sum;
+      }
+    }
+
+    /* compute eb_i - \sum_j W_ij^T da_j = eb_i - Wtda in Wtda */
+    ptr2=td->eb + i*pnp; // set ptr2 to point to eb_i
+    for(ii=0; ii<pnp; ++ii)
+      Wtda[ii]=ptr2[ii] - Wtda[ii];
+
+    /* compute the product (V*_i)^-1 Wtda = (V*_i)^-1 (eb_i - \sum_j W_ij^T da_j).
+     * Recall that only the lower triangle of (V*_i)^-1 is stored
+     */
+    ptr2=td->V + i*Vsz; // set ptr2 to point to (V*_i)^-1
+    for(ii=0; ii<pnp; ++ii){
+      for(jj=0, sum=0.0; jj<=ii; ++jj)
+        sum+=ptr2[ii*pnp+jj]*Wtda[jj];
+      for( ; jj<pnp; ++jj)
+        sum+=ptr2[jj*pnp+ii]*Wtda[jj];
+      ptr1[ii]=sum;
+    }
+  }
+
+  return NULL;
+}
+
+/* call func for all nt thread data in td; they are processed concurrently unless
+ * SBA_NO_THREADS is defined, the last one in the calling thread
+ */
+static void sba_motstr_run_threads(void *(*func)(void *), struct sba_motstr_thread_data_ *td, int nt)
+{
+register int t;
+#ifndef SBA_NO_THREADS
+pthread_t *tids;
+int *started;
+
+  if(nt>1){
+    tids=(pthread_t *)emalloc(nt*sizeof(pthread_t));
+    started=(int *)emalloc(nt*sizeof(int));
+
+    for(t=0; t<nt-1; ++t)
+      started[t]=!pthread_create(tids+t, NULL, func, (void *)(td+t));
+    (*func)((void *)(td+nt-1));
+
+    /* threads that couldn't be created are run here */
+    for(t=0; t<nt-1; ++t)
+      if(started[t]) pthread_join(tids[t], NULL);
+      else (*func)((void *)(td+t));
+
+    free(tids);
+    free(started);
+    return;
+  }
+#endif /* SBA_NO_THREADS */
+
+  for(t=0; t<nt; ++t)
+    (*func)((void *)(td+t));
+}
+
 typedef int (*PLS)(double *A, double *B, double *x, int m, int iscolmaj);
 
 /* Bundle adjustment on camera and structure parameters 
@@ -446,13 +804,16 @@ typedef int (*PLS)(double *A, double *B, double *x, int m, int iscolmaj);
  * Returns the number of iterations (>=0) if successfull, SBA_ERROR if failed
  */
 
-int sba_motstr_levmar_x(
+int sba_motstr_levmar_x_crsm(
     const int n,   /* number of points */
     const int m,   /* number of images */
     const int mcon,/* number of images (starting from the 1st) whose parameters should not be modified.
 					          * All A_ij (see below) with j<mcon are assumed to be zero
 					          */
-    char *vmask,  /* visibility mask: vmask[i, j]=1 if point i visible in image j, 0 otherwise. nxm */
+    struct sba_crsm *vis, /* visibility: nxm sparse matrix whose nonzero elements (i, j) are the images j in which
+                   * point i is visible; only rowptr & colidx are used, val is ignored. Column indices in
+                   * each row must be increasing. Memory needed scales with the number of projections
+                   */
     double *p,    /* initial parameter vector p0: (a1, ..., am, b1, ..., bn).
                    * aj are the image j parameters, bi are the i-th point parameters,
                    * size m*cnp + n*pnp
@@ -462,13 +823,13 @@ int sba_motstr_levmar_x(
     double *x,    /* measurements vector: (x_11^T, .. x_1m^T, ..., x_n1^T, .. x_nm^T)^T where
                    * x_ij is the projection of the i-th point on the j-th image.
                    * NOTE: some of the x_ij might be missing, if point i is not visible in image j;
-                   * see vmask[i, j], max. size n*m*mnp
+                   * see vis, max. size n*m*mnp
                    */
     double *covx, /* measurements covariance matrices: (Sigma_x_11, .. Sigma_x_1m, ..., Sigma_x_n1, .. Sigma_x_nm),
                    * where Sigma_x_ij is the mnp x mnp covariance of x_ij stored row-by-row. Set to NULL if no
                    * covariance estimates are available (identity matrices are implicitly used in this case).
                    * NOTE: a certain Sigma_x_ij is missing if the corresponding x_ij is also missing;
-                   * see vmask[i, j], max. size n*m*mnp*mnp
+                   * see vis, max. size n*m*mnp*mnp
                    */
     const int mnp,/* number of parameters for EACH measurement; usually 2 */
     void (*func)(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double *hx, void *adata),
@@ -498,8 +859,10 @@ int sba_motstr_levmar_x(
     const int itmax,   /* I: maximum number of iterations. itmax==0 signals jacobian verification followed by immediate return */
     const int verbose, /* I: verbosity */
     const double opts[SBA_OPTSSZ],
-	                     /* I: minim. options [\mu, \epsilon1, \epsilon2, \epsilon3, \epsilon4]. Respectively the scale factor for initial \mu,
-                        * stopping thresholds for ||J^T e||_inf, ||dp||_2, ||e||_2 and (||e||_2-||e_new||_2)/||e||_2
+	                     /* I: minim. options [\mu, \epsilon1, \epsilon2, \epsilon3, \epsilon4, threads, solver]. Respectively the scale factor for initial \mu,
+                        * stopping thresholds for ||J^T e||_inf, ||dp||_2, ||e||_2 and (||e||_2-||e_new||_2)/||e||_2,
+                        * the number of threads computing the per-point parts of the normal equations (<=1 for none) and
+                        * the solver for the reduced camera system (SBA_SOLVER_DENSE or SBA_SOLVER_SPARSE)
                         */
     double info[SBA_INFOSZ]
 	                     /* O: information regarding the minimization. Set to NULL if don't care
@@ -519,10 +882,10 @@ int sba_motstr_levmar_x(
                         */
 )
 {
-register int i, j, ii, jj, k, l;
+register int i, j, ii, jj, k;
 int nvis, nnz, retval;
 
-/* The following are work arrays that are dynamically allocated by sba_motstr_levmar_x() */
+/* The following are work arrays that are dynamically allocated by sba_motstr_levmar_x_crsm() */
 double *jac;  /* work array for storing the jacobian, max. size n*m*(mnp*cnp + mnp*pnp) */
 double *U;    /* work array for storing the U_j in the order U_1, ..., U_m, size m*cnp*cnp */
 double *V;    /* work array for storing the *strictly upper triangles* of V_i in the order V_1, ..., V_n, size n*pnp*pnp.
@@ -542,27 +905,31 @@ double *E;   /* work array for storing the e_j in the order e_1, .. e_m, size m*
  */
 double *W;    /* work array for storing the W_ij in the order W_11, ..., W_1m, ..., W_n1, ..., W_nm,
                  max. size n*m*cnp*pnp */
-double *Yj;   /* work array for storing the Y_ij for a *fixed* j in the order Y_1j, Y_nj,
-                 max. size n*cnp*pnp */
-double *YWt;  /* work array for storing \sum_i Y_ij W_ik^T, size cnp*cnp */
-double *S;    /* work array for storing the block array S_jk, size m*m*cnp*cnp */
+double *S=    /* work array for storing the block array S_jk when solved as a dense matrix, size (m-mcon)*(m-mcon)*cnp*cnp */
+          NULL;
 double *dp;   /* work array for storing the parameter vector updates da_1, ..., da_m, db_1, ..., db_n, size m*cnp + n*pnp */
-double *Wtda; /* work array for storing \sum_j W_ij^T da_j, size pnp */
 double *wght= /* work array for storing the weights computed from the covariance inverses, max. size n*m*mnp*mnp */
             NULL;
 
-/* Of the above arrays, jac, e, W, Yj, wght are sparse and
- * U, V, eab, E, S, dp are dense. Sparse arrays (except Yj) are indexed
+/* Of the above arrays, jac, e, W, wght are sparse and
+ * U, V, eab, E, S, dp are dense. Sparse arrays are indexed
  * through idxij (see below), that is with the same mechanism as the input 
  * measurements vector x
  */
 
+struct sba_bsm Sbsm; /* the nonzero blocks of the lower triangle of S (with the fill-in of its Cholesky factor
+                      * if it is solved as a sparse matrix), size <= (m-mcon)*(m-mcon+1)/2*cnp*cnp
+                      */
+int nt, solver;      /* number of threads and the solver for S */
+struct sba_motstr_thread_data_ *thrdata; /* per-thread data */
+double *thrwork;     /* per-thread accumulators and work memory, see struct sba_motstr_thread_data_ */
+
 double *pa, *pb, *ea, *eb, *dpa, *dpb; /* pointers into p, jac, eab and dp respectively */
 
 /* submatrices sizes */
 int Asz, Bsz, ABsz, Usz, Vsz,
-    Wsz, Ysz, esz, easz, ebsz,
-    YWtsz, Wtdasz, Sblsz, covsz;
+    Wsz, Ysz, esz, easz,
+    Sblsz, covsz;
 
 int Sdim; /* S matrix actual dimension */
 
@@ -602,7 +969,6 @@ int nu=2, nu2, stop=0, nfev, njev=0, nlss=0;
 int nobs, nvars;
 const int mmcon=m-mcon;
 PLS linsolver=NULL;
-int (*matinv)(double *A, int m)=NULL;
 
 struct fdj_data_x_ fdj_data;
 void *jac_adata;
@@ -615,16 +981,13 @@ void *jac_adata;
   Usz=cnp * cnp; Vsz=pnp * pnp;
   Wsz=cnp * pnp; Ysz=cnp * pnp;
   esz=mnp;
-  easz=cnp; ebsz=pnp;
-  YWtsz=cnp * cnp;
-  Wtdasz=pnp;
+  easz=cnp;
   Sblsz=cnp * cnp;
   Sdim=mmcon * cnp;
   covsz=mnp * mnp;
 
   /* count total number of visible image points */
-  for(i=nvis=0, jj=n*m; i<jj; ++i)
-    nvis+=(vmask[i]!=0);
+  nvis=vis->nnz;
 
   nobs=nvis*mnp;
   nvars=m*cnp + n*pnp;
@@ -636,27 +999,26 @@ void *jac_adata;
 
   /* allocate & fill up the idxij structure */
   sba_crsm_alloc(&idxij, n, m, nvis);
-  for(i=k=0; i<n; ++i){
-    idxij.rowptr[i]=k;
-    ii=i*m;
-    for(j=0; j<m; ++j)
-      if(vmask[ii+j]){
-        idxij.val[k]=k;
-        idxij.colidx[k++]=j;
-      }
+  for(i=0; i<=n; ++i)
+    idxij.rowptr[i]=vis->rowptr[i];
+  for(k=0; k<nvis; ++k){
+    idxij.val[k]=k;
+    idxij.colidx[k]=vis->colidx[k];
   }
-  idxij.rowptr[n]=nvis;
 
   /* find the maximum number (for all cameras) of visible image projections coming from a single 3D point */
   for(i=maxCvis=0; i<n; ++i)
     if((k=idxij.rowptr[i+1]-idxij.rowptr[i])>maxCvis) maxCvis=k;
 
   /* find the maximum number (for all points) of visible image projections in any single camera */
-  for(j=maxPvis=0; j<m; ++j){
-    for(i=ii=0; i<n; ++i)
-      if(vmask[i*m+j]) ++ii;
-    if(ii>maxPvis) maxPvis=ii;
-  }
+  rcsubs=(int *)emalloc(m*sizeof(int)); /* temporarily used for counting projections per camera */
+  for(j=0; j<m; ++j)
+    rcsubs[j]=0;
+  for(k=0; k<nvis; ++k)
+    ++rcsubs[idxij.colidx[k]];
+  for(j=maxPvis=0; j<m; ++j)
+    if(rcsubs[j]>maxPvis) maxPvis=rcsubs[j];
+  free(rcsubs);
   maxCPvis=(maxCvis>=maxPvis)? maxCvis : maxPvis;
 
 #if 0
@@ -669,19 +1031,34 @@ void *jac_adata;
   printf("\nS density: %.5g\n", ((double)ii)/(mmcon*mmcon)); fflush(stdout);
 #endif
 
+  /* number of threads and the solver for S */
+  nt=(opts[5]>1.0)? (int)opts[5] : 1;
+#ifdef SBA_NO_THREADS
+  nt=1;
+#endif /* SBA_NO_THREADS */
+  if(nt>n) nt=(n>0)? n : 1;
+  solver=(opts[6]==SBA_SOLVER_SPARSE)? SBA_SOLVER_SPARSE : SBA_SOLVER_DENSE;
+
+  /* block pattern of S; the sparse solver factors S in place, so it needs room for the fill-in */
+  sba_bsm_schur_pattern(&Sbsm, &idxij, mcon, cnp, solver==SBA_SOLVER_SPARSE);
+
   /* allocate work arrays */
-  /* W is big enough to hold both jac & W. Note also the extra Wsz, see the initialization of jac below for explanation */
-  W=(double *)emalloc((nvis*((Wsz>=ABsz)? Wsz : ABsz) + Wsz)*sizeof(double));
+  if(nt==1){
+    /* W is big enough to hold both jac & W. Note also the extra Wsz, see the initialization of jac below for explanation */
+    W=(double *)emalloc((nvis*((Wsz>=ABsz)? Wsz : ABsz) + Wsz)*sizeof(double));
+  }
+  else{
+    /* W_ij of different points are computed concurrently, hence W can't overwrite jac */
+    W=(double *)emalloc((nvis*(Wsz + ABsz) + 1)*sizeof(double));
+  }
   U=(double *)emalloc(m*Usz*sizeof(double));
   V=(double *)emalloc(n*Vsz*sizeof(double));
   e=(double *)emalloc(nobs*sizeof(double));
   eab=(double *)emalloc(nvars*sizeof(double));
   E=(double *)emalloc(m*cnp*sizeof(double));
-  Yj=(double *)emalloc(maxPvis*Ysz*sizeof(double));
-  YWt=(double *)emalloc(YWtsz*sizeof(double));
-  S=(double *)emalloc(m*m*Sblsz*sizeof(double));
+  if(solver==SBA_SOLVER_DENSE)
+    S=(double *)emalloc((Sdim*Sdim+1)*sizeof(double));
   dp=(double *)emalloc(nvars*sizeof(double));
-  Wtda=(double *)emalloc(pnp*sizeof(double));
   rcidxs=(int *)emalloc(maxCPvis*sizeof(int));
   rcsubs=(int *)emalloc(maxCPvis*sizeof(int));
 #ifndef SBA_DESTROY_COVS
@@ -715,7 +1092,10 @@ void *jac_adata;
    * W_ij is guaranteed not to overlap with that allocated to their corresponding
    * A_ij, B_ij pairs
    */
-  jac=W + Wsz + ((Wsz>ABsz)? nvis*(Wsz-ABsz) : 0);
+  if(nt==1)
+    jac=W + Wsz + ((Wsz>ABsz)? nvis*(Wsz-ABsz) : 0);
+  else
+    jac=W + nvis*Wsz;
 
   /* set up auxiliary pointers */
   pa=p; pb=p+m*cnp;
@@ -724,6 +1104,35 @@ void *jac_adata;
 
   diagU=diagUV; diagV=diagUV + m*cnp;
 
+  /* divide the points among the threads so that they get about the same number of projections
+   * and the block columns of S so that they get about the same number of blocks
+   */
+  thrdata=(struct sba_motstr_thread_data_ *)emalloc(nt*sizeof(struct sba_motstr_thread_data_));
+  thrwork=(double *)emalloc(nt*(Sbsm.nnz*Sblsz + m*easz + maxCvis*Ysz + 2*Vsz + pnp + 1)*sizeof(double));
+  for(k=0, i=0, j=0; k<nt; ++k){
+    struct sba_motstr_thread_data_ *td=thrdata+k;
+
+    td->tid=k;
+    td->first=i;
+    while(i<n && idxij.rowptr[i]<((double)nvis*(k+1))/nt) ++i;
+    td->last=(k==nt-1)? n : i;
+    td->fcol=j;
+    while(j<Sbsm.nc && Sbsm.colptr[j]<((double)Sbsm.nnz*(k+1))/nt) ++j;
+    td->lcol=(k==nt-1)? Sbsm.nc : j;
+
+    td->idxij=&idxij;
+    td->m=m; td->mcon=mcon; td->nt=nt;
+    td->cnp=cnp; td->pnp=pnp; td->mnp=mnp;
+    td->jac=jac; td->e=e; td->U=U; td->V=V; td->W=W;
+    td->ea=ea; td->eb=eb; td->E=E;
+    td->dpa=dpa; td->dpb=dpb;
+    td->S=&Sbsm; td->Sdense=S;
+    td->Spart=thrwork;
+    td->Epart=thrwork + nt*Sbsm.nnz*Sblsz;
+    td->Y=td->Epart + nt*m*easz + k*(maxCvis*Ysz + 2*Vsz + pnp);
+    td->work=td->Y + maxCvis*Ysz;
+  }
+
   /* if no jacobian function is supplied, prepare to compute jacobian with finite difference */
   if(!fjac){
     fdj_data.func=func;
@@ -745,8 +1154,7 @@ void *jac_adata;
   }
 
   if(itmax==0){ /* verify jacobian */
-    sba_motstr_chkjac_x(func, fjac, p, &idxij, rcidxs, rcsubs, mcon, cnp, pnp, mnp, adata, jac_adata);
-    retval=0;
+    retval=sba_motstr_chkjac_x(func, fjac, p, &idxij, rcidxs, rcsubs, mcon, cnp, pnp, mnp, adata, jac_adata) ? SBA_ERROR : 0; /* suspicious gradients make the verification fail */
     goto freemem_and_return;
   }
 
@@ -874,66 +1282,10 @@ void *jac_adata;
     /* Also compute eb_i = \sum_j B_ij^T e_ij */ // \Sigma here!
     /* Recall that e_ij is mnp x 1
      */
-	  _dblzero(V, n*Vsz); /* clear all V_i */
-	  _dblzero(eb, n*ebsz); /* clear all eb_i */
-    for(i=0; i<n; ++i){
-      ptr1=V + i*Vsz; // set ptr1 to point to V_i
-      ptr2=eb + i*ebsz; // set ptr2 to point to eb_i
-
-      nnz=sba_crsm_row_elmidxs(&idxij, i, rcidxs, rcsubs); /* find nonzero B_ij, j=0...m-1 */
-      for(j=0; j<nnz; ++j){
-        /* set ptr3 to point to B_ij, actual column number in rcsubs[j] */
-        ptr3=jac + idxij.val[rcidxs[j]]*ABsz + Asz;
-      
-        /* compute the UPPER TRIANGULAR PART of B_ij^T B_ij and add it to V_i */
-        for(ii=0; ii<pnp; ++ii){
-          for(jj=ii; jj<pnp; ++jj){
-            for(k=0, sum=0.0; k<mnp; ++k)
-              sum+=ptr3[k*pnp+ii]*ptr3[k*pnp+jj];
-            ptr1[ii*pnp+jj]+=sum;
-          }
-        }
-
-        ptr4=e + idxij.val[rcidxs[j]]*esz; /* set ptr4 to point to e_ij */
-        /* compute B_ij^T e_ij and add it to eb_i */
-        for(ii=0; ii<pnp; ++ii){
-          for(jj=0, sum=0.0; jj<mnp; ++jj)
-            sum+=ptr3[jj*pnp+ii]*ptr4[jj];
-          ptr2[ii]+=sum;
-        }
-      }
-    }
-
-    /* compute W_ij =  A_ij^T B_ij */ // \Sigma here!
+    /* and W_ij =  A_ij^T B_ij */ // \Sigma here!
     /* Recall that A_ij is mnp x cnp and B_ij is mnp x pnp
      */
-    for(i=0; i<n; ++i){
-      nnz=sba_crsm_row_elmidxs(&idxij, i, rcidxs, rcsubs); /* find nonzero W_ij, j=0...m-1 */
-      for(j=0; j<nnz; ++j){
-        /* set ptr1 to point to W_ij, actual column number in rcsubs[j] */
-        ptr1=W + idxij.val[rcidxs[j]]*Wsz;
-
-        if(rcsubs[j]<mcon){ /* A_ij is zero */
-          _dblzero(ptr1, Wsz); /* clear W_ij */
-          continue;
-        }
-
-        /* set ptr2 & ptr3 to point to A_ij & B_ij resp. */
-        ptr2=jac  + idxij.val[rcidxs[j]]*ABsz;
-        ptr3=ptr2 + Asz;
-        /* compute A_ij^T B_ij and store it in W_ij
-         * Recall that storage for A_ij, B_ij does not overlap with that for W_ij,
-         * see the comments related to the initialization of jac above
-         */
-        /* assert(ptr2-ptr1>=Wsz); */
-        for(ii=0; ii<cnp; ++ii)
-          for(jj=0; jj<pnp; ++jj){
-            for(k=0, sum=0.0; k<mnp; ++k)
-              sum+=ptr2[k*cnp+ii]*ptr3[k*pnp+jj];
-            ptr1[ii*pnp+jj]=sum;
-          }
-      }
-    }
+    sba_motstr_run_threads(sba_motstr_VWeb_thread, thrdata, nt);
 
     /* Compute ||J^T e||_inf and ||p||^2 */
     for(i=0, p_L2=eab_inf=0.0; i<nvars; ++i){
@@ -989,203 +1341,43 @@ if(!(itno%100)){
         for(i=0; i<cnp; ++i)
           ptr1[i*cnp+i]+=mu;
       }
-      for(i=0; i<n; ++i){
-        ptr1=V + i*Vsz; // set ptr1 to point to V_i
-        for(j=0; j<pnp; ++j)
-          ptr1[j*pnp+j]+=mu;
 
-		    /* compute V*_i^-1.
-         * Recall that only the upper triangle of the symmetric pnp x pnp matrix V*_i
-         * is stored in ptr1; its (also symmetric) inverse is saved in the lower triangle of ptr1
-         */
-        /* inverting V*_i with LDLT seems to result in faster overall execution compared to when using LU or Cholesky */
-        //j=sba_symat_invert_LU(ptr1, pnp); matinv=sba_symat_invert_LU;
-        //j=sba_symat_invert_Chol(ptr1, pnp); matinv=sba_symat_invert_Chol;
-        j=sba_symat_invert_BK(ptr1, pnp); matinv=sba_symat_invert_BK;
-		    if(!j){
-			    fprintf(stderr, "SBA: singular matrix V*_i (i=%d) in sba_motstr_levmar_x(), increasing damping\n", i);
+      /* compute V*_i^-1, the Y_ij = W_ij (V*_i)^-1 and their contributions to S and e_j
+       * for the points of every thread (see sba_motstr_schur_thread())
+       */
+      for(k=0; k<nt; ++k)
+        thrdata[k].mu=mu;
+      sba_motstr_run_threads(sba_motstr_schur_thread, thrdata, nt);
+      for(k=0; k<nt; ++k)
+        if(thrdata[k].singular){
+          fprintf(stderr, "SBA: singular matrix V*_i (i=%d) in sba_motstr_levmar_x(), increasing damping\n", thrdata[k].singular-1);
           goto moredamping; // increasing damping will eventually make V*_i diagonally dominant, thus nonsingular
-          //retval=SBA_ERROR;
-          //goto freemem_and_return;
-		    }
-      }
-
-      _dblzero(E, m*easz); /* clear all e_j */
-      /* compute the mmcon x mmcon block matrix S and e_j */
-
-      /* Note that S is symmetric, therefore its computation can be
-       * sped up by computing only the upper part and then reusing
-       * it for the lower one.
-		   */
-      for(j=mcon; j<m; ++j){
-        int mmconxUsz=mmcon*Usz;
-
-		    nnz=sba_crsm_col_elmidxs(&idxij, j, rcidxs, rcsubs); /* find nonzero Y_ij, i=0...n-1 */
-
-        /* compute all Y_ij = W_ij (V*_i)^-1 for a *fixed* j.
-         * To save memory, the block matrix consisting of the Y_ij
-         * is not stored. Instead, only a block column of this matrix
-         * is computed & used at each time: For each j, all nonzero
-         * Y_ij are computed in Yj and then used in the calculations
-         * involving S_jk and e_j.
-         * Recall that W_ij is cnp x pnp and (V*_i) is pnp x pnp
-         */
-        for(i=0; i<nnz; ++i){
-          /* set ptr3 to point to (V*_i)^-1, actual row number in rcsubs[i] */
-          ptr3=V + rcsubs[i]*Vsz;
-
-          /* set ptr1 to point to Y_ij, actual row number in rcsubs[i] */
-          ptr1=Yj + i*Ysz;
-          /* set ptr2 to point to W_ij resp. */
-          ptr2=W + idxij.val[rcidxs[i]]*Wsz;
-          /* compute W_ij (V*_i)^-1 and store it in Y_ij.
-           * Recall that only the lower triangle of (V*_i)^-1 is stored
-           */
-          for(ii=0; ii<cnp; ++ii){
-            ptr4=ptr2+ii*pnp;
-            for(jj=0; jj<pnp; ++jj){
-              for(k=0, sum=0.0; k<=jj; ++k)
-                sum+=ptr4[k]*ptr3[jj*pnp+k]; //ptr2[ii*pnp+k]*ptr3[jj*pnp+k];
-              for( ; k<pnp; ++k)
-                sum+=ptr4[k]*ptr3[k*pnp+jj]; //ptr2[ii*pnp+k]*ptr3[k*pnp+jj];
-              ptr1[ii*pnp+jj]=sum;
-            }
-          }
-        }
-
-        /* compute the UPPER TRIANGULAR PART of S */
-        for(k=j; k<m; ++k){ // j>=mcon
-          /* compute \sum_i Y_ij W_ik^T in YWt. Note that for an off-diagonal block defined by j, k
-           * YWt (and thus S_jk) is nonzero only if there exists a point that is visible in both the
-           * j-th and k-th images
-           */
-          
-          /* Recall that Y_ij is cnp x pnp and W_ik is cnp x pnp */ 
-          _dblzero(YWt, YWtsz); /* clear YWt */
-
-          for(i=0; i<nnz; ++i){
-            register double *pYWt;
-
-            /* find the min and max column indices of the elements in row i (actually rcsubs[i])
-             * and make sure that k falls within them. This test handles W_ik's which are
-             * certain to be zero without bothering to call sba_crsm_elmidx()
-             */
-            ii=idxij.colidx[idxij.rowptr[rcsubs[i]]];
-            jj=idxij.colidx[idxij.rowptr[rcsubs[i]+1]-1];
-            if(k<ii || k>jj) continue; /* W_ik == 0 */
-
-            /* set ptr2 to point to W_ik */
-            l=sba_crsm_elmidxp(&idxij, rcsubs[i], k, j, rcidxs[i]);
-            //l=sba_crsm_elmidx(&idxij, rcsubs[i], k);
-            if(l==-1) continue; /* W_ik == 0 */
-
-            ptr2=W + idxij.val[l]*Wsz;
-            /* set ptr1 to point to Y_ij, actual row number in rcsubs[i] */
-            ptr1=Yj + i*Ysz;
-            for(ii=0; ii<cnp; ++ii){
-              ptr3=ptr1+ii*pnp;
-              pYWt=YWt+ii*cnp;
-
-              for(jj=0; jj<cnp; ++jj){
-                ptr4=ptr2+jj*pnp;
-                for(l=0, sum=0.0; l<pnp; ++l)
-                  sum+=ptr3[l]*ptr4[l]; //ptr1[ii*pnp+l]*ptr2[jj*pnp+l];
-                pYWt[jj]+=sum; //YWt[ii*cnp+jj]+=sum;
-              }
-            }
-          }
-		  
-		      /* since the linear system involving S is solved with lapack,
-		       * it is preferable to store S in column major (i.e. fortran)
-		       * order, so as to avoid unecessary transposing/copying.
-           */
-#if MAT_STORAGE==COLUMN_MAJOR
-          ptr2=S + (k-mcon)*mmconxUsz + (j-mcon)*cnp; // set ptr2 to point to the beginning of block j,k in S
-#else
-          ptr2=S + (j-mcon)*mmconxUsz + (k-mcon)*cnp; // set ptr2 to point to the beginning of block j,k in S
-#endif
-		  
-          if(j!=k){ /* Kronecker */
-            for(ii=0; ii<cnp; ++ii, ptr2+=Sdim)
-              for(jj=0; jj<cnp; ++jj)
-                ptr2[jj]=
-#if MAT_STORAGE==COLUMN_MAJOR
-				                -YWt[jj*cnp+ii];
-#else
-				                -YWt[ii*cnp+jj];
-#endif
-          }
-          else{
-            ptr1=U + j*Usz; // set ptr1 to point to U_j
-
-            for(ii=0; ii<cnp; ++ii, ptr2+=Sdim)
-              for(jj=0; jj<cnp; ++jj)
-                ptr2[jj]=
-#if MAT_STORAGE==COLUMN_MAJOR
-				                ptr1[jj*cnp+ii] - YWt[jj*cnp+ii];
-#else
-				                ptr1[ii*cnp+jj] - YWt[ii*cnp+jj];
-#endif
-          }
-        }
-
-        /* copy the LOWER TRIANGULAR PART of S from the upper one */
-        for(k=mcon; k<j; ++k){
-#if MAT_STORAGE==COLUMN_MAJOR
-          ptr1=S + (k-mcon)*mmconxUsz + (j-mcon)*cnp; // set ptr1 to point to the beginning of block j,k in S
-          ptr2=S + (j-mcon)*mmconxUsz + (k-mcon)*cnp; // set ptr2 to point to the beginning of block k,j in S
-#else
-          ptr1=S + (j-mcon)*mmconxUsz + (k-mcon)*cnp; // set ptr1 to point to the beginning of block j,k in S
-          ptr2=S + (k-mcon)*mmconxUsz + (j-mcon)*cnp; // set ptr2 to point to the beginning of block k,j in S
-#endif
-          for(ii=0; ii<cnp; ++ii, ptr1+=Sdim)
-            for(jj=0, ptr3=ptr2+ii; jj<cnp; ++jj, ptr3+=Sdim)
-              ptr1[jj]=*ptr3;
-        }
-
-        /* compute e_j=ea_j - \sum_i Y_ij eb_i */
-        /* Recall that Y_ij is cnp x pnp and eb_i is pnp x 1 */
-        ptr1=E + j*easz; // set ptr1 to point to e_j
-
-        for(i=0; i<nnz; ++i){
-          /* set ptr2 to point to Y_ij, actual row number in rcsubs[i] */
-          ptr2=Yj + i*Ysz;
-
-          /* set ptr3 to point to eb_i */
-          ptr3=eb + rcsubs[i]*ebsz;
-          for(ii=0; ii<cnp; ++ii){
-            ptr4=ptr2+ii*pnp;
-            for(jj=0, sum=0.0; jj<pnp; ++jj)
-              sum+=ptr4[jj]*ptr3[jj]; //ptr2[ii*pnp+jj]*ptr3[jj];
-            ptr1[ii]+=sum;
-          }
         }
 
-        ptr2=ea + j*easz; // set ptr2 to point to ea_j
-        for(i=0; i<easz; ++i)
-          ptr1[i]=ptr2[i] - ptr1[i];
-      }
-
-#if 0
-      if(verbose>1){ /* count the nonzeros in S */
-        for(i=ii=0; i<Sdim*Sdim; ++i)
-          if(S[i]!=0.0) ++ii;
-        printf("\nS density: %.5g\n", ((double)ii)/(Sdim*Sdim)); fflush(stdout);
-      }
-#endif
+      /* compute the mmcon x mmcon block matrix S and e_j by summing the contributions of the threads.
+       * Only the lower triangle of S is formed (S is symmetric), the dense S is filled completely
+       */
+      _dblzero(E, m*easz); /* clear all e_j */
+      if(S) _dblzero(S, Sdim*Sdim);
+      sba_motstr_run_threads(sba_motstr_reduce_thread, thrdata, nt);
 
       /* solve the linear system S dpa = E to compute the da_j.
        *
        * Note that if MAT_STORAGE==1 S is modified in the following call;
        * this is OK since S is recomputed for each iteration
        */
-	    //issolved=sba_Axb_LU(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, MAT_STORAGE); linsolver=sba_Axb_LU;
-      issolved=sba_Axb_Chol(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, MAT_STORAGE); linsolver=sba_Axb_Chol;
-      //issolved=sba_Axb_BK(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, MAT_STORAGE); linsolver=sba_Axb_BK;
-      //issolved=sba_Axb_QRnoQ(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, MAT_STORAGE); linsolver=sba_Axb_QRnoQ;
-      //issolved=sba_Axb_QR(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, MAT_STORAGE); linsolver=sba_Axb_QR;
-	    //issolved=sba_Axb_SVD(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, MAT_STORAGE); linsolver=sba_Axb_SVD;
-	    //issolved=sba_Axb_CG(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, (3*Sdim)/2, 1E-10, SBA_CG_JACOBI, MAT_STORAGE); linsolver=(PLS)sba_Axb_CG;
+      if(solver==SBA_SOLVER_SPARSE){
+        issolved=sba_Axb_BSChol(&Sbsm, E+mcon*cnp, dpa+mcon*cnp); /* overwrites Sbsm with its Cholesky factor */
+      }
+      else{
+	      //issolved=sba_Axb_LU(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, MAT_STORAGE); linsolver=sba_Axb_LU;
+        issolved=sba_Axb_Chol(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, MAT_STORAGE); linsolver=sba_Axb_Chol;
+        //issolved=sba_Axb_BK(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, MAT_STORAGE); linsolver=sba_Axb_BK;
+        //issolved=sba_Axb_QRnoQ(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, MAT_STORAGE); linsolver=sba_Axb_QRnoQ;
+        //issolved=sba_Axb_QR(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, MAT_STORAGE); linsolver=sba_Axb_QR;
+	      //issolved=sba_Axb_SVD(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, MAT_STORAGE); linsolver=sba_Axb_SVD;
+	      //issolved=sba_Axb_CG(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, (3*Sdim)/2, 1E-10, SBA_CG_JACOBI, MAT_STORAGE); linsolver=(PLS)sba_Axb_CG;
+      }
 
       ++nlss;
 
@@ -1194,47 +1386,7 @@ if(!(itno%100)){
       if(issolved){
 
         /* compute the db_i */
-        for(i=0; i<n; ++i){
-          ptr1=dpb + i*ebsz; // set ptr1 to point to db_i
-
-          /* compute \sum_j W_ij^T da_j */
-          /* Recall that W_ij is cnp x pnp and da_j is cnp x 1 */
-          _dblzero(Wtda, Wtdasz); /* clear Wtda */
-          nnz=sba_crsm_row_elmidxs(&idxij, i, rcidxs, rcsubs); /* find nonzero W_ij, j=0...m-1 */
-          for(j=0; j<nnz; ++j){
-            /* set ptr2 to point to W_ij, actual column number in rcsubs[j] */
-			      if(rcsubs[j]<mcon) continue; /* W_ij is zero */
-
-            ptr2=W + idxij.val[rcidxs[j]]*Wsz;
-
-            /* set ptr3 to point to da_j */
-            ptr3=dpa + rcsubs[j]*cnp;
-
-            for(ii=0; ii<pnp; ++ii){
-              ptr4=ptr2+ii;
-              for(jj=0, sum=0.0; jj<cnp; ++jj)
-                sum+=ptr4[jj*pnp]*ptr3[jj]; //ptr2[jj*pnp+ii]*ptr3[jj];
-              Wtda[ii]+=sum;
-            }
-          }
-
-          /* compute eb_i - \sum_j W_ij^T da_j = eb_i - Wtda in Wtda */
-          ptr2=eb + i*ebsz; // set ptr2 to point to eb_i
-          for(ii=0; ii<pnp; ++ii)
-            Wtda[ii]=ptr2[ii] - Wtda[ii];
-
-          /* compute the product (V*_i)^-1 Wtda = (V*_i)^-1 (eb_i - \sum_j W_ij^T da_j).
-           * Recall that only the lower triangle of (V*_i)^-1 is stored
-           */
-          ptr2=V + i*Vsz; // set ptr2 to point to (V*_i)^-1
-          for(ii=0; ii<pnp; ++ii){
-            for(jj=0, sum=0.0; jj<=ii; ++jj)
-              sum+=ptr2[ii*pnp+jj]*Wtda[jj];
-            for( ; jj<pnp; ++jj)
-              sum+=ptr2[jj*pnp+ii]*Wtda[jj];
-            ptr1[ii]=sum;
-          }
-        }
+        sba_motstr_run_threads(sba_motstr_db_thread, thrdata, nt);
 
         /* parameter vector updates are now in dpa, dpb */
 
@@ -1382,9 +1534,11 @@ freemem_and_return: /* NOTE: this point is also reached via a goto! */
    /* free whatever was allocated */
   free(W);   free(U);  free(V);
   free(e);   free(eab);
-  free(E);   free(Yj); free(YWt);
-  free(S);   free(dp); free(Wtda);
+  free(E);   free(dp);
+  if(S) free(S);
   free(rcidxs); free(rcsubs);
+  free(thrdata); free(thrwork);
+  sba_bsm_free(&Sbsm);
 #ifndef SBA_DESTROY_COVS
   if(wght) free(wght);
 #else
@@ -1399,9 +1553,34 @@ freemem_and_return: /* NOTE: this point is also reached via a goto! */
 
   sba_crsm_free(&idxij);
 
-  /* free the memory allocated by the matrix inversion & linear solver routines */
-  if(matinv) (*matinv)(NULL, 0);
+  /* free the memory allocated by the linear solver routines */
   if(linsolver) (*linsolver)(NULL, NULL, NULL, 0, 0);
+  if(solver==SBA_SOLVER_SPARSE) sba_Axb_BSChol(NULL, NULL, NULL);
+
+  return retval;
+}
+
+
+/* Bundle adjustment on camera and structure parameters, visibility given as a dense nxm mask
+ * (vmask[i, j]=1 if point i visible in image j, 0 otherwise); see sba_motstr_levmar_x_crsm()
+ * for the remaining arguments
+ *
+ * Returns the number of iterations (>=0) if successfull, SBA_ERROR if failed
+ */
+
+int sba_motstr_levmar_x(
+    const int n, const int m, const int mcon, char *vmask, double *p, const int cnp, const int pnp,
+    double *x, double *covx, const int mnp,
+    void (*func)(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double *hx, void *adata),
+    void (*fjac)(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double *jac, void *adata),
+    void *adata, const int itmax, const int verbose, const double opts[SBA_OPTSSZ], double info[SBA_INFOSZ])
+{
+struct sba_crsm vis;
+int retval;
+
+  sba_crsm_build_vmask(&vis, vmask, n, m);
+  retval=sba_motstr_levmar_x_crsm(n, m, mcon, &vis, p, cnp, pnp, x, covx, mnp, func, fjac, adata, itmax, verbose, opts, info);
+  sba_crsm_free(&vis);
 
   return retval;
 }
@@ -1627,8 +1806,7 @@ void *jac_adata;
   }
 
   if(itmax==0){ /* verify jacobian */
-    sba_mot_chkjac_x(func, fjac, p, &idxij, rcidxs, rcsubs, mcon, cnp, mnp, adata, jac_adata);
-    retval=0;
+    retval=sba_mot_chkjac_x(func, fjac, p, &idxij, rcidxs, rcsubs, mcon, cnp, mnp, adata, jac_adata) ? SBA_ERROR : 0; /* suspicious gradients make the verification fail */
     goto freemem_and_return;
   }
 
@@ -2172,8 +2350,7 @@ void *jac_adata;
   }
 
   if(itmax==0){ /* verify jacobian */
-    sba_str_chkjac_x(func, fjac, p, &idxij, rcidxs, rcsubs, pnp, mnp, adata, jac_adata);
-    retval=0;
+    retval=sba_str_chkjac_x(func, fjac, p, &idxij, rcidxs, rcsubs, pnp, mnp, adata, jac_adata) ? SBA_ERROR : 0; /* suspicious gradients make the verification fail */
     goto freemem_and_return;
   }
 
@@ -591,18 +591,20 @@ static void sba_str_Qs_fdjac(
 
 
 /* 
- * Simple driver to sba_motstr_levmar_x for bundle adjustment on camera and structure parameters.
+ * Simple driver to sba_motstr_levmar_x_crsm for bundle adjustment on camera and structure parameters.
  *
  * Returns the number of iterations (>=0) if successfull, SBA_ERROR if failed
  */
 
-int sba_motstr_levmar(
+int sba_motstr_levmar_crsm(
     const int n,   /* number of points */
     const int m,   /* number of images */
     const int mcon,/* number of images (starting from the 1st) whose parameters should not be modified.
 					          * All A_ij (see below) with j<mcon are assumed to be zero
 					          */
-    char *vmask,  /* visibility mask: vmask[i, j]=1 if point i visible in image j, 0 otherwise. nxm */
+    struct sba_crsm *vis, /* visibility: nxm sparse matrix, vis(i, j) is nonzero if point i visible in image j.
+                   * Only rowptr & colidx are used, column indices in each row must be increasing
+                   */
     double *p,    /* initial parameter vector p0: (a1, ..., am, b1, ..., bn).
                    * aj are the image j parameters, bi are the i-th point parameters,
                    * size m*cnp + n*pnp
@@ -612,13 +614,13 @@ int sba_motstr_levmar(
     double *x,    /* measurements vector: (x_11^T, .. x_1m^T, ..., x_n1^T, .. x_nm^T)^T where
                    * x_ij is the projection of the i-th point on the j-th image.
                    * NOTE: some of the x_ij might be missing, if point i is not visible in image j;
-                   * see vmask[i, j], max. size n*m*mnp
+                   * see vis, max. size n*m*mnp
                    */
     double *covx, /* measurements covariance matrices: (Sigma_x_11, .. Sigma_x_1m, ..., Sigma_x_n1, .. Sigma_x_nm),
                    * where Sigma_x_ij is the mnp x mnp covariance of x_ij stored row-by-row. Set to NULL if no
                    * covariance estimates are available (identity matrices are implicitly used in this case).
                    * NOTE: a certain Sigma_x_ij is missing if the corresponding x_ij is also missing;
-                   * see vmask[i, j], max. size n*m*mnp*mnp
+                   * see vis, max. size n*m*mnp*mnp
                    */
     const int mnp,/* number of parameters for EACH measurement; usually 2 */
     void (*proj)(int j, int i, double *aj, double *bi, double *xij, void *adata),
@@ -626,13 +628,13 @@ int sba_motstr_levmar(
                                                * the parameters of point i are bi and the parameters of camera j aj,
                                                * computes a prediction of \hat{x}_{ij}. aj is cnp x 1, bi is pnp x 1 and
                                                * xij is mnp x 1. This function is called only if point i is visible in
-                                               * image j (i.e. vmask[i, j]==1)
+                                               * image j (i.e. vis(i, j) is nonzero)
                                                */
     void (*projac)(int j, int i, double *aj, double *bi, double *Aij, double *Bij, void *adata),
                                               /* functional relation to evaluate d x_ij / d a_j and
                                                * d x_ij / d b_i in Aij and Bij resp.
                                                * This function is called only if point i is visible in * image j
-                                               * (i.e. vmask[i, j]==1). Also, A_ij and B_ij are mnp x cnp and mnp x pnp
+                                               * (i.e. vis(i, j) is nonzero). Also, A_ij and B_ij are mnp x cnp and mnp x pnp
                                                * matrices resp. and they should be stored in row-major order.
                                                *
                                                * If NULL, the jacobians are approximated by repetitive proj calls
@@ -676,25 +678,43 @@ static void (*fjac)(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs,
   wdata.adata=adata;
 
   fjac=(projac)? sba_motstr_Qs_jac : sba_motstr_Qs_fdjac;
-  retval=sba_motstr_levmar_x(n, m, mcon, vmask, p, cnp, pnp, x, covx, mnp, sba_motstr_Qs, fjac, &wdata, itmax, verbose, opts, info);
+  retval=sba_motstr_levmar_x_crsm(n, m, mcon, vis, p, cnp, pnp, x, covx, mnp, sba_motstr_Qs, fjac, &wdata, itmax, verbose, opts, info);
 
   if(info){
-    register int i;
-    int nvis;
-
-    /* count visible image points */
-    for(i=nvis=0; i<n*m; ++i)
-      nvis+=(vmask[i]!=0);
-
     /* each "func" & "fjac" evaluation requires nvis "proj" & "projac" evaluations */
-    info[7]*=nvis;
-    info[8]*=nvis;
+    info[7]*=vis->nnz;
+    info[8]*=vis->nnz;
   }
 
   return retval;
 }
 
 
+/*
+ * Simple driver to sba_motstr_levmar_x for bundle adjustment on camera and structure parameters,
+ * visibility given as a dense nxm mask (vmask[i, j]=1 if point i visible in image j, 0 otherwise);
+ * see sba_motstr_levmar_crsm() for the remaining arguments
+ *
+ * Returns the number of iterations (>=0) if successfull, SBA_ERROR if failed
+ */
+
+int sba_motstr_levmar(
+    const int n, const int m, const int mcon, char *vmask, double *p, const int cnp, const int pnp,
+    double *x, double *covx, const int mnp,
+    void (*proj)(int j, int i, double *aj, double *bi, double *xij, void *adata),
+    void (*projac)(int j, int i, double *aj, double *bi, double *Aij, double *Bij, void *adata),
+    void *adata, const int itmax, const int verbose, const double opts[SBA_OPTSSZ], double info[SBA_INFOSZ])
+{
+struct sba_crsm vis;
+int retval;
+
+  sba_crsm_build_vmask(&vis, vmask, n, m);
+  retval=sba_motstr_levmar_crsm(n, m, mcon, &vis, p, cnp, pnp, x, covx, mnp, proj, projac, adata, itmax, verbose, opts, info);
+  sba_crsm_free(&vis);
+
+  return retval;
+}
+
 /* 
  * Simple driver to sba_mot_levmar_x for bundle adjustment on camera parameters.
  *
@@ -23,12 +23,6 @@
 
 #include <stdio.h>
 
-struct bbf_data
-{
-  double d;
-  void* old_data;
-};
-
 /************************* Local Function Prototypes *************************/
 
 struct kd_node* kd_node_init( struct feature*, int );
@@ -41,7 +35,8 @@ int partition_array( double*, int, double );
 void partition_features( struct kd_node* );
 struct kd_node* explore_to_leaf( struct kd_node*, struct feature*,
 				 struct min_pq* );
-int insert_into_nbr_array( struct feature*, struct feature**, int, int );
+int insert_into_nbr_array( struct feature*, double, struct feature**, double*,
+			   int, int );
 int within_rect( CvPoint2D64f, CvRect );
 
 
@@ -96,7 +91,7 @@ int kdtree_bbf_knn( struct kd_node* kd_root, struct feature* feat, int k,
   struct kd_node* expl;
   struct min_pq* min_pq;
   struct feature* tree_feat, ** _nbrs;
-  struct bbf_data* bbf_data;
+  double* dists;
   int i, t = 0, n = 0;
 
   if( ! nbrs  ||  ! feat  ||  ! kd_root )
@@ -106,7 +101,21 @@ int kdtree_bbf_knn( struct kd_node* kd_root, struct feature* feat, int k,
       return -1;
     }
 
+  /* distances are kept aside instead of in the tree features' feature_data,
+     so that the tree is never modified and can be searched from several
+     threads at once */
   _nbrs = calloc( k, sizeof( struct feature* ) );
+  dists = calloc( k, sizeof( double ) );
+  if( ! _nbrs  ||  ! dists )
+    {
+      fprintf( stderr, "Warning: unable to allocate memory,"
+	       " %s line %d\n", __FILE__, __LINE__ );
+      free( _nbrs );
+      free( dists );
+      *nbrs = NULL;
+      return -1;
+    }
+
   min_pq = minpq_init();
   minpq_insert( min_pq, kd_root, 0 );
   while( min_pq->n > 0  &&  t < max_nn_chks )
@@ -130,39 +139,20 @@ int kdtree_bbf_knn( struct kd_node* kd_root, struct feature* feat, int k,
       for( i = 0; i < expl->n; i++ )
 	{
 	  tree_feat = &expl->features[i];
-	  bbf_data = malloc( sizeof( struct bbf_data ) );
-	  if( ! bbf_data )
-	    {
-	      fprintf( stderr, "Warning: unable to allocate memory,"
-		       " %s line %d\n", __FILE__, __LINE__ );
-	      goto fail;
-	    }
-	  bbf_data->old_data = tree_feat->feature_data;
-	  bbf_data->d = descr_dist_sq(feat, tree_feat);
-	  tree_feat->feature_data = bbf_data;
-	  n += insert_into_nbr_array( tree_feat, _nbrs, n, k );
+	  n += insert_into_nbr_array( tree_feat, descr_dist_sq( feat, tree_feat ),
+				      _nbrs, dists, n, k );
 	}
       t++;
     }
 
   minpq_release( &min_pq );
-  for( i = 0; i < n; i++ )
-    {
-      bbf_data = _nbrs[i]->feature_data;
-      _nbrs[i]->feature_data = bbf_data->old_data;
-      free( bbf_data );
-    }
+  free( dists );
   *nbrs = _nbrs;
   return n;
 
  fail:
   minpq_release( &min_pq );
-  for( i = 0; i < n; i++ )
-    {
-      bbf_data = _nbrs[i]->feature_data;
-      _nbrs[i]->feature_data = bbf_data->old_data;
-      free( bbf_data );
-    }
+  free( dists );
   free( _nbrs );
   *nbrs = NULL;
   return -1;
@@ -572,43 +562,35 @@ struct kd_node* explore_to_leaf( struct kd_node* kd_node, struct feature* feat,
   Inserts a feature into the nearest-neighbor array so that the array remains
   in order of increasing descriptor distance from the search feature.
 
-  @param feat feature to be inderted into the array; it's feature_data field
-    should be a pointer to a bbf_data with d equal to the squared descriptor
-    distance between feat and the search feature
+  @param feat feature to be inserted into the array
+  @param d squared descriptor distance between feat and the search feature
   @param nbrs array of nearest neighbors neighbors
+  @param dists squared descriptor distances of the features in nbrs
   @param n number of elements already in nbrs and
   @param k maximum number of elements in nbrs
 
   @return If feat was successfully inserted into nbrs, returns 1; otherwise
     returns 0.
 */
-int insert_into_nbr_array( struct feature* feat, struct feature** nbrs,
-			   int n, int k )
+int insert_into_nbr_array( struct feature* feat, double d,
+			   struct feature** nbrs, double* dists, int n, int k )
 {
-  struct bbf_data* fdata, * ndata;
-  double dn, df;
   int i, ret = 0;
 
   if( n == 0 )
     {
       nbrs[0] = feat;
+      dists[0] = d;
       return 1;
     }
 
   /* check at end of array */
-  fdata = (struct bbf_data*)feat->feature_data;
-  df = fdata->d;
-  ndata = (struct bbf_data*)nbrs[n-1]->feature_data;
-  dn = ndata->d;
-  if( df >= dn )
+  if( d >= dists[n-1] )
     {
       if( n == k )
-	{
-	  feat->feature_data = fdata->old_data;
-	  free( fdata );
-	  return 0;
-	}
+	return 0;
       nbrs[n] = feat;
+      dists[n] = d;
       return 1;
     }
 
@@ -616,25 +598,21 @@ int insert_into_nbr_array( struct feature* feat, struct feature** nbrs,
   if( n < k )
     {
       nbrs[n] = nbrs[n-1];
+      dists[n] = dists[n-1];
       ret = 1;
     }
-  else
-    {
-      nbrs[n-1]->feature_data = ndata->old_data;
-      free( ndata );
-    }
   i = n-2;
   while( i >= 0 )
     {
-      ndata = (struct bbf_data*)nbrs[i]->feature_data;
-      dn = ndata->d;
-      if( dn <= df )
+      if( dists[i] <= d )
 	break;
       nbrs[i+1] = nbrs[i];
+      dists[i+1] = dists[i];
       i--;
     }
   i++;
   nbrs[i] = feat;
+  dists[i] = d;
 
   return ret;
 }
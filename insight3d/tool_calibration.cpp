@@ -37,17 +37,38 @@ const size_t
 	CALIBRATION_IMAGE_MEASUREMENT_THRESHOLD = 0,
 	CALIBRATION_NORMALIZE_DATA = 1,
 	CALIBRATION_NORMALIZE_A = 2,
-	CALIBRATION_RANDOMNESS = 3
+	CALIBRATION_RANDOMNESS = 3,
+	CALIBRATION_THREADS = 4,
+	CALIBRATION_SPARSE_SOLVER = 5,
+	CALIBRATION_ROBUST_KERNEL = 6,
+	CALIBRATION_ROBUST_ROUNDS = 7,
+	CALIBRATION_LOCAL_BUNDLE_CAMERAS = 8,
+	CALIBRATION_GLOBAL_BUNDLE_INTERVAL = 9
 ;
 
+const size_t
+	CALIBRATION_ROBUST_HUBER = 0,
+	CALIBRATION_ROBUST_CAUCHY = 1,
+	CALIBRATION_ROBUST_NONE = 2
+;
+
+static const char * calibration_robust_kernel_labels[] = { "Huber", "Cauchy", "None (squared error)", NULL };
+
 static size_t tool_calibration_id;
 
 // forward declarations
-void calibration_bundle();
+void calibration_bundle(const size_t calibration_id, const bool * const active_shots = NULL);
+void calibration_bundle_local(const size_t calibration_id, const size_t shot_id, const int cameras_count);
+void calibration_bundle_metric();
 void calibration_triangulate_vertices(
 	const size_t calibration_id, const double measurement_threshold, const int min_inliers,
 	const bool normalize_data, const bool normalize_A
 );
+size_t * calibration_cameras_index(const Calibration * const calibration);
+void calibration_triangulate_shot_vertices(
+	const size_t calibration_id, const size_t shot_id, const double measurement_threshold, const int min_inliers,
+	const bool normalize_data, const bool normalize_A
+);
 void calibration_rectify(bool affine = false);
 
 // update calibration flag in shots structure - it must be true iff the shot is calibrated in given partial calibration
@@ -85,6 +106,12 @@ void tool_calibration_create()
 	tool_register_bool(CALIBRATION_NORMALIZE_DATA, "Normalization of input data", 1);
 	tool_register_bool(CALIBRATION_NORMALIZE_A, "Normalization of linear systems", 0);
 	tool_register_int(CALIBRATION_RANDOMNESS, "Randomness of automatic calibration: ", 3, 0, 10000, 1);
+	tool_register_int(CALIBRATION_THREADS, "Number of threads (0 = auto): ", 0, 0, 64, 1);
+	tool_register_bool(CALIBRATION_SPARSE_SOLVER, "Sparse solver in bundle adjustment", 1);
+	tool_register_enum(CALIBRATION_ROBUST_KERNEL, "Robust error in bundle adjustment:", calibration_robust_kernel_labels);
+	tool_register_int(CALIBRATION_ROBUST_ROUNDS, "Reweighting rounds of robust bundle adjustment: ", 3, 1, 20, 1);
+	tool_register_int(CALIBRATION_LOCAL_BUNDLE_CAMERAS, "Cameras refined after resection: ", 6, 1, 1000, 1);
+	tool_register_int(CALIBRATION_GLOBAL_BUNDLE_INTERVAL, "Refine all cameras after every (views): ", 10, 1, 10000, 1);
 
 	tool_create_separator(); 
 	tool_create_button("Automatic calibration", tool_calibration_auto);
@@ -218,21 +245,72 @@ void calibration_update_inliers(const size_t calibration_id, const size_t count,
 	}
 }
 
-// update current estimation of the set of inlying points for the whole calibration 
-// todo 
-void calibration_update_inliers(const size_t calibration_id)
+// update current estimation of the set of inlying points for the whole calibration, every 
+// observation of a reconstructed vertex is reprojected and marked as inlier iff its 
+// reprojection error is below the threshold (so that outliers can also become inliers 
+// again once the estimate improves); if shots_reindex is given, only shots with set 
+// index are updated 
+void calibration_update_inliers(const size_t calibration_id, const double measurement_threshold, const size_t * const shots_reindex = NULL)
 {
 	ASSERT_IS_SET(calibrations, calibration_id);
-	const Calibration * calibration = calibrations.data + calibration_id;
+	Calibration * const calibration = calibrations.data + calibration_id;
 
-	// size_t * vertex_to_X = dyn_empty_index(calibration->Ps), Xs_i;
-	// LAMBDA(calibration->Ps, Xs_i, vertex_to_X[calibration->Xs.data[Xs_i].vertex_id] = Xs_i; );
+	// index from vertex ids to calibration's vertices 
+	size_t * vertex_to_X = ALLOC(size_t, vertices.count > 0 ? vertices.count : 1);
+	for (size_t i = 0; i < vertices.count; i++) vertex_to_X[i] = SIZE_MAX;
+	for ALL(calibration->Xs, i) 
+	{
+		ASSERT(calibration->Xs.data[i].vertex_id < vertices.count, "invalid vertex index");
+		vertex_to_X[calibration->Xs.data[i].vertex_id] = i;
+	}
 
 	// go through all cameras 
+	size_t inliers = 0, outliers = 0;
+	const double threshold_sq = measurement_threshold * measurement_threshold;
 	for ALL(calibration->Ps, i) 
 	{
-		// todo
+		Calibration_Camera * const camera = calibration->Ps.data + i;
+		if (shots_reindex && shots_reindex[camera->shot_id] == SIZE_MAX) continue;
+		const Shot * const shot = shots.data + camera->shot_id;
+
+		// go through this camera's points
+		for ALL(camera->points_meta, j) 
+		{
+			if (!validate_point(camera->shot_id, j)) continue;
+			const Point * const point = shot->points.data + j;
+			if (point->vertex >= vertices.count || vertex_to_X[point->vertex] == SIZE_MAX) continue;
+			const CvMat * const X = calibration->Xs.data[vertex_to_X[point->vertex]].X;
+
+			// project the vertex 
+			double x[3];
+			for (int k = 0; k < 3; k++) 
+			{
+				x[k] = 
+					OPENCV_ELEM(camera->P, k, 0) * OPENCV_ELEM(X, 0, 0) + 
+					OPENCV_ELEM(camera->P, k, 1) * OPENCV_ELEM(X, 1, 0) + 
+					OPENCV_ELEM(camera->P, k, 2) * OPENCV_ELEM(X, 2, 0) + 
+					OPENCV_ELEM(camera->P, k, 3) * OPENCV_ELEM(X, 3, 0)
+				;
+			}
+
+			bool inlier = false; 
+			if (!nearly_zero(x[2])) 
+			{
+				const double 
+					dx = x[0] / x[2] - point->x * shot->width, 
+					dy = x[1] / x[2] - point->y * shot->height
+				;
+
+				inlier = dx * dx + dy * dy <= threshold_sq;
+			}
+
+			camera->points_meta.data[j].inlier = inlier ? 1 : 0;
+			if (inlier) inliers++; else outliers++;
+		}
 	}
+
+	printf("  %d observations marked as inliers, %d as outliers.\n", (int)inliers, (int)outliers);
+	FREE(vertex_to_X);
 }
 
 // calibrate pair of shots and create new calibration to enclose it
@@ -578,17 +656,37 @@ void tool_calibration_pair()
 	opencv_end();
 }
 
-// internal function used to calibrate given shot by resection
-bool calibration_add_view(const size_t calibration_id, const size_t shot_id, const double threshold, const bool normalize_data, const bool normalize_A)
+// result of resection of one shot 
+struct Calibration_Resection 
 {
-	Shot * const shot = shots.data + shot_id;
-	Calibration * const calibration = calibrations.data + calibration_id;
-	opencv_begin(); 
+	size_t shot_id; 
+	unsigned int seed;           // state of random number generator used by RANSAC
+	bool ok; 
+	CvMat * P;                   // estimated (denormalized) projection matrix 
+	int count, inliers_count;    // number of used correspondences and how many of them are inliers
+	size_t * points_indices;     // points of the shot used in resection 
+	bool * inliers;
+};
+
+// calibrate given shot by resection, the calibration is only read (so that several 
+// shots can be resected concurrently) and the result has to be saved using 
+// calibration_save_resection and released by calibration_release_resection; 
+// if seed is NULL, rand() is used 
+void calibration_resect(
+	const size_t calibration_id, const double threshold, const bool normalize_data, const bool normalize_A, 
+	unsigned int * const seed, Calibration_Resection * const resection
+)
+{
+	resection->ok = false;
+	resection->P = NULL;
+	resection->count = resection->inliers_count = 0;
+	resection->points_indices = NULL;
+	resection->inliers = NULL;
 
 	// export data
 	CvMat * points = NULL, * vertices = NULL;
 	size_t * points_indices = NULL;
-	bool ready = publish_resection_data_from_calibration(calibration_id, shot_id, &points, &vertices, &points_indices);
+	bool ready = publish_resection_data_from_calibration(calibration_id, resection->shot_id, &points, &vertices, &points_indices);
 
 	// check the data
 	if (!ready || points->cols < 10) 
@@ -608,13 +706,10 @@ bool calibration_add_view(const size_t calibration_id, const size_t shot_id, con
 			FREE(points_indices);
 		}
 
-		printf("Unable to resect this image.\n"); 
-		opencv_end();
-		return false;
+		return;
 	}
 
 	ASSERT(points->cols == vertices->cols, "resection data inconsistent");
-	if (ready && points->cols < 6) { ready = false; cvReleaseMat(&points); cvReleaseMat(&vertices); free(points_indices); }
 
 	// normalize data 
 	CvMat * H_normalization_inv = NULL;
@@ -631,48 +726,112 @@ bool calibration_add_view(const size_t calibration_id, const size_t shot_id, con
 	// calculate resection
 	CvMat * P = opencv_create_matrix(3, 4);
 	bool * inliers = ALLOC(bool, points->cols);
-	bool ok = mvg_resection_RANSAC(vertices, points, P, NULL, NULL, NULL, normalize_A, 500, threshold * scale, inliers);
-	if (ok)
+	resection->count = points->cols;
+	resection->ok = mvg_resection_RANSAC(vertices, points, P, NULL, NULL, NULL, normalize_A, 500, threshold * scale, inliers, seed);
+	if (resection->ok)
 	{
-		// * if the resection was successful, save it *
-
-		// try to find the camera among those already calibrated
-		size_t P_id;
-		bool P_found;
-		LAMBDA_FIND(calibration->Ps, P_id, P_found, calibration->Ps.data[P_id].shot_id == shot_id);
-
-		// if it hasn't been found, create a new one
-		if (!P_found) 
-		{
-			ADD(calibration->Ps);
-			P_id = LAST_INDEX(calibration->Ps);
-		}
-		else
-		{
-			ASSERT(calibration->Ps.data[P_id].P, "camera calibration structure without allocated P matrix found");
-			cvReleaseMat(&calibration->Ps.data[P_id].P);
-		}
-
 		// denormalize P
 		if (normalize_data) cvMatMul(H_normalization_inv, P, P);
-		
-		// save it
-		calibration->Ps.data[P_id].P = P;
-		calibration->Ps.data[P_id].shot_id = shot_id;
-
-		// also update the estimate of inliers and outliers
-		calibration_update_inliers(calibration_id, P_id, points->cols, points_indices, inliers);
+		resection->P = P;
+		resection->points_indices = points_indices;
+		resection->inliers = inliers;
+		for (int i = 0; i < points->cols; i++) 
+		{
+			if (inliers[i]) resection->inliers_count++;
+		}
+	}
+	else
+	{
+		cvReleaseMat(&P);
+		FREE(inliers);
+		FREE(points_indices);
 	}
 
 	// release resources
 	if (normalize_data) cvReleaseMat(&H_normalization_inv);
-	FREE(inliers);
-	FREE(points_indices);
 	cvReleaseMat(&points);
 	cvReleaseMat(&vertices);
+}
+
+// save successful resection into calibration (the projection matrix is moved there)
+void calibration_save_resection(const size_t calibration_id, Calibration_Resection * const resection)
+{
+	ASSERT(resection->ok, "saving failed resection");
+	Calibration * const calibration = calibrations.data + calibration_id;
+	const size_t shot_id = resection->shot_id;
+
+	// try to find the camera among those already calibrated
+	size_t P_id;
+	bool P_found;
+	LAMBDA_FIND(calibration->Ps, P_id, P_found, calibration->Ps.data[P_id].shot_id == shot_id);
+
+	// if it hasn't been found, create a new one
+	if (!P_found) 
+	{
+		ADD(calibration->Ps);
+		P_id = LAST_INDEX(calibration->Ps);
+	}
+	else
+	{
+		ASSERT(calibration->Ps.data[P_id].P, "camera calibration structure without allocated P matrix found");
+		cvReleaseMat(&calibration->Ps.data[P_id].P);
+	}
+
+	// save it
+	calibration->Ps.data[P_id].P = resection->P;
+	calibration->Ps.data[P_id].shot_id = shot_id;
+	resection->P = NULL;
+
+	// also update the estimate of inliers and outliers
+	calibration_update_inliers(calibration_id, P_id, resection->count, resection->points_indices, resection->inliers);
+}
+
+// release resources held by resection result 
+void calibration_release_resection(Calibration_Resection * const resection)
+{
+	if (resection->P) cvReleaseMat(&resection->P);
+	if (resection->points_indices) FREE(resection->points_indices);
+	if (resection->inliers) FREE(resection->inliers);
+}
+
+// internal function used to calibrate given shot by resection
+bool calibration_add_view(const size_t calibration_id, const size_t shot_id, const double threshold, const bool normalize_data, const bool normalize_A)
+{
+	opencv_begin(); 
+
+	Calibration_Resection resection;
+	resection.shot_id = shot_id;
+	calibration_resect(calibration_id, threshold, normalize_data, normalize_A, NULL, &resection);
+	if (resection.ok) 
+	{
+		calibration_save_resection(calibration_id, &resection);
+	}
+	else if (resection.count < 10) 
+	{
+		printf("Unable to resect this image.\n"); 
+	}
+
+	calibration_release_resection(&resection);
 
 	opencv_end();
-	return ok;
+	return resection.ok;
+}
+
+// data shared by threads resecting candidate shots 
+struct Calibration_Resection_Job 
+{
+	size_t calibration_id;
+	double threshold; 
+	bool normalize_data, normalize_A; 
+	Calibration_Resection * resections;
+};
+
+// resect one candidate shot, called from worker threads 
+void calibration_resection_job(void * arg, const size_t item, const size_t thread_id)
+{
+	Calibration_Resection_Job * const job = (Calibration_Resection_Job *)arg;
+	Calibration_Resection * const resection = job->resections + item;
+	calibration_resect(job->calibration_id, job->threshold, job->normalize_data, job->normalize_A, &resection->seed, resection);
 }
 
 // decide which 2 shots should be used to start-up calibration and then do so 
@@ -688,7 +847,7 @@ bool calibration_auto_begin(
 	printf("Starting new calibration.\n");
 
 	// first make sure that meta data are up to date 
-	geometry_build_shots_relations();
+	geometry_build_shots_relations(core_parallel_threads_count(tool_get_int(tool_calibration_id, CALIBRATION_THREADS)));
 
 	// allocate array to keep track of randomness+1 best pairs 
 	size_t 
@@ -697,16 +856,14 @@ bool calibration_auto_begin(
 	
 	size_t best_count = 0;
 
-	// go through all pairs 
-	for ALL(shots_relations, i) 
+	// go through all pairs sharing some vertices 
+	for (size_t i = 0; i < shots_relations.shots_count; i++) 
 	{
-		const Shot_Relations * const shot_relations = shots_relations.data + i; 
-		
-		for ALL(shot_relations->pair_relations, j) 
+		for (size_t k = shots_relations.first[i]; k < shots_relations.first[i + 1]; k++) 
 		{
+			const size_t j = shots_relations.neighbours[k];
 			if (i >= j) continue;
-			const Shot_Pair_Relation * const pair_relation = shot_relations->pair_relations.data + j; 
-			const size_t correspondences = pair_relation->correspondences_count;
+			const size_t correspondences = shots_relations.correspondences_count[k];
 			
 			// insert the value into sorted array 
 			if (best_count > 0)
@@ -814,153 +971,214 @@ bool calibration_auto_step(
 	const size_t calibration_id = ui_state.current_calibration;
 	Calibration * const calibration = calibrations.data + calibration_id;
 
-	// if this hasn't been refined yet, we could do bundle adjustment 
-	if (!calibration->refined && rand() % 3 == 0) 
+	// * extend the calibration to another camera *
+
+	printf("Extending calibration by resection.\n");
+	const size_t len = randomness + 1;
+
+	// mark calibrated shots (we don't care about those)
+	calibration_refresh_flag(calibration_id);
+
+	// count how many estimated vertices are on each uncalibrated shot
+	size_t * const vertex_count = ALLOC(size_t, shots.count);
+	memset(vertex_count, 0, sizeof(size_t) * shots.count);
+	for ALL(calibration->Xs, i) 
 	{
-		// let's refine using nonlinear optimization
-		printf("Refining calibration using bundle adjustment.\n");
-		calibration_bundle();
-		calibration->refined = true;
-		opencv_begin();    // todo unify calibration_*'s requirement for opencv lock
-		// calibration_triangulate_vertices(calibration_id, distance_threshold, 2, normalize_data, normalize_A);
-		opencv_end();
-		printf("  Bundle adjustment done.\n");
-		tool_calibration_refresh_UI();
+		const size_t vertex_id = calibration->Xs.data[i].vertex_id; 
 		
-		return true;
+		// go through all points of this vertex
+		ASSERT_IS_SET(vertices_incidence, vertex_id);
+		for ALL(vertices_incidence.data[vertex_id].shot_point_ids, j)
+		{
+			const Double_Index * const index = vertices_incidence.data[vertex_id].shot_point_ids.data + j; 
+			
+			ASSERT(validate_shot(index->primary), "invalid shot encountered");
+			if (shots.data[index->primary].partial_calibration) continue;
+			ASSERT(index->primary < shots.count, "shot index out of bounds");
+			vertex_count[index->primary]++;
+		}
 	}
-	else
-	{
-		// * extend the calibration to another camera *
 
-		printf("Extending calibration by resection.\n");
-		const size_t len = randomness + 1;
+	// now pick 'len' best shots, ties are broken by the number of correspondences 
+	// with already calibrated shots (taken from the covisibility graph built by 
+	// calibration_auto_begin) 
+	// allocate array to keep track of randomness+1 best pairs 
+	size_t 
+		* const best_shot = ALLOC(size_t, len + 1),
+		* const best_corr = ALLOC(size_t, len + 1), 
+		* const best_links = ALLOC(size_t, len + 1);
+	size_t best_count = 0;
 
-		// mark calibrated shots (we don't care about those)
-		calibration_refresh_flag(calibration_id);
+	// go through all available shots
+	bool uncalibrated = false;
+	for ALL(shots, i) 
+	{
+		const Shot * const shot = shots.data + i; 
+		if (shot->partial_calibration) continue;
+		uncalibrated = true;
 
-		// count how many estimated vertices are on each uncalibrated shot
-		size_t * const vertex_count = ALLOC(size_t, shots.count);
-		memset(vertex_count, 0, sizeof(size_t) * shots.count);
-		for ALL(calibration->Xs, i) 
+		const size_t correspondences = vertex_count[i];
+		size_t links = 0; 
+		for ALL(calibration->Ps, j) 
 		{
-			const size_t vertex_id = calibration->Xs.data[i].vertex_id; 
-			
-			// go through all points of this vertex
-			ASSERT_IS_SET(vertices_incidence, vertex_id);
-			for ALL(vertices_incidence.data[vertex_id].shot_point_ids, j)
-			{
-				const Double_Index * const index = vertices_incidence.data[vertex_id].shot_point_ids.data + j; 
-				
-				ASSERT(validate_shot(index->primary), "invalid shot encountered");
-				if (shots.data[index->primary].partial_calibration) continue;
-				ASSERT(index->primary < shots.count, "shot index out of bounds");
-				vertex_count[index->primary]++;
-			}
+			links += geometry_shots_correspondences(i, calibration->Ps.data[j].shot_id);
 		}
-
-		// now pick 'len' best shots 
-		// allocate array to keep track of randomness+1 best pairs 
-		size_t 
-			* const best_shot = ALLOC(size_t, len + 1),
-			* const best_corr = ALLOC(size_t, len + 1);
-		size_t best_count = 0;
-	
-		// go through all available shots
-		bool uncalibrated = false;
-		for ALL(shots, i) 
+		
+		// insert the value into sorted array 
+		if (best_count > 0)
 		{
-			const Shot * const shot = shots.data + i; 
-			if (shot->partial_calibration) continue;
-			uncalibrated = true;
-
-			const size_t correspondences = vertex_count[i];
-			
-			// insert the value into sorted array 
-			if (best_count > 0)
-			{
-				size_t no = best_count; // not overflow, since has length len + 1 and best_count <= len
-				best_shot[no] = i; 
-				best_corr[no] = correspondences;
-				while (no > 0 && best_corr[no - 1] < correspondences) 
-				{
-					swap_size_t(best_shot[no], best_shot[no - 1]); 
-					swap_size_t(best_corr[no], best_corr[no - 1]);
-					no--;
-				}
-				if (best_count < len) best_count++; 
-			}
-			else
+			size_t no = best_count; // not overflow, since has length len + 1 and best_count <= len
+			best_shot[no] = i; 
+			best_corr[no] = correspondences;
+			best_links[no] = links;
+			while (
+				no > 0 && 
+				(best_corr[no - 1] < correspondences || (best_corr[no - 1] == correspondences && best_links[no - 1] < links))
+			) 
 			{
-				best_count = 1;
-				best_shot[0] = i;
-				best_corr[0] = correspondences;
+				swap_size_t(best_shot[no], best_shot[no - 1]); 
+				swap_size_t(best_corr[no], best_corr[no - 1]);
+				swap_size_t(best_links[no], best_links[no - 1]);
+				no--;
 			}
+			if (best_count < len) best_count++; 
 		}
-
-		// is there an uncalibrated shot? 
-		if (!uncalibrated) 
+		else
 		{
-			printf("  All shots are calibrated.\n");
-			FREE(best_shot); 
-			FREE(best_corr); 
-			return false;
+			best_count = 1;
+			best_shot[0] = i;
+			best_corr[0] = correspondences;
+			best_links[0] = links;
 		}
+	}
 
-		// print the list of images with the largest amount of estimated vrtices 
-		printf("  List images considered:\n");
-		printf("  ");
-		for (size_t i = 0; i < best_count; i++) 
-		{
-			printf("%zd[%zd] ", best_shot[i], best_corr[i]);
-		}
-		if (best_count == 0) printf("(empty)");
-		printf("\n");
+	FREE(vertex_count);
+	FREE(best_links);
+
+	// is there an uncalibrated shot? 
+	if (!uncalibrated) 
+	{
+		printf("  All shots are calibrated.\n");
+		FREE(best_shot); 
+		FREE(best_corr); 
+		return false;
+	}
+
+	// print the list of images with the largest amount of estimated vrtices 
+	printf("  List images considered:\n");
+	printf("  ");
+	for (size_t i = 0; i < best_count; i++) 
+	{
+		printf("%zd[%zd] ", best_shot[i], best_corr[i]);
+	}
+	if (best_count == 0) printf("(empty)");
+	printf("\n");
+
+	// calculate how many of these are good enough to perform resection
+	size_t sufficient_count; // how many have at least 8 correspondences between them
+	for (sufficient_count = 0; sufficient_count < best_count; sufficient_count++)
+	{
+		if (best_corr[sufficient_count] < 6) break;
+	}
+
+	// terminate if there is no suitable pair
+	if (sufficient_count == 0)
+	{
+		printf("  No image with enough reconstructed vertices.\n");
+		FREE(best_shot); 
+		FREE(best_corr); 
+		return false; 
+	}
 	
-		// calculate how many of these are good enough to perform resection
-		size_t sufficient_count; // how many have at least 8 correspondences between them
-		for (sufficient_count = 0; sufficient_count < best_count; sufficient_count++)
+	// pick (at most 5) different candidates among the suitable shots and resect them 
+	// concurrently, the one with the largest consensus set is accepted 
+	const size_t candidates_count = sufficient_count < 5 ? sufficient_count : 5;
+	Calibration_Resection * const resections = ALLOC(Calibration_Resection, candidates_count);
+	for (size_t i = 0; i < candidates_count; i++) 
+	{
+		const size_t pick = i + rand() % (sufficient_count - i);
+		swap_size_t(best_shot[i], best_shot[pick]);
+		swap_size_t(best_corr[i], best_corr[pick]);
+		resections[i].shot_id = best_shot[i];
+		resections[i].seed = rand();
+		printf("  Resecting image %zd.\n", best_shot[i]); 
+	}
+
+	FREE(best_shot);
+	FREE(best_corr);
+
+	Calibration_Resection_Job job; 
+	job.calibration_id = calibration_id;
+	job.threshold = distance_threshold;
+	job.normalize_data = normalize_data;
+	job.normalize_A = normalize_A;
+	job.resections = resections;
+
+	opencv_begin();
+	core_parallel_for(
+		candidates_count, core_parallel_threads_count(tool_get_int(tool_calibration_id, CALIBRATION_THREADS)), 
+		calibration_resection_job, &job
+	);
+
+	size_t best = SIZE_MAX;
+	for (size_t i = 0; i < candidates_count; i++) 
+	{
+		if (!resections[i].ok) 
 		{
-			if (best_corr[sufficient_count] < 6) break;
+			printf("  Failed to resect image %zd.\n", resections[i].shot_id);
 		}
-	
-		// terminate if there is no suitable pair
-		if (sufficient_count == 0)
+		else if (best == SIZE_MAX || resections[i].inliers_count > resections[best].inliers_count) 
 		{
-			printf("  No image with enough reconstructed vertices.\n");
-			return false; 
+			best = i;
 		}
-		
-		// try to perform resection 
-		for (int i = 0; i < 5; i++) 
-		{
-			const size_t pick = rand() % sufficient_count;
-			const size_t shot_to_resect = best_shot[pick];
+	}
 
-			printf("  Resecting image %zd.\n", shot_to_resect); 
-			const bool status = calibration_add_view(calibration_id, shot_to_resect, distance_threshold, normalize_data, normalize_A);
-			
-			if (status) 
-			{
-				calibration->refined = false;
-				printf("  Resection performed.\n");
-				FREE(best_shot);
-				FREE(best_corr);
-				tool_calibration_refresh_UI();
-				calibration_triangulate_vertices(calibration_id, distance_threshold, 2, normalize_data, normalize_A);
-				return true;
-			}
+	size_t shot_to_resect = SIZE_MAX;
+	if (best != SIZE_MAX) 
+	{
+		shot_to_resect = resections[best].shot_id;
+		calibration_save_resection(calibration_id, resections + best);
+	}
 
-			printf("  Failed to resect.\n");
-		}
+	for (size_t i = 0; i < candidates_count; i++) 
+	{
+		calibration_release_resection(resections + i);
+	}
 
-		FREE(best_shot); 
-		FREE(best_corr);
+	FREE(resections);
+	opencv_end();
 
-		return false;
+	if (shot_to_resect == SIZE_MAX) return false;
+
+	calibration->refined = false;
+	printf("  Resection of image %zd performed.\n", shot_to_resect);
+	tool_calibration_refresh_UI();
+
+	// only vertices seen by the new camera could have changed 
+	opencv_begin();
+	calibration_triangulate_shot_vertices(calibration_id, shot_to_resect, distance_threshold, 2, normalize_data, normalize_A);
+	opencv_end();
+
+	// refine the new camera together with its neighbourhood, the whole calibration 
+	// is refined only after every couple of added cameras 
+	int cameras_count = 0; 
+	size_t j;
+	LAMBDA(calibration->Ps, j, cameras_count++; );
+	if (cameras_count % tool_get_int(tool_calibration_id, CALIBRATION_GLOBAL_BUNDLE_INTERVAL) == 0) 
+	{
+		printf("Refining calibration using bundle adjustment.\n");
+		calibration_bundle(calibration_id);
 	}
-	
-	return false;
+	else
+	{
+		printf("Refining neighbourhood of image %zd using bundle adjustment.\n", shot_to_resect);
+		calibration_bundle_local(calibration_id, shot_to_resect, tool_get_int(tool_calibration_id, CALIBRATION_LOCAL_BUNDLE_CAMERAS));
+	}
+
+	calibration->refined = true;
+	printf("  Bundle adjustment done.\n");
+	tool_calibration_refresh_UI();
+	return true;
 }
 
 // perform final nonlinear refinement and metric stratification 
@@ -983,7 +1201,7 @@ bool calibration_auto_end(
 
 	// final refinement
 	printf("Refining calibration using bundle adjustment.\n");
-	calibration_bundle();
+	calibration_bundle(calibration_id);
 	opencv_begin();    // todo unify calibration_*'s requirement for opencv lock
 	calibration_triangulate_vertices(calibration_id, distance_threshold, 2, normalize_data, normalize_A);
 	opencv_end();
@@ -991,6 +1209,10 @@ bool calibration_auto_end(
 	// metric stratification 
 	calibration_rectify(true);
 
+	// refine metric reconstruction 
+	printf("Refining metric reconstruction using bundle adjustment.\n");
+	calibration_bundle_metric();
+
 	// * use calibration * // note similarity with code in tool_calibration_use
 
 	// clear all calibration matrices
@@ -1326,109 +1548,243 @@ void tool_calibration_use()
 	INDEX_CLEAR(ui_state.current_calibration);
 }
 
-// internal routine used to triangulate vertex and revise its credibility
-void calibration_triangulate_vertex(
-	const size_t calibration_id, const size_t vertex_id, const double measurement_threshold, const int min_inliers,
-	const bool normalize_data, const bool normalize_A
+// per-thread scratch memory used in triangulation, it's large enough to hold 
+// data of the vertex with the most observations 
+struct Calibration_Triangulation_Scratch 
+{
+	double * points, * Ps; 
+	CvMat * headers; 
+	const CvMat * * matrices;
+};
+
+// data shared by threads triangulating a batch of vertices; observations of k-th 
+// vertex are stored at positions first[k] .. first[k + 1] - 1 of the flat arrays 
+struct Calibration_Triangulation_Job 
+{
+	const size_t * first; 
+	const double * points;                    // image coordinates of observations 
+	const CvMat * * Ps;                       // projection matrices of observing cameras
+	bool * inliers;                           // observations consistent with triangulated vertex 
+	CvMat * * Xs;                             // triangulated vertices (NULL when triangulation fails)
+	unsigned int seed; 
+	double threshold; 
+	int min_inliers; 
+	bool normalize_data, normalize_A; 
+	Calibration_Triangulation_Scratch * scratch; 
+};
+
+// triangulate one vertex of the batch, called from worker threads 
+void calibration_triangulation_job(void * arg, const size_t item, const size_t thread_id)
+{
+	Calibration_Triangulation_Job * const job = (Calibration_Triangulation_Job *)arg;
+	Calibration_Triangulation_Scratch * const scratch = job->scratch + thread_id;
+	const size_t first = job->first[item];
+	const int n = job->first[item + 1] - first;
+	bool * const inliers = job->inliers + first;
+
+	job->Xs[item] = NULL;
+	memset(inliers, 0, sizeof(bool) * n);
+	if (n < 2) return;
+
+	// copy the points, since they might be normalized 
+	CvMat points = cvMat(2, n, CV_64F, scratch->points);
+	for (int i = 0; i < n; i++) 
+	{
+		OPENCV_ELEM(&points, 0, i) = job->points[2 * (first + i) + 0];
+		OPENCV_ELEM(&points, 1, i) = job->points[2 * (first + i) + 1];
+	}
+
+	// optionally normalize and transform projection matrices accordingly
+	const CvMat * * matrices = job->Ps + first;
+	double scale = 1;
+	if (job->normalize_data) 
+	{
+		double h[9];
+		CvMat H_normalization = cvMat(3, 3, CV_64F, h);
+		mvg_normalize_points(&points, &H_normalization, &scale);
+		for (int i = 0; i < n; i++) 
+		{
+			scratch->headers[i] = cvMat(3, 4, CV_64F, scratch->Ps + 12 * i);
+			cvMatMul(&H_normalization, job->Ps[first + i], scratch->headers + i);
+			scratch->matrices[i] = scratch->headers + i;
+		}
+		matrices = scratch->matrices;
+	}
+
+	// every vertex gets its own random sequence, so that the result doesn't 
+	// depend on the order in which the vertices are processed 
+	unsigned int seed = job->seed + (unsigned int)item * 2654435761u;
+	job->Xs[item] = mvg_triangulation_RANSAC(
+		matrices, &points, false, job->normalize_A, job->min_inliers, job->min_inliers, MVG_RANSAC_TRIANGULATION_TRIALS, 
+		job->threshold * scale, inliers, &seed
+	);
+}
+
+// triangulate vertices and revise their credibility (internal routine); the observations 
+// are gathered first, then the vertices are triangulated in parallel and finally the 
+// results are written into the calibration 
+void calibration_triangulate_batch(
+	const size_t calibration_id, const size_t * const vertex_ids, const size_t count, 
+	const double measurement_threshold, const int min_inliers, const bool normalize_data, const bool normalize_A
 )
 {
 	ASSERT_IS_SET(calibrations, calibration_id);
-	ASSERT(validate_vertex(vertex_id), "tried to triangulate invalid vertex");
-	Calibration * calibration = calibrations.data + calibration_id;
-
-	// publish triangulation data 
-	const CvMat * * projection_matrices_original; 
-	CvMat * * projection_matrices_normalized = NULL;
-	CvMat * points;
-	size_t * indices;
-	if (publish_triangulation_data_from_calibration(calibration_id, vertices_incidence.data[vertex_id], vertex_id, projection_matrices_original, points, indices))
-	{
-		// triangulation data successfully obtained
-		bool * inliers = ALLOC(bool, points->cols);
-		CvMat * X;
-
-		// optionally normalize
-		double scale = 1;
-		if (normalize_data)
-		{
-			// normalize the points
-			CvMat * H_normalization = opencv_create_matrix(3, 3);
-			mvg_normalize_points(points, H_normalization, &scale);
-			projection_matrices_normalized = ALLOC(CvMat *, points->cols);
+	Calibration * const calibration = calibrations.data + calibration_id;
+	if (count == 0) return;
 
-			// transform projection matrices accordingly
-			for (int i = 0; i < points->cols; i++)
-			{
-				CvMat * M = opencv_create_matrix(3, 4);
-				cvMatMul(H_normalization, projection_matrices_original[i], M);
-				projection_matrices_normalized[i] = M;
-			}
-			cvReleaseMat(&H_normalization);
+	// count observations on calibrated shots 
+	size_t * const cameras = calibration_cameras_index(calibration);
+	size_t * const first = ALLOC(size_t, count + 1);
+	size_t total = 0, max_count = 0;
+	for (size_t k = 0; k < count; k++) 
+	{
+		const size_t vertex_id = vertex_ids[k];
+		ASSERT(validate_vertex(vertex_id), "tried to triangulate invalid vertex");
+		ASSERT_IS_SET(vertices_incidence, vertex_id);
+
+		first[k] = total;
+		for ALL(vertices_incidence.data[vertex_id].shot_point_ids, j) 
+		{
+			if (cameras[vertices_incidence.data[vertex_id].shot_point_ids.data[j].primary] != SIZE_MAX) total++;
 		}
 
-		// try to find the vertex in existing dataset
-		size_t X_id; 
-		bool X_found;
-		LAMBDA_FIND(calibration->Xs, X_id, X_found, calibration->Xs.data[X_id].vertex_id == vertex_id);
-		Calibration_Vertex * vertex = NULL;
-		if (X_found)
+		if (total - first[k] > max_count) max_count = total - first[k];
+	}
+	first[count] = total;
+
+	// gather them into flat arrays, indices hold pairs (camera, point) 
+	double * const points = ALLOC(double, 2 * total + 1);
+	const CvMat * * const Ps = ALLOC(const CvMat *, total + 1);
+	size_t * const indices = ALLOC(size_t, 2 * total + 1);
+	bool * const inliers = ALLOC(bool, total + 1);
+	for (size_t k = 0; k < count; k++) 
+	{
+		const size_t vertex_id = vertex_ids[k];
+		size_t l = first[k];
+		for ALL(vertices_incidence.data[vertex_id].shot_point_ids, j) 
 		{
-			vertex = calibration->Xs.data + X_id;
+			const Double_Index * const index = vertices_incidence.data[vertex_id].shot_point_ids.data + j;
+			const size_t P_id = cameras[index->primary];
+			if (P_id == SIZE_MAX) continue;
+
+			// consistency check
+			ASSERT_IS_SET(shots.data[index->primary].points, index->secondary);
+			const Shot * const shot = shots.data + index->primary;
+			ASSERT(shot->points.data[index->secondary].vertex == vertex_id, "inconsistent data in vertex_incidence structure");
+
+			points[2 * l + 0] = shot->points.data[index->secondary].x * shot->width;
+			points[2 * l + 1] = shot->points.data[index->secondary].y * shot->height;
+			Ps[l] = calibration->Ps.data[P_id].P;
+			indices[2 * l + 0] = P_id;
+			indices[2 * l + 1] = index->secondary;
+			l++;
 		}
+		ASSERT(l == first[k + 1], "inconsistent counters");
+	}
+
+	FREE(cameras);
+
+	// triangulate in parallel 
+	const size_t threads_count = core_parallel_threads_count(tool_get_int(tool_calibration_id, CALIBRATION_THREADS));
+	Calibration_Triangulation_Job job; 
+	job.first = first;
+	job.points = points;
+	job.Ps = Ps;
+	job.inliers = inliers;
+	job.Xs = ALLOC(CvMat *, count);
+	job.seed = rand();
+	job.threshold = measurement_threshold;
+	job.min_inliers = min_inliers;
+	job.normalize_data = normalize_data;
+	job.normalize_A = normalize_A;
+	job.scratch = ALLOC(Calibration_Triangulation_Scratch, threads_count);
+	for (size_t t = 0; t < threads_count; t++) 
+	{
+		job.scratch[t].points = ALLOC(double, 2 * max_count + 1);
+		job.scratch[t].Ps = ALLOC(double, 12 * max_count + 1);
+		job.scratch[t].headers = ALLOC(CvMat, max_count + 1);
+		job.scratch[t].matrices = ALLOC(const CvMat *, max_count + 1);
+	}
+
+	core_parallel_for(count, threads_count, calibration_triangulation_job, &job);
+
+	// index from vertex ids to calibration's vertices 
+	size_t * const vertex_to_X = ALLOC(size_t, vertices.count > 0 ? vertices.count : 1);
+	for (size_t i = 0; i < vertices.count; i++) vertex_to_X[i] = SIZE_MAX;
+	for ALL(calibration->Xs, i) 
+	{
+		ASSERT(calibration->Xs.data[i].vertex_id < vertices.count, "invalid vertex index");
+		vertex_to_X[calibration->Xs.data[i].vertex_id] = i;
+	}
+
+	// save the results 
+	for (size_t k = 0; k < count; k++) 
+	{
+		const size_t vertex_id = vertex_ids[k], n = first[k + 1] - first[k];
+
+		// vertex isn't visible on any calibrated shot 
+		if (n == 0) continue;
 
-		if (
-			points->cols >= 2 &&
-			(X = mvg_triangulation_RANSAC(
-				normalize_data ? (const CvMat **)projection_matrices_normalized : projection_matrices_original, 
-				points, false, normalize_A, min_inliers, min_inliers, MVG_RANSAC_TRIANGULATION_TRIALS, 
-				measurement_threshold * scale, inliers
-			)
-			/*(X = mvg_triangulation_SVD(
-				normalize_data ? (const CvMat **)projection_matrices_normalized : projection_matrices_original, 
-				points, normalize_A, min_inliers, 0, -1
-			)*/
-			)
-		)
+		const size_t X_id = vertex_to_X[vertex_id];
+		if (job.Xs[k]) 
 		{
 			// vertex has been triangulated - save it's coordinates
-			if (vertex) 
+			if (X_id != SIZE_MAX) 
 			{
+				Calibration_Vertex * const vertex = calibration->Xs.data + X_id;
 				if (vertex->X) cvReleaseMat(&vertex->X);
-				vertex->X = X;
+				vertex->X = job.Xs[k];
 			}
 			else
 			{
 				ADD(calibration->Xs);
-				vertex = calibration->Xs.data + LAST_INDEX(calibration->Xs);
+				Calibration_Vertex * const vertex = calibration->Xs.data + LAST_INDEX(calibration->Xs);
 				vertex->vertex_id = vertex_id;
-				vertex->X = X;
+				vertex->X = job.Xs[k];
+				vertex_to_X[vertex_id] = LAST_INDEX(calibration->Xs);
 			}
-
-			// also update the set of inliers and outliers 
-			calibration_update_inliers(calibration_id, points->cols, indices, inliers);
 		}
-		else if (vertex)
+		else if (X_id != SIZE_MAX) 
 		{
+			Calibration_Vertex * const vertex = calibration->Xs.data + X_id;
 			if (vertex->X) cvReleaseMat(&vertex->X);
 			vertex->set = false;
-
-			// mark the inliers and outliers anyway
-			calibration_update_inliers(calibration_id, points->cols, indices, inliers);
+			vertex_to_X[vertex_id] = SIZE_MAX;
 		}
-
-		// release resources 
-		if (normalize_data)
+		else
 		{
-			for (int i = 0; i < points->cols; i++)
-			{
-				cvReleaseMat(projection_matrices_normalized + i);
-			}
-			FREE(projection_matrices_normalized);
+			continue;
 		}
-		FREE(indices);
-		FREE(projection_matrices_original);
-		cvReleaseMat(&points);
+
+		// also update the set of inliers and outliers 
+		calibration_update_inliers(calibration_id, n, indices + 2 * first[k], inliers + first[k]);
 	}
+
+	// release resources 
+	for (size_t t = 0; t < threads_count; t++) 
+	{
+		FREE(job.scratch[t].points);
+		FREE(job.scratch[t].Ps);
+		FREE(job.scratch[t].headers);
+		FREE(job.scratch[t].matrices);
+	}
+	FREE(job.scratch);
+	FREE(job.Xs);
+	FREE(vertex_to_X);
+	FREE(first);
+	FREE(points);
+	FREE(Ps);
+	FREE(indices);
+	FREE(inliers);
+}
+
+// internal routine used to triangulate vertex and revise its credibility
+void calibration_triangulate_vertex(
+	const size_t calibration_id, const size_t vertex_id, const double measurement_threshold, const int min_inliers,
+	const bool normalize_data, const bool normalize_A
+)
+{
+	calibration_triangulate_batch(calibration_id, &vertex_id, 1, measurement_threshold, min_inliers, normalize_data, normalize_A);
 }
 
 // triangulate all vertices (internal routine)
@@ -1438,11 +1794,37 @@ void calibration_triangulate_vertices(
 )
 {
 	// go through all vertices
+	size_t * const vertex_ids = ALLOC(size_t, vertices.count > 0 ? vertices.count : 1);
+	size_t count = 0;
 	for ALL(vertices, i) 
 	{
-		// try to triangulate it 
-		calibration_triangulate_vertex(calibration_id, i, measurement_threshold, 2, normalize_data, normalize_A);
+		vertex_ids[count++] = i;
 	}
+
+	calibration_triangulate_batch(calibration_id, vertex_ids, count, measurement_threshold, min_inliers, normalize_data, normalize_A);
+	FREE(vertex_ids);
+}
+
+// triangulate vertices observed in given shot (internal routine)
+void calibration_triangulate_shot_vertices(
+	const size_t calibration_id, const size_t shot_id, const double measurement_threshold, const int min_inliers,
+	const bool normalize_data, const bool normalize_A
+)
+{
+	ASSERT(validate_shot(shot_id), "invalid shot");
+
+	// go through all points of the shot
+	size_t * const vertex_ids = ALLOC(size_t, shots.data[shot_id].points.count > 0 ? shots.data[shot_id].points.count : 1);
+	size_t count = 0;
+	for ALL(shots.data[shot_id].points, i) 
+	{
+		const size_t vertex_id = shots.data[shot_id].points.data[i].vertex;
+		if (!validate_vertex(vertex_id)) continue;
+		vertex_ids[count++] = vertex_id;
+	}
+
+	calibration_triangulate_batch(calibration_id, vertex_ids, count, measurement_threshold, min_inliers, normalize_data, normalize_A);
+	FREE(vertex_ids);
 }
 
 // triangulate vertices 
@@ -1487,11 +1869,7 @@ void tool_calibration_triangulate_trusted()
 		normalize_A = tool_get_bool(tool_calibration_id, CALIBRATION_NORMALIZE_A);
 
 	// go through all vertices and triangulate
-	for ALL(vertices, i) 
-	{
-		// try to triangulate it 
-		calibration_triangulate_vertex(calibration_id, i, measurement_threshold, 3, normalize_data, normalize_A);
-	}
+	calibration_triangulate_vertices(calibration_id, measurement_threshold, 3, normalize_data, normalize_A);
 }
 
 // refine existing calibration using different thresholding levels 
@@ -1639,131 +2017,123 @@ void tool_calibration_clear()
 	tool_calibration_refresh_UI();
 }
 
-// calculating projection of vertex using current camera 
-void calibration_projection(int j, int i, double *aj, double *bi, double *xij, void *adata)
+// index from shot ids to calibration's cameras (SIZE_MAX for shots which aren't 
+// calibrated), the array is allocated here and has to be released by the caller 
+size_t * calibration_cameras_index(const Calibration * const calibration)
 {
-	double w = aj[2 * 4 + 0] * bi[0] + aj[2 * 4 + 1] * bi[1] + aj[2 * 4 + 2] * bi[2] + aj[2 * 4 + 3] * bi[3];
-	if (w == 0) w = 0e-8; // note dirty...
-	xij[0] = (aj[0 * 4 + 0] * bi[0] + aj[0 * 4 + 1] * bi[1] + aj[0 * 4 + 2] * bi[2] + aj[0 * 4 + 3] * bi[3]) / w;
-	xij[1] = (aj[1 * 4 + 0] * bi[0] + aj[1 * 4 + 1] * bi[1] + aj[1 * 4 + 2] * bi[2] + aj[1 * 4 + 3] * bi[3]) / w;
-
-	// print the error
-	/*const size_t INDEX = I[j * C + i] * 2;
-	const double dx = M[INDEX + 0] - bi[0], dy = M[INDEX + 1] - bi[1]; 
-	const double d = sqrt(dx * dx + dy * dy);
-	printf("[%f]", d);*/
-}
-
-// run bundle adjustment 
-void calibration_bundle() 
-{
-	const size_t BA_CAMERA_PARAMETERS = 12;
-
-	opencv_begin(); // lock OpenCV (perhaps unnecessary?)
-
-	// if no calibration is selected, we don't have anything to do 
-	if (!INDEX_IS_SET(ui_state.current_calibration))
+	size_t * const cameras = ALLOC(size_t, shots.count > 0 ? shots.count : 1);
+	for (size_t i = 0; i < shots.count; i++) cameras[i] = SIZE_MAX;
+	for ALL(calibration->Ps, i) 
 	{
-		printf("No calibration selected.\n");
-		return;
+		ASSERT(calibration->Ps.data[i].shot_id < shots.count, "invalid shot index");
+		cameras[calibration->Ps.data[i].shot_id] = i;
 	}
 
-	const size_t calibration_id = ui_state.current_calibration;
-	Calibration * const calibration = calibrations.data + calibration_id;
-
-	// update calibrated flag 
-	calibration_refresh_flag(calibration_id);
-
-	// * build input for bundle adjustment routine *
+	return cameras;
+}
 
-	// count the number of vertices and cameras
-	int Xs_count = 0, Ps_count = 0; 
+// build sparse visibility and measurement vector for bundle adjustment from inlier 
+// observations of calibration's vertices (excluded vertices are left without any), 
+// returns the number of measurements; visibility's arrays and measurement are allocated 
+// here and have to be released by the caller; only cameras and vertices which have 
+// their index in shots_reindex and Xs_reindex set are used (Xs_reindex can be NULL 
+// when all vertices are) 
+size_t calibration_bundle_observations(
+	const Calibration * const calibration, const size_t * const shots_reindex, const size_t * const Xs_reindex, 
+	const int Ps_count, const int Xs_count, const bool * const excluded, sba_crsm & visibility, double * & measurement
+)
+{
+	// bound the number of measurements by the number of all observations of the vertices 
+	size_t maximum_count = 0; 
+	for ALL(calibration->Xs, i)
 	{
-		size_t i; // strong todo why can't labda define the iterator? maybe to break from inside of it and read last iterated index?
-		LAMBDA(calibration->Xs, i, Xs_count++; );
-		LAMBDA(calibration->Ps, i, Ps_count++; );
+		if (Xs_reindex && Xs_reindex[i] == SIZE_MAX) continue;
+		ASSERT_IS_SET(vertices_incidence, calibration->Xs.data[i].vertex_id);
+		maximum_count += vertices_incidence.data[calibration->Xs.data[i].vertex_id].shot_point_ids.count;
 	}
 
-	// allocate memory for the visibility mask 
-	const int maximum_count = Xs_count * Ps_count;
-	char * visibility_mask = ALLOC(char, maximum_count);
-	memset(visibility_mask, 0, sizeof(char) * maximum_count);
-	double * measurement = ALLOC(double, maximum_count * 2);
-
-	// precompute index from shot_ids to order in Calibration_Cameras array 
-	size_t * shots_reindex = ALLOC(size_t, shots.count); 
-	for (size_t i = 0; i < shots.count; i++) shots_reindex[i] = SIZE_MAX;
+	// allocate memory for the visibility (stored sparsely as the list of cameras 
+	// observing each vertex) and for the measurements 
+	int * visibility_rows = ALLOC(int, Xs_count + 1); 
+	int * visibility_cameras = ALLOC(int, maximum_count > 0 ? maximum_count : 1);
+	measurement = ALLOC(double, maximum_count > 0 ? maximum_count * 2 : 1);
 
-	{
-		size_t k, j = 0;
-		LAMBDA(
-			calibration->Ps, k, 
-			ASSERT(calibration->Ps.data[k].shot_id < shots.count, "invalid shot index");
-			shots_reindex[calibration->Ps.data[k].shot_id] = j++;
-		);
-		// note that the domain of the shots_reindex mapping is defined by the 
-		//      partial_calibration flag - therefore, it must be kept consistent
-		// note could we have a dedicated function for this stuff (generally)? 
-		// something like: INDEX(shots_reindex, shots, calibration->Ps)
-	}
-
-	// go through all vertices and generate visibility mask and measurement vector 
+	// go through all vertices and generate visibility and measurement vector; vertex_visibility 
+	// holds for every camera the last vertex which is visible in it (increased by one)
 	size_t measurement_count = 0, X_count = 0;
-	char * vertex_visibility = ALLOC(char, Ps_count);
+	size_t * vertex_visibility = ALLOC(size_t, Ps_count);
+	memset(vertex_visibility, 0, sizeof(size_t) * Ps_count);
 	size_t * incidence_ids = ALLOC(size_t, Ps_count);
+	size_t * const cameras = calibration_cameras_index(calibration);
 	
 	for ALL(calibration->Xs, i)
 	{
+		if (Xs_reindex && Xs_reindex[i] == SIZE_MAX) continue;
+		ASSERT(!Xs_reindex || Xs_reindex[i] == X_count, "vertices have to be ordered");
 		Calibration_Vertex * const X = calibration->Xs.data + i;
 		const size_t vertex_id = X->vertex_id;
 
 		ASSERT_IS_SET(vertices_incidence, vertex_id);
 
 		// go through all photos with this vertex and decide which ones will be inserted 
-		memset(vertex_visibility, 0, sizeof(char) * Ps_count);
+		const size_t first = measurement_count;
 		for ALL(vertices_incidence.data[vertex_id].shot_point_ids, j)
 		{
 			const Double_Index * const index = vertices_incidence.data[vertex_id].shot_point_ids.data + j;
 			const Shot * const shot = shots.data + index->primary;
 
 			// we care only about photos in this calibration (we updated the calibrated flag, remember?)
-			if (shot->partial_calibration) // note is this done right? will the compiler join this and the following ifs in release? // obsolete comment
+			// which take part in the optimization and only about vertices which weren't excluded 
+			if (shot->partial_calibration && shots_reindex[index->primary] != SIZE_MAX && !(excluded && excluded[X_count]))
 			{
-				if (!(IS_SET(calibration->Ps.data[shots_reindex[index->primary]].points_meta, index->secondary))) continue;
+				const Calibration_Camera * const P = calibration->Ps.data + cameras[index->primary];
+				if (!(IS_SET(P->points_meta, index->secondary))) continue;
 				
 				// and we also discard outliers
-				if (calibration->Ps.data[shots_reindex[index->primary]].points_meta.data[index->secondary].inlier == 1)
+				if (P->points_meta.data[index->secondary].inlier == 1)
 				{
 					ASSERT(index->primary < shots.count, "invalid shot index");
 					ASSERT(shots_reindex[index->primary] < Ps_count, "invalid shot order index");
-					vertex_visibility[shots_reindex[index->primary]] = 1; 
-					incidence_ids[shots_reindex[index->primary]] = j;
+					const size_t camera = shots_reindex[index->primary];
+					if (vertex_visibility[camera] != X_count + 1) 
+					{
+						ASSERT(measurement_count < maximum_count, "accessing elements outside of visibility");
+						vertex_visibility[camera] = X_count + 1; 
+						visibility_cameras[measurement_count++] = camera;
+					}
+
+					incidence_ids[camera] = j;
 				}
 			}
 		}
 
-		// set visibility 
-		ASSERT(X_count * Ps_count + Ps_count <= maximum_count, "accessing elements outside of visibility mask");
-		memcpy(visibility_mask + (X_count * Ps_count), vertex_visibility, sizeof(char) * Ps_count);
+		// set visibility, cameras have to be sorted 
+		visibility_rows[X_count] = first;
+		for (size_t k = first + 1; k < measurement_count; k++) 
+		{
+			const int camera = visibility_cameras[k]; 
+			size_t l = k; 
+			while (l > first && visibility_cameras[l - 1] > camera) 
+			{
+				visibility_cameras[l] = visibility_cameras[l - 1];
+				l--;
+			}
+
+			visibility_cameras[l] = camera;
+		}
 
 		// insert their values into measurement vector
-		for (size_t j = 0; j < Ps_count; j++) 
+		for (size_t k = first; k < measurement_count; k++) 
 		{
-			// skip invisible
-			if (vertex_visibility[j] != 1) continue;
-
-			const size_t incidence_id = incidence_ids[j];
+			const size_t incidence_id = incidence_ids[visibility_cameras[k]];
 			ASSERT_IS_SET(vertices_incidence.data[vertex_id].shot_point_ids, incidence_id);
 			const Double_Index * const index = vertices_incidence.data[vertex_id].shot_point_ids.data + incidence_id;
 			const Shot * const shot = shots.data + index->primary; 
 
 			// the meassurement will be used
 			ASSERT_IS_SET(shot->points, index->secondary);
-			// printf("[%d/%d] ", measurement_count * 2 + 1, maximum_count * 2);
-			ASSERT(measurement_count * 2 + 1 < 2 * maximum_count, "measurement index out of bounds");
-			measurement[measurement_count * 2 + 0] = shot->points.data[index->secondary].x * shot->width;
-			measurement[measurement_count * 2 + 1] = shot->points.data[index->secondary].y * shot->height;
-			measurement_count++;
+			measurement[k * 2 + 0] = shot->points.data[index->secondary].x * shot->width;
+			measurement[k * 2 + 1] = shot->points.data[index->secondary].y * shot->height;
 		}
 
 		// increase the counter of vertices in calibration 
@@ -1771,19 +2141,284 @@ void calibration_bundle()
 		ASSERT(X_count <= Xs_count, "inconsistent counters");
 	}
 
+	visibility_rows[Xs_count] = measurement_count;
+	FREE(vertex_visibility);
+	FREE(incidence_ids);
+	FREE(cameras);
+
+	visibility.nr = Xs_count; 
+	visibility.nc = Ps_count; 
+	visibility.nnz = measurement_count; 
+	visibility.val = NULL; 
+	visibility.colidx = visibility_cameras;
+	visibility.rowptr = visibility_rows;
+	return measurement_count;
+}
+
+// fill in options of bundle adjustment routine 
+void calibration_bundle_options(double options[SBA_OPTSSZ])
+{
+	ASSERT(SBA_OPTSSZ > 6, "sba has fewer options than expected, this should be easy to fix");
+	memset(options, 0, sizeof(double) * SBA_OPTSSZ);
+	options[0] = SBA_INIT_MU;
+	options[1] = SBA_STOP_THRESH;
+	options[2] = SBA_STOP_THRESH;
+	options[3] = SBA_STOP_THRESH;
+	options[4] = 0;
+
+	// the per-point parts of normal equations are computed in parallel and the reduced 
+	// camera system is either solved as a dense or block sparse matrix 
+	options[5] = core_parallel_threads_count(tool_get_int(tool_calibration_id, CALIBRATION_THREADS));
+	options[6] = tool_get_bool(tool_calibration_id, CALIBRATION_SPARSE_SOLVER) ? SBA_SOLVER_SPARSE : SBA_SOLVER_DENSE;
+}
+
+// reprojection errors of all observations in the order of measurement vector, returns 
+// the sum of their squares 
+double calibration_bundle_residuals(
+	const int Xs_count, const int Ps_count, const sba_crsm & visibility, double * const parameters, 
+	const int camera_parameters, const int point_parameters, const double * const measurement, 
+	void (* const projection)(int j, int i, double * aj, double * bi, double * xij, void * adata), void * const data, 
+	double * const residuals
+)
+{
+	double sum = 0;
+	double * const points = parameters + Ps_count * camera_parameters;
+	for (int i = 0; i < Xs_count; i++) 
+	{
+		for (int k = visibility.rowptr[i]; k < visibility.rowptr[i + 1]; k++) 
+		{
+			const int j = visibility.colidx[k];
+			double x[2];
+			projection(j, i, parameters + j * camera_parameters, points + i * point_parameters, x, data);
+
+			const double dx = measurement[2 * k + 0] - x[0], dy = measurement[2 * k + 1] - x[1];
+			residuals[k] = sqrt(dx * dx + dy * dy);
+			sum += dx * dx + dy * dy;
+		}
+	}
+
+	return sum;
+}
+
+// run bundle adjustment with robust error function, which is minimized by iteratively 
+// reweighted least squares - before every round each observation gets weight according 
+// to its current reprojection error and the weights are passed to sba as (inverse) 
+// measurement covariances; initial and final sums of squared (unweighted) reprojection 
+// errors are returned; first fixed_count cameras are not optimized 
+void calibration_bundle_adjust(
+	const int Xs_count, const int Ps_count, const int fixed_count, sba_crsm & visibility, double * const parameters, 
+	const int camera_parameters, const int point_parameters, double * const measurement, const size_t measurement_count, 
+	void (* const projection)(int j, int i, double * aj, double * bi, double * xij, void * adata), 
+	void (* const jacobian)(int j, int i, double * aj, double * bi, double * Aij, double * Bij, void * adata), 
+	void * const data, double & initial_error, double & final_error
+)
+{
+	// get settings
+	const size_t kernel = tool_get_int(tool_calibration_id, CALIBRATION_ROBUST_KERNEL);
+	const int rounds = kernel == CALIBRATION_ROBUST_NONE ? 1 : tool_get_int(tool_calibration_id, CALIBRATION_ROBUST_ROUNDS);
+	const double delta = tool_get_real(tool_calibration_id, CALIBRATION_IMAGE_MEASUREMENT_THRESHOLD);
+
+	// optimization options
+	double options[SBA_OPTSSZ];
+	calibration_bundle_options(options);
+
+	// info
+	double info[SBA_INFOSZ];
+
+	// nothing to optimize 
+	if (measurement_count == 0 || fixed_count >= Ps_count) 
+	{
+		initial_error = final_error = 0;
+		return;
+	}
+
+	double * residuals = ALLOC(double, measurement_count > 0 ? measurement_count : 1);
+	double * covariances = kernel == CALIBRATION_ROBUST_NONE ? NULL : ALLOC(double, measurement_count > 0 ? 4 * measurement_count : 1);
+	initial_error = calibration_bundle_residuals(Xs_count, Ps_count, visibility, parameters, camera_parameters, point_parameters, measurement, projection, data, residuals);
+	final_error = initial_error;
+
+	for (int round = 0; round < rounds; round++) 
+	{
+		// reweight observations, weight w corresponds to covariance matrix I / w 
+		if (covariances) 
+		{
+			for (size_t k = 0; k < measurement_count; k++) 
+			{
+				const double r = residuals[k] / delta;
+				double w = 1;
+				if (kernel == CALIBRATION_ROBUST_HUBER) 
+				{
+					if (r > 1) w = 1 / r;
+				}
+				else if (kernel == CALIBRATION_ROBUST_CAUCHY) 
+				{
+					w = 1 / (1 + r * r);
+				}
+
+				// gross outliers would make the covariances numerically singular 
+				if (w < 1e-6) w = 1e-6;
+
+				covariances[4 * k + 0] = 1 / w; 
+				covariances[4 * k + 1] = 0; 
+				covariances[4 * k + 2] = 0; 
+				covariances[4 * k + 3] = 1 / w; 
+			}
+		}
+
+		// * call bundle adjustment routine * 
+		sba_motstr_levmar_crsm(
+			Xs_count,
+			Ps_count,
+			fixed_count,
+			&visibility,
+			parameters,
+			camera_parameters, 
+			point_parameters,
+			measurement, 
+			covariances, 
+			2, 
+			projection, 
+			jacobian, 
+			data,
+			1000,
+			0, // verbose option
+			options, 
+			info
+		);
+
+		const double error = calibration_bundle_residuals(Xs_count, Ps_count, visibility, parameters, camera_parameters, point_parameters, measurement, projection, data, residuals);
+
+		// stop once the weights settle down 
+		const bool converged = fabs(final_error - error) <= 1e-3 * final_error;
+		final_error = error;
+		if (converged) break;
+	}
+
+	FREE(residuals);
+	if (covariances) FREE(covariances);
+}
+
+// run bundle adjustment of the given calibration; if active_shots is given (indexed 
+// by shot ids), only these cameras and vertices observed in them are optimized, while 
+// the remaining cameras observing these vertices are kept fixed and everything else 
+// is left out (local bundle adjustment) 
+void calibration_bundle(const size_t calibration_id, const bool * const active_shots) 
+{
+	const size_t BA_CAMERA_PARAMETERS = MVG_BUNDLE_PROJECTIVE_CAMERA_PARAMETERS;
+
+	opencv_begin(); // lock OpenCV (perhaps unnecessary?)
+
+	ASSERT_IS_SET(calibrations, calibration_id);
+	Calibration * const calibration = calibrations.data + calibration_id;
+
+	// update calibrated flag 
+	calibration_refresh_flag(calibration_id);
+
+	// * build input for bundle adjustment routine *
+
+	// decide which vertices and cameras take part in the optimization, cameras 
+	// are ordered so that the fixed ones come first; shots_reindex holds for 
+	// every shot its order in the vector of parameters and Xs_reindex the same 
+	// for calibration's vertices 
+	int Xs_count = 0, Ps_count = 0, fixed_count = 0; 
+	size_t * shots_reindex = ALLOC(size_t, shots.count); 
+	for (size_t i = 0; i < shots.count; i++) shots_reindex[i] = SIZE_MAX;
+	size_t * Xs_reindex = ALLOC(size_t, calibration->Xs.count > 0 ? calibration->Xs.count : 1);
+
+	if (!active_shots) 
+	{
+		for ALL(calibration->Ps, i) 
+		{
+			ASSERT(calibration->Ps.data[i].shot_id < shots.count, "invalid shot index");
+			shots_reindex[calibration->Ps.data[i].shot_id] = Ps_count++;
+		}
+
+		for ALL(calibration->Xs, i) 
+		{
+			Xs_reindex[i] = Xs_count++;
+		}
+	}
+	else
+	{
+		// vertices with an inlying observation in one of the active cameras are optimized 
+		// and every other camera observing them is fixed 
+		bool * const fixed = ALLOC(bool, shots.count > 0 ? shots.count : 1);
+		memset(fixed, 0, sizeof(bool) * shots.count);
+		size_t * const cameras = calibration_cameras_index(calibration);
+
+		for ALL(calibration->Xs, i) 
+		{
+			const size_t vertex_id = calibration->Xs.data[i].vertex_id;
+			ASSERT_IS_SET(vertices_incidence, vertex_id);
+			const Double_Indices * const incidence = &vertices_incidence.data[vertex_id].shot_point_ids;
+
+			// is the vertex observed by an active camera? 
+			Xs_reindex[i] = SIZE_MAX;
+			for ALL(*incidence, j) 
+			{
+				const Double_Index * const index = incidence->data + j;
+				if (cameras[index->primary] == SIZE_MAX || !active_shots[index->primary]) continue;
+				const Calibration_Camera * const P = calibration->Ps.data + cameras[index->primary];
+				if (IS_SET(P->points_meta, index->secondary) && P->points_meta.data[index->secondary].inlier == 1) 
+				{
+					Xs_reindex[i] = Xs_count++;
+					break;
+				}
+			}
+
+			if (Xs_reindex[i] == SIZE_MAX) continue;
+
+			// the other cameras observing it 
+			for ALL(*incidence, j) 
+			{
+				const Double_Index * const index = incidence->data + j;
+				if (cameras[index->primary] == SIZE_MAX || active_shots[index->primary]) continue;
+				const Calibration_Camera * const P = calibration->Ps.data + cameras[index->primary];
+				if (IS_SET(P->points_meta, index->secondary) && P->points_meta.data[index->secondary].inlier == 1) 
+				{
+					fixed[index->primary] = true;
+				}
+			}
+		}
+
+		for ALL(calibration->Ps, i) 
+		{
+			const size_t shot_id = calibration->Ps.data[i].shot_id;
+			if (fixed[shot_id]) shots_reindex[shot_id] = fixed_count++;
+		}
+
+		Ps_count = fixed_count;
+		for ALL(calibration->Ps, i) 
+		{
+			const size_t shot_id = calibration->Ps.data[i].shot_id;
+			if (active_shots[shot_id]) shots_reindex[shot_id] = Ps_count++;
+		}
+
+		FREE(fixed);
+		FREE(cameras);
+		printf("  Local bundle adjustment of %d cameras (%d fixed) and %d vertices.\n", Ps_count - fixed_count, fixed_count, Xs_count);
+	}
+
+	// gather observations 
+	sba_crsm visibility; 
+	double * measurement; 
+	const size_t measurement_count = calibration_bundle_observations(calibration, shots_reindex, Xs_reindex, Ps_count, Xs_count, NULL, visibility, measurement);
+
+
 	// * build vector of parameters *
 
 	const size_t parameters_count = Ps_count * BA_CAMERA_PARAMETERS + Xs_count * 4;
-	double * parameters = ALLOC(double, parameters_count); 
+	double * parameters = ALLOC(double, parameters_count > 0 ? parameters_count : 1); 
 
 	size_t Ps_i = 0;
 	for ALL(calibration->Ps, i)
 	{
 		const Calibration_Camera * camera = calibration->Ps.data + i;
+		ASSERT(camera->shot_id < shots.count, "invalid shot index"); 
+		if (shots_reindex[camera->shot_id] == SIZE_MAX) continue;
 		for (int j = 0; j < 12; j++) 
 		{
 			const double d = OPENCV_ELEM(camera->P, j / 4, j % 4);
-			ASSERT(camera->shot_id < shots.count, "invalid shot index"); 
 			ASSERT(shots_reindex[camera->shot_id] * BA_CAMERA_PARAMETERS + j < parameters_count, "parameter index out of bounds");
 			parameters[shots_reindex[camera->shot_id] * BA_CAMERA_PARAMETERS + j] = d;
 		}
@@ -1792,18 +2427,16 @@ void calibration_bundle()
 	ASSERT(Ps_i == Ps_count, "inconsistent counters");
 
 	const size_t parameter_offset = Ps_count * BA_CAMERA_PARAMETERS;
-	size_t Xs_i = 0; 
 	for ALL(calibration->Xs, i) 
 	{
+		if (Xs_reindex[i] == SIZE_MAX) continue;
 		const Calibration_Vertex * vertex = calibration->Xs.data + i;
 		for (int j = 0; j < 4; j++) 
 		{
-			ASSERT(parameter_offset + Xs_i * 4 + j < parameters_count, "parameter index out of bounds");
-			parameters[parameter_offset + Xs_i * 4 + j] = OPENCV_ELEM(vertex->X, j, 0);
+			ASSERT(parameter_offset + Xs_reindex[i] * 4 + j < parameters_count, "parameter index out of bounds");
+			parameters[parameter_offset + Xs_reindex[i] * 4 + j] = OPENCV_ELEM(vertex->X, j, 0);
 		}
-		Xs_i++;
 	}
-	ASSERT(Xs_i == Xs_count, "inconsistent counters");
 
 	// * input verification * 
 
@@ -1930,88 +2563,331 @@ void calibration_bundle()
 		scanf("%d", &i);
 	}*/
 
-	// * additional settings and info *
-
-	// optimization options
-	double options[SBA_OPTSSZ];
-	ASSERT(SBA_OPTSSZ > 4, "sba has fewer options than expected, this should be easy to fix");
-	memset(options, 0, sizeof(double) * SBA_OPTSSZ);
-	options[0] = SBA_INIT_MU;
-	options[1] = SBA_STOP_THRESH;
-	options[2] = SBA_STOP_THRESH;
-	options[3] = SBA_STOP_THRESH;
-	options[4] = 0;
-
-	// info
-	double info[SBA_INFOSZ];
-
 	// * call bundle adjustment routine * 
-	sba_motstr_levmar(
-		Xs_count,
-		Ps_count,
-		0,
-		visibility_mask,
-		parameters,
-		BA_CAMERA_PARAMETERS, 
-		4,
-		measurement, 
-		NULL, 
-		2, 
-		calibration_projection, 
-		NULL, 
-		NULL,
-		1000,
-		0, // verbose option
-		options, 
-		info
+	double initial_error, final_error;
+	calibration_bundle_adjust(
+		Xs_count, Ps_count, fixed_count, visibility, parameters, BA_CAMERA_PARAMETERS, 4, measurement, measurement_count, 
+		mvg_bundle_projective_projection, mvg_bundle_projective_jacobian, NULL, 
+		initial_error, final_error
 	);
 
-	printf("  Initial average squared error %f, optimized to %f.\n", info[0] / measurement_count, info[1] / measurement_count);
+	if (measurement_count > 0) 
+	{
+		printf("  Initial average squared error %f, optimized to %f.\n", initial_error / measurement_count, final_error / measurement_count);
+	}
 
 	// * save obtained estimate back into the Calibration structure *
 
-	Ps_i = 0;
 	for ALL(calibration->Ps, i)
 	{
 		const Calibration_Camera * camera = calibration->Ps.data + i;
+		ASSERT(camera->shot_id < shots.count, "invalid shot index");
+		if (shots_reindex[camera->shot_id] == SIZE_MAX) continue;
 		for (int j = 0; j < 12; j++) 
 		{
-			ASSERT(camera->shot_id < shots.count, "invalid shot index");
 			ASSERT(shots_reindex[camera->shot_id] * BA_CAMERA_PARAMETERS + j < parameters_count, "invalid parameter index");
 			OPENCV_ELEM(camera->P, j / 4, j % 4) = parameters[shots_reindex[camera->shot_id] * BA_CAMERA_PARAMETERS + j];
 		}
-		Ps_i++; 
 	}
-	ASSERT(Ps_i == Ps_count, "inconsistent counters");
 
-	Xs_i = 0; 
 	for ALL(calibration->Xs, i) 
 	{
+		if (Xs_reindex[i] == SIZE_MAX) continue;
 		const Calibration_Vertex * vertex = calibration->Xs.data + i;
 		for (int j = 0; j < 4; j++) 
 		{
-			ASSERT(parameter_offset + Xs_i * 4 + j < parameters_count, "parameters out of bounds");
-			OPENCV_ELEM(vertex->X, j, 0) = parameters[parameter_offset + Xs_i * 4 + j];
+			ASSERT(parameter_offset + Xs_reindex[i] * 4 + j < parameters_count, "parameters out of bounds");
+			OPENCV_ELEM(vertex->X, j, 0) = parameters[parameter_offset + Xs_reindex[i] * 4 + j];
+		}
+	}
+
+	// * re-evaluate inliers and outliers * 
+	calibration_update_inliers(calibration_id, tool_get_real(tool_calibration_id, CALIBRATION_IMAGE_MEASUREMENT_THRESHOLD), shots_reindex);
+
+	// * release structures *
+	FREE(parameters);
+	FREE(measurement);
+	FREE(visibility.rowptr);
+	FREE(visibility.colidx);
+	FREE(shots_reindex);
+	FREE(Xs_reindex);
+
+	opencv_end();
+}
+
+// run local bundle adjustment of given shot and (at most cameras_count - 1) calibrated 
+// shots sharing the largest number of inlying vertices with it 
+void calibration_bundle_local(const size_t calibration_id, const size_t shot_id, const int cameras_count)
+{
+	ASSERT_IS_SET(calibrations, calibration_id);
+	ASSERT(validate_shot(shot_id), "invalid shot");
+	const Calibration * const calibration = calibrations.data + calibration_id;
+	size_t * const cameras = calibration_cameras_index(calibration);
+	ASSERT(cameras[shot_id] != SIZE_MAX, "shot isn't calibrated");
+	const Calibration_Camera * const camera = calibration->Ps.data + cameras[shot_id];
+
+	// count the vertices shot shares with other cameras 
+	size_t * const shared = ALLOC(size_t, shots.count);
+	memset(shared, 0, sizeof(size_t) * shots.count);
+	for ALL(camera->points_meta, i) 
+	{
+		if (camera->points_meta.data[i].inlier != 1 || !validate_point(shot_id, i)) continue;
+		const size_t vertex_id = shots.data[shot_id].points.data[i].vertex;
+		if (!validate_vertex(vertex_id) || !IS_SET(vertices_incidence, vertex_id)) continue;
+
+		for ALL(vertices_incidence.data[vertex_id].shot_point_ids, j) 
+		{
+			const Double_Index * const index = vertices_incidence.data[vertex_id].shot_point_ids.data + j;
+			if (index->primary == shot_id || cameras[index->primary] == SIZE_MAX) continue;
+			const Calibration_Camera * const P = calibration->Ps.data + cameras[index->primary];
+			if (IS_SET(P->points_meta, index->secondary) && P->points_meta.data[index->secondary].inlier == 1) 
+			{
+				shared[index->primary]++;
+			}
+		}
+	}
+
+	// pick the neighbours with most shared vertices 
+	bool * const active = ALLOC(bool, shots.count);
+	memset(active, 0, sizeof(bool) * shots.count);
+	active[shot_id] = true;
+	for (int k = 1; k < cameras_count; k++) 
+	{
+		size_t best = SIZE_MAX; 
+		for (size_t i = 0; i < shots.count; i++) 
+		{
+			if (!active[i] && shared[i] > 0 && (best == SIZE_MAX || shared[i] > shared[best])) best = i;
+		}
+
+		if (best == SIZE_MAX) break;
+		active[best] = true;
+	}
+
+	calibration_bundle(calibration_id, active);
+
+	FREE(active);
+	FREE(shared);
+	FREE(cameras);
+}
+
+// run bundle adjustment of metric reconstruction, every camera is parametrized by its 
+// rotation, translation and focal length and vertices by their inhomogeneous coordinates 
+// (so that there are fewer parameters than in projective bundle adjustment and the 
+// normal equations are better conditioned); the remaining internal parameters stay fixed 
+void calibration_bundle_metric()
+{
+	const size_t BA_CAMERA_PARAMETERS = MVG_BUNDLE_METRIC_CAMERA_PARAMETERS;
+	const size_t BA_POINT_PARAMETERS = MVG_BUNDLE_METRIC_POINT_PARAMETERS;
+
+	opencv_begin();
+
+	// if no calibration is selected, we don't have anything to do 
+	if (!INDEX_IS_SET(ui_state.current_calibration))
+	{
+		opencv_end();
+		return;
+	}
+
+	const size_t calibration_id = ui_state.current_calibration;
+	Calibration * const calibration = calibrations.data + calibration_id;
+
+	// update calibrated flag 
+	calibration_refresh_flag(calibration_id);
+
+	// count the number of vertices and cameras
+	int Xs_count = 0, Ps_count = 0; 
+	{
+		size_t i;
+		LAMBDA(calibration->Xs, i, Xs_count++; );
+		LAMBDA(calibration->Ps, i, Ps_count++; );
+	}
+
+	// precompute index from shot_ids to order in Calibration_Cameras array 
+	size_t * shots_reindex = ALLOC(size_t, shots.count); 
+	for (size_t i = 0; i < shots.count; i++) shots_reindex[i] = SIZE_MAX;
+
+	{
+		size_t k, j = 0;
+		LAMBDA(
+			calibration->Ps, k, 
+			ASSERT(calibration->Ps.data[k].shot_id < shots.count, "invalid shot index");
+			shots_reindex[calibration->Ps.data[k].shot_id] = j++;
+		);
+	}
+
+	// * build vector of parameters *
+
+	const size_t parameters_count = Ps_count * BA_CAMERA_PARAMETERS + Xs_count * BA_POINT_PARAMETERS;
+	double * parameters = ALLOC(double, parameters_count); 
+	Mvg_Bundle_Intrinsics * intrinsics = ALLOC(Mvg_Bundle_Intrinsics, Ps_count > 0 ? Ps_count : 1);
+
+	// decompose cameras into K, R and camera center 
+	CvMat 
+		* K = opencv_create_matrix(3, 3), 
+		* R = opencv_create_matrix(3, 3), 
+		* C = opencv_create_matrix(3, 1)
+	;
+
+	for ALL(calibration->Ps, i)
+	{
+		const Calibration_Camera * const camera = calibration->Ps.data + i;
+		ASSERT(camera->shot_id < shots.count, "invalid shot index"); 
+		const size_t j = shots_reindex[camera->shot_id];
+		ASSERT(j < Ps_count, "invalid shot order index");
+
+		if (!mvg_finite_projection_matrix_decomposition(camera->P, K, R, C))
+		{
+			// we can't parametrize this camera, the reconstruction probably isn't metric 
+			printf("  Camera at infinity, metric bundle adjustment skipped.\n");
+			cvReleaseMat(&K);
+			cvReleaseMat(&R);
+			cvReleaseMat(&C);
+			FREE(intrinsics);
+			FREE(parameters);
+			FREE(shots_reindex);
+			opencv_end();
+			return;
+		}
+
+		// make focal lengths positive and R a proper rotation, the projection 
+		// matrix stays the same up to scale 
+		for (int k = 0; k < 2; k++) 
+		{
+			if (OPENCV_ELEM(K, k, k) < 0) 
+			{
+				for (int l = 0; l < 3; l++) 
+				{
+					OPENCV_ELEM(K, l, k) *= -1;
+					OPENCV_ELEM(R, k, l) *= -1;
+				}
+			}
+		}
+
+		if (cvDet(R) < 0) cvScale(R, R, -1);
+
+		// rotation and translation t = -RC
+		double r[9], * const a = parameters + j * BA_CAMERA_PARAMETERS;
+		for (int k = 0; k < 9; k++) r[k] = OPENCV_ELEM(R, k / 3, k % 3);
+		mvg_bundle_rotation_vector(r, a);
+		for (int k = 0; k < 3; k++)
+		{
+			a[3 + k] = -(
+				r[3 * k + 0] * OPENCV_ELEM(C, 0, 0) + 
+				r[3 * k + 1] * OPENCV_ELEM(C, 1, 0) + 
+				r[3 * k + 2] * OPENCV_ELEM(C, 2, 0)
+			);
+		}
+
+		// focal length and the fixed part of internal calibration 
+		const double f = OPENCV_ELEM(K, 0, 0);
+		a[6] = f;
+		intrinsics[j].aspect = OPENCV_ELEM(K, 1, 1) / f;
+		intrinsics[j].skew = OPENCV_ELEM(K, 0, 1) / f;
+		intrinsics[j].pp_x = OPENCV_ELEM(K, 0, 2);
+		intrinsics[j].pp_y = OPENCV_ELEM(K, 1, 2);
+	}
+
+	cvReleaseMat(&K);
+	cvReleaseMat(&R);
+	cvReleaseMat(&C);
+
+	// vertices at infinity can't be expressed in inhomogeneous coordinates, 
+	// they are excluded from the optimization 
+	bool * excluded = ALLOC(bool, Xs_count > 0 ? Xs_count : 1);
+	const size_t parameter_offset = Ps_count * BA_CAMERA_PARAMETERS;
+	size_t Xs_i = 0; 
+	for ALL(calibration->Xs, i) 
+	{
+		const Calibration_Vertex * const vertex = calibration->Xs.data + i;
+		const double w = OPENCV_ELEM(vertex->X, 3, 0);
+		double * const b = parameters + parameter_offset + Xs_i * BA_POINT_PARAMETERS;
+		excluded[Xs_i] = nearly_zero(w);
+		for (int j = 0; j < 3; j++) 
+		{
+			b[j] = excluded[Xs_i] ? 0 : OPENCV_ELEM(vertex->X, j, 0) / w;
 		}
 		Xs_i++;
 	}
 	ASSERT(Xs_i == Xs_count, "inconsistent counters");
 
-	// * re-evaluate inliers and outliers * 
-	for ALL(calibration->Ps, i) 
+	// gather observations 
+	sba_crsm visibility; 
+	double * measurement; 
+	const size_t measurement_count = calibration_bundle_observations(calibration, shots_reindex, NULL, Ps_count, Xs_count, excluded, visibility, measurement);
+
+	// * call bundle adjustment routine * 
+	double initial_error, final_error;
+	calibration_bundle_adjust(
+		Xs_count, Ps_count, 0, visibility, parameters, BA_CAMERA_PARAMETERS, BA_POINT_PARAMETERS, measurement, measurement_count, 
+		mvg_bundle_metric_projection, mvg_bundle_metric_jacobian, intrinsics, 
+		initial_error, final_error
+	);
+
+	if (measurement_count > 0) 
+	{
+		printf("  Initial average squared error %f, optimized to %f.\n", initial_error / measurement_count, final_error / measurement_count);
+	}
+
+	// * save obtained estimate back into the Calibration structure *
+
+	for ALL(calibration->Ps, i)
 	{
-		const Calibration_Camera * camera = calibration->Ps.data + i; 
+		const Calibration_Camera * const camera = calibration->Ps.data + i;
+		const size_t j = shots_reindex[camera->shot_id];
+		const double * const a = parameters + j * BA_CAMERA_PARAMETERS;
+
+		// P = K [R | t] 
+		double r[9];
+		mvg_bundle_rotation(a, r, NULL);
+		const double f = a[6];
+		const double k[9] = {
+			f, intrinsics[j].skew * f, intrinsics[j].pp_x, 
+			0, intrinsics[j].aspect * f, intrinsics[j].pp_y, 
+			0, 0, 1
+		};
+
+		for (int row = 0; row < 3; row++) 
+		{
+			for (int col = 0; col < 4; col++) 
+			{
+				double d = 0;
+				for (int l = 0; l < 3; l++) 
+				{
+					d += k[3 * row + l] * (col < 3 ? r[3 * l + col] : a[3 + l]);
+				}
+				OPENCV_ELEM(camera->P, row, col) = d;
+			}
+		}
+	}
 
-		// go through this cameras points 
-		// todo 
+	Xs_i = 0; 
+	for ALL(calibration->Xs, i) 
+	{
+		const Calibration_Vertex * const vertex = calibration->Xs.data + i;
+		if (!excluded[Xs_i]) 
+		{
+			const double * const b = parameters + parameter_offset + Xs_i * BA_POINT_PARAMETERS;
+			for (int j = 0; j < 3; j++) 
+			{
+				OPENCV_ELEM(vertex->X, j, 0) = b[j];
+			}
+			OPENCV_ELEM(vertex->X, 3, 0) = 1;
+		}
+		Xs_i++;
 	}
+	ASSERT(Xs_i == Xs_count, "inconsistent counters");
+
+	// * re-evaluate inliers and outliers * 
+	calibration_update_inliers(calibration_id, tool_get_real(tool_calibration_id, CALIBRATION_IMAGE_MEASUREMENT_THRESHOLD));
 
 	// * release structures *
 	FREE(parameters);
+	FREE(intrinsics);
+	FREE(excluded);
 	FREE(measurement);
-	FREE(visibility_mask);
-	FREE(vertex_visibility);
-	FREE(incidence_ids);
+	FREE(visibility.rowptr);
+	FREE(visibility.colidx);
+	FREE(shots_reindex);
 
 	opencv_end();
 }
@@ -2035,7 +2911,7 @@ void tool_calibration_bundle()
 		normalize_data = tool_get_bool(tool_calibration_id, CALIBRATION_NORMALIZE_DATA),
 		normalize_A = tool_get_bool(tool_calibration_id, CALIBRATION_NORMALIZE_A);
 
-	calibration_bundle();
+	calibration_bundle(calibration_id);
 	calibration_triangulate_vertices(calibration_id, measurement_threshold, 2, normalize_data, normalize_A);
 }
 
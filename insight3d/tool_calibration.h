@@ -33,6 +33,8 @@
 #include "mvg_normalization.h"
 #include "mvg_camera.h"
 #include "mvg_autocalibration.h"
+#include "mvg_bundle.h"
+#include "core_parallel.h"
 
 // methods
 void tool_calibration_create();
@@ -124,7 +124,9 @@ void tool_edit_erase_selected_points()
 	// prepare for deletition 
 	ui_prepare_for_deletition(true, true, true, false, false);
 
-	// delete the points 
+	// delete the points, remember vertices which lost their last point 
+	size_t * empty_vertices = ALLOC(size_t, count > 0 ? count : 1);
+	size_t empty_count = 0;
 	for (size_t i = 0; i < 2 * count; i += 2)
 	{
 		const size_t vertex_id = shots.data[ids[i + 1]].points.data[ids[i]].vertex;
@@ -138,14 +140,17 @@ void tool_edit_erase_selected_points()
 			break; 
 		}
 
-		// if it was last, delete the vertex
 		if (last) 
 		{
-			geometry_delete_vertex(vertex_id);
+			empty_vertices[empty_count++] = vertex_id;
 		}
 	}
 
+	// delete all those vertices at once 
+	geometry_delete_vertices(empty_vertices, empty_count);
+
 	// release resources 
+	FREE(empty_vertices);
 	FREE(ids);
 }
 
@@ -163,7 +168,7 @@ void tool_edit_erase_all_vertices_and_points()
 	ui_prepare_for_deletition(true, true, true, false, false);
 
 	// delete all polygons 
-	DYN_FREE(polygons);
+	geometry_release_polygons();
 
 	// delete all points
 	for ALL(shots, i) 
@@ -35,12 +35,19 @@ const size_t
 	MATCHING_RESOLUTION = 6,
 	MATCHING_SKIP_FEATURE_EXTRACTION = 7,
 	MATCHING_F_RANSAC = 8,
-	MATCHING_INCLUDE_UNVERIFIED = 9
+	MATCHING_INCLUDE_UNVERIFIED = 9,
+	MATCHING_THREADS = 10,
+	MATCHING_USE_CACHE = 11,
+	MATCHING_RETRIEVED = 12,
+	MATCHING_INDEX_TREES = 13,
+	MATCHING_INDEX_CHECKS = 14,
+	MATCHING_SYMMETRIC = 15
 	;
 
 const size_t
 	MATCHING_TOPOLOGY_UNORDERED = 0, 
-	MATCHING_TOPOLOGY_SEQUENCE = 1
+	MATCHING_TOPOLOGY_SEQUENCE = 1,
+	MATCHING_TOPOLOGY_RETRIEVAL = 2
 	;
 
 const size_t 
@@ -49,7 +56,7 @@ const size_t
 	;
 
 static const char * matching_method_labels[] = { "SIFT", "SIFT+MSER", NULL };
-static const char * matching_topology_labels[] = { "All pairs (unordered set of images)", "Just neighbours (linear sequence)", NULL };
+static const char * matching_topology_labels[] = { "All pairs (unordered set of images)", "Just neighbours (linear sequence)", "Top-K retrieved pairs (large unordered set)", NULL };
 static const char * matching_resolution_labels[] = { "medium (up to 1600px)", "high (up to 2600px)", "low (up to 1024px)", NULL }; 
 static const int matching_resolution_values[] = { 1600, 2600, 1024, NULL };
 
@@ -59,27 +66,96 @@ struct Tool_Matching
 	// at this point, we don't need any... 
 };
 
-// structures for union-find
-struct Matching_UF_Node 
-{ 
-	bool set;
-	bool root; // is this root element 
-	bool root_with_vertex; // does this root element have created vertex? (in that case the value i holds it's vertex_id)
-	size_t i; // index of parent for children, size for root nodes
+// image pair scheduled for matching together with the found matches
+struct Matching_Pair 
+{
+	size_t first_shot_id, second_shot_id; 
+	int * matches;                 // pairs of indices into the keypoints arrays of the two shots 
+	size_t matches_count;
+	bool finished;                 // matches are ready to be merged 
+};
+
+// settings and buffers shared by the threads matching image pairs
+struct Matching_Pairs_Job
+{
+	Matching_Pair * pairs;
+	size_t pairs_count;
+	double fsor_limit, epipolar_distance_threshold;
+	bool use_ransac, include_unverified, symmetric; 
+	int * * buffers;               // per-thread buffers for storing matches (each for 2 * max_features_count values)
+	volatile size_t next;          // next pair to be taken by some worker 
+	size_t merged;                 // pairs before this one are merged into tracks 
+	size_t window;                 // how many pairs may be taken ahead of the merged ones 
+	pthread_mutex_t lock;          // guards merged and finished flags of pairs 
+	pthread_cond_t finished, merged_changed;
+};
+
+// state shared by threads looking for vertices visible on some shot more than once 
+struct Matching_Conflicts_Job
+{
+	bool * conflicting;            // result for every vertex 
+	size_t * * stamps;             // per-thread stamps of shots (for shots.count shots)
 };
 
-DYNAMIC_STRUCTURE_DECLARATIONS(Matching_UF_Nodes, Matching_UF_Node);
-DYNAMIC_STRUCTURE(Matching_UF_Nodes, Matching_UF_Node);
+// how many image pairs per thread can be matched ahead of the first pair which 
+// hasn't been merged yet (limits memory held by unmerged matches)
+static const size_t MATCHING_PAIRS_PER_THREAD = 8;
+
+// size of buckets used by guided matching (in pixels)
+static const int MATCHING_BUCKET_SIZE = 50;
+
+// vocabulary tree used to retrieve similar images (branching^depth visual words 
+// trained on at most the given number of descriptors)
+static const int 
+	MATCHING_VOCABULARY_BRANCHING = 10, 
+	MATCHING_VOCABULARY_DEPTH = 4, 
+	MATCHING_VOCABULARY_SAMPLES = 100000
+	;
+
+// shot waiting for feature extraction, either with decoded image or with 
+// features loaded from cache 
+struct Matching_Extraction_Item
+{
+	size_t shot_id; 
+	IplImage * img;
+	bool use_cache;                // store extracted features into cache 
+	Features_Cache_Key cache_key;
+	Keypoints keypoints;           // features loaded from cache (if img is NULL)
+	int width, height;
+	Descriptor_Index_Parameters index_parameters;
+};
+
+// state shared by the threads extracting features 
+struct Matching_Extraction_Job
+{
+	Core_Parallel_Queue queue;     // decoded images waiting for extraction 
+	pthread_mutex_t lock;          // guards the counter below
+	pthread_cond_t processed;      // signalled whenever the counter changes 
+	size_t processed_count;        // number of shots already processed (or skipped)
+};
+
+// how many decoded images per extraction thread can wait in the queue
+static const size_t MATCHING_IMAGES_PER_THREAD = 2;
 
 static Tool_Matching tool_matching;
 static size_t tool_matching_id;
 
 // forward declarations of private routines
-void matching_extract_features(const double max_width);
-void matching_extract_tracks(const double fsor_limit, const bool use_ransac, const bool include_unverified, const double epipolar_distance_threshold, Matching_UF_Nodes & uf_nodes, const int topology, const int neighbours);
-void matching_remove_conflicting_tracks();
-size_t matching_find_parent_node(Matching_UF_Nodes & nodes, feature * first, bool & found);
-void matching_features_union(Matching_UF_Nodes & nodes, feature * first, feature * second);
+void matching_extract_features(const double max_size, const size_t threads_count, const bool use_cache, const Descriptor_Index_Parameters & index_parameters);
+bool matching_extract_shot_features(Shot * const shot, Matching_Extraction_Item * const item);
+void matching_extract_item(Matching_Extraction_Job * const job, Matching_Extraction_Item * const item);
+void matching_extract_features_job(void * arg, const size_t item, const size_t thread_id);
+size_t matching_extracted_count(Matching_Extraction_Job * const job);
+Tracks * matching_extract_tracks(const double fsor_limit, const bool use_ransac, const bool include_unverified, const bool symmetric, const double epipolar_distance_threshold, const int topology, const int neighbours, const int retrieved_count, const Descriptor_Index_Parameters & index_parameters, const size_t threads_count);
+int * matching_retrieve_similar_shots(const int retrieved_count, const size_t threads_count);
+bool matching_is_retrieved(const int * retrieved, const int retrieved_count, const size_t i, const size_t j);
+size_t matching_keep_unique(int * matches, const size_t correspondences, const size_t second_count);
+size_t matching_match_pair(const Shot * const first_shot, const Shot * const second_shot, const double fsor_limit, const bool use_ransac, const bool include_unverified, const bool symmetric, const double epipolar_distance_threshold, int * matches);
+void matching_match_pairs_job(void * arg, const size_t item, const size_t thread_id);
+void matching_match_pairs_worker(void * arg, const size_t item, const size_t thread_id);
+void matching_conflicts_job(void * arg, const size_t item, const size_t thread_id);
+void matching_remove_conflicting_tracks(const size_t threads_count);
+void matching_release_meta(Shot * const shot);
 
 // refresh lists in UI containing information modified by this tool
 void tool_matching_refresh_UI()
@@ -92,6 +168,7 @@ void tool_matching_create()
 	tool_matching_id = tool_create(UI_MODE_UNSPECIFIED, "Matching", "Automatic matching of images");
 
 	tool_register_menu_function("Main menu|Matching|Start matching|", tool_matching_standard);
+	tool_register_menu_function("Main menu|Matching|Remove conflicting tracks|", tool_matching_remove_conflicts);
 	tool_create_tab("Matching");
 
 	// tool_register_int(MATCHING_RESOLUTION, "Image size to use (px): ", 1024, 64, 4096, 256);
@@ -105,12 +182,21 @@ void tool_matching_create()
 	// tool_register_bool(MATCHING_GUIDED, "Use guided matching", 1);
 	tool_register_bool(MATCHING_F_RANSAC, "Use RANSAC filtering", 1);
 	tool_register_bool(MATCHING_INCLUDE_UNVERIFIED, "Include matches unverified by RANSAC", 0);
+	tool_register_bool(MATCHING_SYMMETRIC, "Keep only mutual matches (match each pair once)", 0);
 	tool_register_bool(MATCHING_SKIP_FEATURE_EXTRACTION, "Skip feature extraction", 0);
+	tool_register_bool(MATCHING_USE_CACHE, "Cache extracted features on disk", 1);
+	tool_register_int(MATCHING_THREADS, "Number of threads (0 = auto): ", 0, 0, 64, 1);
+	tool_register_int(MATCHING_INDEX_TREES, "Number of kd-trees (0 = exact search): ", 4, 0, 16, 1);
+	tool_register_int(MATCHING_INDEX_CHECKS, "Descriptors checked per query: ", 200, 1, 10000, 50);
 
 	tool_create_separator();
 	tool_create_label("For linear sequences:");
 	tool_register_int(MATCHING_NEIGHBOURS, "Number of neighbours: ", 2, 0, 250, 1);
 
+	tool_create_separator();
+	tool_create_label("For large unordered sets:");
+	tool_register_int(MATCHING_RETRIEVED, "Number of retrieved images: ", 10, 1, 250, 1);
+
 	tool_create_button("Start matching", tool_matching_standard);
 	// tool_create_separator();
 	// tool_create_button("Remove conflicts", tool_matching_remove_conflicts);
@@ -128,481 +214,787 @@ void tool_matching_standard()
 	const int max_size = matching_resolution_values[tool_get_enum(tool_matching_id, MATCHING_RESOLUTION)];
 	const double epipolar_distance_threshold = tool_get_real(tool_matching_id, MATCHING_IMAGE_MEASUREMENT_THRESHOLD);
 	const bool skip_feature_extraction = tool_get_bool(tool_matching_id, MATCHING_SKIP_FEATURE_EXTRACTION);
+	const bool use_cache = tool_get_bool(tool_matching_id, MATCHING_USE_CACHE);
 	const bool use_ransac = tool_get_bool(tool_matching_id, MATCHING_F_RANSAC);
 	const bool include_unverified = tool_get_bool(tool_matching_id, MATCHING_INCLUDE_UNVERIFIED);
+	const bool symmetric = tool_get_bool(tool_matching_id, MATCHING_SYMMETRIC);
 	const int topology = tool_get_enum(tool_matching_id, MATCHING_TOPOLOGY);
 	const int neighbours = tool_get_int(tool_matching_id, MATCHING_NEIGHBOURS);
+	const int retrieved_count = tool_get_int(tool_matching_id, MATCHING_RETRIEVED);
+	const size_t threads_count = core_parallel_threads_count(tool_get_int(tool_matching_id, MATCHING_THREADS));
+	Descriptor_Index_Parameters index_parameters;
+	index_parameters.trees_count = tool_get_int(tool_matching_id, MATCHING_INDEX_TREES);
+	index_parameters.checks = tool_get_int(tool_matching_id, MATCHING_INDEX_CHECKS);
 
 	// extract features
 	if (!skip_feature_extraction)
 	{
-		matching_extract_features(max_size);
+		matching_extract_features(max_size, threads_count, use_cache, index_parameters);
 	}
 
 	// perform matching and extend correspondences into full-tracks 
-	Matching_UF_Nodes uf_nodes;
-	matching_extract_tracks(fsor_limit, use_ransac, include_unverified, epipolar_distance_threshold, uf_nodes, topology, neighbours);
+	Tracks * tracks = matching_extract_tracks(fsor_limit, use_ransac, include_unverified, symmetric, epipolar_distance_threshold, topology, neighbours, retrieved_count, index_parameters, threads_count);
 
-	// take all classes of equivalence and create corresponding vertices
-	for ALL(uf_nodes, i)
+	// take all tracks and create corresponding vertices (tracks never contain 
+	// two features from the same shot, so there are no conflicts to remove)
+	size_t * track_vertices = ALLOC(size_t, tracks->nodes_count > 0 ? tracks->nodes_count : 1);
+	for (size_t node = 0; node < tracks->nodes_count; node++)
 	{
-		Matching_UF_Node * const node = uf_nodes.data + i; 
-		if (!node->root || node->i < 2) continue; 
+		track_vertices[node] = SIZE_MAX;
+		if (tracks->parent[node] != node || tracks->size[node] < 2) continue; 
 
 		// create vertex
 		size_t vertex_id; 
 		geometry_new_vertex(vertex_id);
 		vertices.data[vertex_id].vertex_type = GEOMETRY_VERTEX_AUTO;
-		node->i = vertex_id;
-		node->root_with_vertex = true;
+		track_vertices[node] = vertex_id;
 	}
 
 	// create points for vertices
 	for ALL(shots, i) 
 	{
 		const Shot * const shot = shots.data + i; 
-		if (!shot->keypoints) continue;
+		if (tracks->offsets[i + 1] == tracks->offsets[i]) continue;
 		ASSERT(shot->matching, "matching meta not defined"); 
 		Matching_Shot * meta = (Matching_Shot *)shot->matching;
 		ASSERT(meta->width > 0 && meta->height > 0, "invalid picture sizes");
 
 		// go through all features on this image
-		for (size_t f = 0; f < shot->keypoints_count; f++) 
+		for (size_t f = 0; f < shot->keypoints.count; f++) 
 		{
-			// take a look at it's root element
-			bool found = false; 
-			const size_t root_id = matching_find_parent_node(uf_nodes, shot->keypoints + f, found);
+			// take a look at it's track 
+			const size_t root = mvg_tracks_find(tracks, mvg_tracks_node(tracks, i, f));
 
-			if (found && uf_nodes.data[root_id].root_with_vertex) 
+			if (track_vertices[root] != SIZE_MAX) 
 			{
 				size_t point_id;
-				geometry_new_point(point_id, shot->keypoints[f].x / meta->width, shot->keypoints[f].y / meta->height, i, uf_nodes.data[root_id].i);
+				geometry_new_point(point_id, shot->keypoints.positions[2 * f + 0] / meta->width, shot->keypoints.positions[2 * f + 1] / meta->height, i, track_vertices[root]);
 			}
 		}
 	} 
 
-	// release meta information of all shots  
+	printf("%d matches refused, since they would join two features of the same shot\n", (int)tracks->refused_count);
+	fflush(stdout);
+
+	FREE(track_vertices);
+	mvg_tracks_release(tracks);
+
+	// release the bucket grids; the rest of meta information (image size) stays with 
+	// the keypoints and descriptor index, so that they can be reused by the next run 
+	// with feature extraction skipped 
 	for ALL(shots, i)
 	{
-		Shot * const shot = shots.data + i; 
-		if (shot->matching)
-		{
-			FREE(shot->matching);
-		}
+		Matching_Shot * const meta = (Matching_Shot *)shots.data[i].matching;
+		if (!meta) continue;
+		mvg_release_grid(meta->grid);
+		meta->grid = NULL;
 	}
 
-	// finally delete inconsistent vertices 
-	ui_empty_selection_list();
-	matching_remove_conflicting_tracks();
-
 	opencv_end();
 }
 
-/*// remove tracks occuring on a single shot more than once
+// release matching meta information of a shot 
+void matching_release_meta(Shot * const shot)
+{
+	if (!shot->matching) return;
+
+	Matching_Shot * const meta = (Matching_Shot *)shot->matching; 
+	mvg_release_grid(meta->grid);
+	FREE(shot->matching);
+	shot->matching = NULL;
+}
+
+// remove tracks occuring on a single shot more than once (matching doesn't 
+// create such tracks, but they may come from imported or edited data) 
 void tool_matching_remove_conflicts()
 {
 	ui_empty_selection_list();
-	matching_remove_conflicting_tracks();
-}*/
+	matching_remove_conflicting_tracks(core_parallel_threads_count(tool_get_int(tool_matching_id, MATCHING_THREADS)));
+}
+
+// extract features of a single shot from it's decoded image (the image is released) 
+// or take the features loaded from cache 
+bool matching_extract_shot_features(Shot * const shot, Matching_Extraction_Item * const item)
+{
+	// create new matching meta structure, since we'll regenerate the features
+	shot->matching = ALLOC(Matching_Shot, 1);
+	memset(shot->matching, 0, sizeof(Matching_Shot));
+	Matching_Shot * const meta = (Matching_Shot *)shot->matching;
+
+	if (item->img)
+	{
+		// fill in image's meta-values
+		meta->width = item->img->width;
+		meta->height = item->img->height;
+
+		// extract SIFT keypoints 
+		feature * features = NULL;
+		const int count = sift_features(item->img, &features);
+		printf("[count = %d]\n", count);
+		fflush(stdout);
+		cvReleaseImage(&item->img);
+
+		// keep just their positions and descriptors (SIFT descriptors are integers from 0 to 255)
+		geometry_keypoints_allocate(shot->keypoints, count);
+		for (int j = 0; j < count; j++)
+		{
+			ASSERT(features[j].d == GEOMETRY_DESCRIPTOR_LENGTH, "unexpected descriptor length");
+			shot->keypoints.positions[2 * j + 0] = features[j].x;
+			shot->keypoints.positions[2 * j + 1] = features[j].y;
+
+			unsigned char * const descriptor = shot->keypoints.descriptors + j * GEOMETRY_DESCRIPTOR_LENGTH;
+			for (int l = 0; l < GEOMETRY_DESCRIPTOR_LENGTH; l++)
+			{
+				descriptor[l] = (unsigned char)features[j].descr[l];
+			}
+		}
+
+		if (features) free(features);
+
+		// save them for the next time
+		if (item->use_cache && !geometry_features_cache_save(shot->image_filename, item->cache_key, shot->keypoints, meta->width, meta->height))
+		{
+			printf("failed to save features into cache\n");
+		}
+	}
+	else
+	{
+		meta->width = item->width; 
+		meta->height = item->height; 
+		shot->keypoints = item->keypoints; 
+		printf("[count = %d, cached]\n", shot->keypoints.count);
+		fflush(stdout);
+	}
+
+	// build index for searching descriptors 
+	shot->descriptor_index = mvg_descriptor_index_build(shot->keypoints, item->index_parameters);
+
+	// if indexing failed, we release everything and mark as unmatched
+	if (!shot->descriptor_index)
+	{
+		matching_release_meta(shot);
+		geometry_keypoints_release(shot->keypoints);
+		TOOL_PARTIAL_FAIL("Failed to build descriptor index", return false);
+	}
+
+	return true;
+}
+
+// extract features of one decoded image and report it as processed
+void matching_extract_item(Matching_Extraction_Job * const job, Matching_Extraction_Item * const item)
+{
+	matching_extract_shot_features(shots.data + item->shot_id, item);
+	FREE(item);
+
+	pthread_mutex_lock(&job->lock);
+	job->processed_count++;
+	pthread_cond_signal(&job->processed);
+	pthread_mutex_unlock(&job->lock);
+}
+
+// extraction thread, processes decoded images until the queue is closed 
+void matching_extract_features_job(void * arg, const size_t item, const size_t thread_id)
+{
+	Matching_Extraction_Job * const job = (Matching_Extraction_Job *)arg; 
+
+	void * decoded; 
+	while (core_parallel_queue_pop(&job->queue, &decoded))
+	{
+		matching_extract_item(job, (Matching_Extraction_Item *)decoded);
+	}
+}
+
+// number of shots whose features are already extracted
+size_t matching_extracted_count(Matching_Extraction_Job * const job) 
+{
+	pthread_mutex_lock(&job->lock);
+	const size_t processed_count = job->processed_count; 
+	pthread_mutex_unlock(&job->lock);
+	return processed_count;
+}
 
 // extract features 
-// todo delete existing keypoints on relevant images
-void matching_extract_features(const double max_size)
+// this thread decodes images (or loads cached features) and passes them through 
+// a bounded queue to the extraction threads, which run SIFT and build descriptor indices; 
+// the queue limits how many decoded images are held in memory at once
+void matching_extract_features(const double max_size, const size_t threads_count, const bool use_cache, const Descriptor_Index_Parameters & index_parameters)
 {
 	// extract keypoints from all images 
 	debug("extracting keypoints");
 
-	for ALL(shots, i)
-
-	double progress; 
+	// delete all previous information, if any 
 	size_t shots_count = 0; 
 	for ALL(shots, i)
 	{
+		Shot * const shot = shots.data + i; 
+		matching_release_meta(shot);
+		geometry_keypoints_release(shot->keypoints);
+		mvg_descriptor_index_release(shot->descriptor_index);
+		shot->descriptor_index = NULL;
 		shots_count++;
 	}
 
 	tool_start_progressbar(); 
 
-	int shot_no = 0;
+	// start extraction threads, if none of them can be started, we do everything here
+	Matching_Extraction_Job job; 
+	core_parallel_queue_initialize(&job.queue, MATCHING_IMAGES_PER_THREAD * threads_count);
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_cond_init(&job.processed, NULL);
+	job.processed_count = 0; 
+	Core_Parallel_Threads threads; 
+	const bool parallel = core_parallel_start(&threads, threads_count, matching_extract_features_job, &job) > 0;
+
+	// decode the pictures 
 	for ALL(shots, i)
 	{
-		shot_no++;
-
 		Shot * const shot = shots.data + i; 
 		debug(shot->image_filename);
 
-		// delete all previous information, if any 
-		if (shot->matching) { FREE(shot->matching); shot->matching = NULL; }
-		if (shot->keypoints) { free(shot->keypoints); shot->keypoints = NULL; shot->keypoints_count = 0; }
-		if (shot->kd_tree) { kdtree_release(shot->kd_tree); shot->kd_tree = NULL; }
-
 		// update progressbar
-		tool_show_progress((shot_no - 1) * (1.0 / shots_count));
+		tool_show_progress(matching_extracted_count(&job) * (1.0 / shots_count));
+
+		Matching_Extraction_Item * const item = ALLOC(Matching_Extraction_Item, 1);
+		memset(item, 0, sizeof(Matching_Extraction_Item));
+		item->shot_id = i; 
+		item->cache_key.max_size = (int)max_size;
+		item->index_parameters = index_parameters;
+
+		// try the cache first 
+		item->use_cache = use_cache && geometry_features_cache_key(shot->image_filename, item->cache_key);
+		const bool cached = item->use_cache && geometry_features_cache_load(
+			shot->image_filename, item->cache_key, item->keypoints, item->width, item->height
+		);
 
 		// load the picture
-		IplImage * img = opencv_load_image(shot->image_filename, (int)max_size);
-		if (!img)
+		if (!cached)
+		{
+			item->img = opencv_load_image(shot->image_filename, (int)max_size);
+			if (!item->img)
+			{
+				FREE(item);
+				pthread_mutex_lock(&job.lock);
+				job.processed_count++;
+				pthread_mutex_unlock(&job.lock);
+				TOOL_PARTIAL_FAIL("Cannot load image from disk", continue);
+			}
+		}
+
+		// hand it over 
+		if (parallel) 
 		{
-			TOOL_PARTIAL_FAIL("Cannot load image from disk", continue);
+			core_parallel_queue_push(&job.queue, item);
 		}
+		else
+		{
+			matching_extract_item(&job, item);
+		}
+	}
 
-		// create new matching meta structure, since we'll regenerate the features
-		shot->matching = ALLOC(Matching_Shot, 1);
-		memset(shot->matching, 0, sizeof(Matching_Shot));
+	// wait for extraction threads to finish the remaining pictures, progress 
+	// is updated whenever some of them is done 
+	core_parallel_queue_close(&job.queue);
+	pthread_mutex_lock(&job.lock);
+	while (job.processed_count < shots_count)
+	{
+		pthread_cond_wait(&job.processed, &job.lock);
+		const size_t processed_count = job.processed_count;
+		pthread_mutex_unlock(&job.lock);
+		tool_show_progress(processed_count * (1.0 / shots_count));
+		pthread_mutex_lock(&job.lock);
+	}
+	pthread_mutex_unlock(&job.lock);
 
-		// fill in image's meta-values
-		Matching_Shot * const meta = (Matching_Shot *)shot->matching;
-		meta->width = img->width;
-		meta->height = img->height;
+	core_parallel_join(&threads);
+	core_parallel_queue_release(&job.queue);
+	pthread_cond_destroy(&job.processed);
+	pthread_mutex_destroy(&job.lock);
 
-		// extract SIFT keypoints
-		shot->keypoints_count = sift_features(img, &shot->keypoints);
-		printf("[count = %d]\n", shot->keypoints_count);
-		fflush(stdout);
+	tool_end_progressbar();
+}
+
+// drop matches whose keypoint in the second image is matched more than once
+size_t matching_keep_unique(int * matches, const size_t correspondences, const size_t second_count)
+{
+	int * const used = ALLOC(int, second_count > 0 ? second_count : 1);
+	memset(used, 0, sizeof(int) * second_count);
+	for (size_t k = 0; k < correspondences; k++)
+	{
+		used[matches[2 * k + 1]]++;
+	}
 
-		// build kd tree
-		shot->kd_tree = kdtree_build(shot->keypoints, shot->keypoints_count);
+	size_t unique = 0;
+	for (size_t k = 0; k < correspondences; k++)
+	{
+		if (used[matches[2 * k + 1]] != 1) continue;
+		matches[2 * unique + 0] = matches[2 * k + 0];
+		matches[2 * unique + 1] = matches[2 * k + 1];
+		unique++;
+	}
+
+	FREE(used);
+	return unique;
+}
+
+// match one image pair, the matches are stored into matches buffer (which has to be
+// large enough to hold 2 * max_features_count values) as pairs of indices into the
+// keypoints arrays of both shots; shots are only read, so that pairs can be matched
+// concurrently; symmetric matching keeps only mutual nearest neighbours and one-to-one 
+// guided matches, so that the pair doesn't have to be matched in the opposite direction
+size_t matching_match_pair(const Shot * const first_shot, const Shot * const second_shot, const double fsor_limit, const bool use_ransac, const bool include_unverified, const bool symmetric, const double epipolar_distance_threshold, int * matches)
+{
+	const double fsor_limit_sq = fsor_limit * fsor_limit;
+	const Matching_Shot * const first_meta = (Matching_Shot *)first_shot->matching;
+	const Matching_Shot * const second_meta = (Matching_Shot *)second_shot->matching;
+	const Keypoints & first_keypoints = first_shot->keypoints, & second_keypoints = second_shot->keypoints;
+
+	// query all keypoints of the first image at once against the index of the second image 
+	int 
+		* const neighbours = ALLOC(int, 2 * first_keypoints.count), 
+		* const distances = ALLOC(int, 2 * first_keypoints.count),
+		* const found = ALLOC(int, first_keypoints.count)
+	;
+
+	mvg_descriptor_index_knn(second_shot->descriptor_index, first_keypoints.descriptors, first_keypoints.count, 2, neighbours, distances, found);
+
+	// in symmetric mode, find the nearest neighbours in the opposite direction too
+	int * backward = NULL, * backward_distances = NULL, * backward_found = NULL; 
+	if (symmetric) 
+	{
+		backward = ALLOC(int, second_keypoints.count);
+		backward_distances = ALLOC(int, second_keypoints.count);
+		backward_found = ALLOC(int, second_keypoints.count);
+		mvg_descriptor_index_knn(first_shot->descriptor_index, second_keypoints.descriptors, second_keypoints.count, 1, backward, backward_distances, backward_found);
+	}
+
+	// keep the distinctive ones (and mutual, if required)
+	size_t correspondences = 0;
+	for (size_t keypoint = 0; keypoint < first_keypoints.count; keypoint++)
+	{
+		if (found[keypoint] != 2 || distances[2 * keypoint + 0] >= fsor_limit_sq * distances[2 * keypoint + 1]) continue;
 
-		// if kd-tree failed, we release everything and mark as unmatched
-		if (!shot->kd_tree)
+		const int neighbour = neighbours[2 * keypoint + 0];
+		if (!symmetric || (backward_found[neighbour] == 1 && backward[neighbour] == (int)keypoint))
 		{
-			FREE(shot->matching);
-			shot->matching = NULL;
-			free(shot->keypoints); 
-			shot->keypoints = NULL; 
-			shot->keypoints_count = 0;
-			cvReleaseImage(&img);
-			TOOL_PARTIAL_FAIL("Failed to build kd-tree", continue);
+			matches[2 * correspondences + 0] = keypoint;
+			matches[2 * correspondences + 1] = neighbour;
+			correspondences++;
 		}
+	}
+
+	FREE(found);
+	FREE(distances);
+	FREE(neighbours);
+	if (symmetric) 
+	{
+		FREE(backward_found);
+		FREE(backward_distances);
+		FREE(backward);
+	}
+
+	// optional RANSAC filtering
+	if (use_ransac && correspondences >= 18)
+	{
+		// allocate structures
+		CvMat * first_points = cvCreateMat(2, correspondences, CV_64F), * second_points = cvCreateMat(2, correspondences, CV_64F);
+		CvMat * status = cvCreateMat(1, correspondences, CV_8U);
+		cvZero(status);
+		CvMat * F = cvCreateMat(3, 3, CV_64F);
+
+		// fill in the data
+		for (size_t k = 0; k < correspondences; k++)
+		{
+			const double
+				* const first_position = first_keypoints.positions + 2 * matches[2 * k + 0],
+				* const second_position = second_keypoints.positions + 2 * matches[2 * k + 1];
+
+			OPENCV_ELEM(first_points, 0, k) = first_position[0] / first_meta->width * first_shot->width;
+			OPENCV_ELEM(first_points, 1, k) = first_position[1] / first_meta->height * first_shot->height;
+			OPENCV_ELEM(second_points, 0, k) = second_position[0] / second_meta->width * second_shot->width;
+			OPENCV_ELEM(second_points, 1, k) = second_position[1] / second_meta->height * second_shot->height;
+		}
+
+		// calculate the fundamental matrix
+		cvFindFundamentalMat(first_points, second_points, F, CV_FM_RANSAC, epipolar_distance_threshold, 0.99, status);
 
-		// clear user defined pointer of all features
-		for (size_t j = 0; j < shot->keypoints_count; j++)
+		// improve the number of correspondences using guided matching
+		correspondences = mvg_guided_matching(
+			first_keypoints, first_shot->width, first_shot->height, first_shot->width / (double)first_meta->width,
+			second_keypoints, second_meta->grid, second_shot->width, second_shot->height, second_shot->width / (double)second_meta->width,
+			F,
+			epipolar_distance_threshold,
+			fsor_limit,
+			matches
+		);
+
+		if (symmetric) 
 		{
-			shot->keypoints[j].feature_data = NULL;
+			correspondences = matching_keep_unique(matches, correspondences, second_keypoints.count);
 		}
 
-		// release resources 
-		cvReleaseImage(&img);
+		cvReleaseMat(&first_points);
+		cvReleaseMat(&second_points);
+		cvReleaseMat(&status);
+		cvReleaseMat(&F);
+
+		return correspondences;
+	}
+	else if (!use_ransac || include_unverified)
+	{
+		// keep all correspondences
+		// note we could also remove these altogether
+		return correspondences;
 	}
 
-	tool_end_progressbar();
+	return 0;
 }
 
-// extract tracks
-void matching_extract_tracks(const double fsor_limit, const bool use_ransac, const bool include_unverified, const double epipolar_distance_threshold, Matching_UF_Nodes & uf_nodes, const int topology, const int neighbours)
+// match one scheduled image pair, called from worker threads
+void matching_match_pairs_job(void * arg, const size_t item, const size_t thread_id)
 {
-	const double fsor_limit_sq = fsor_limit * fsor_limit;
+	Matching_Pairs_Job * const job = (Matching_Pairs_Job *)arg;
+	Matching_Pair * const pair = job->pairs + item;
+	int * const buffer = job->buffers[thread_id];
+
+	pair->matches_count = matching_match_pair(
+		shots.data + pair->first_shot_id,
+		shots.data + pair->second_shot_id,
+		job->fsor_limit,
+		job->use_ransac,
+		job->include_unverified,
+		job->symmetric,
+		job->epipolar_distance_threshold,
+		buffer
+	);
+
+	// move the result out of the thread's buffer, so that it can be merged later
+	pair->matches = NULL;
+	if (pair->matches_count > 0)
+	{
+		pair->matches = ALLOC(int, 2 * pair->matches_count);
+		memcpy(pair->matches, buffer, 2 * pair->matches_count * sizeof(int));
+	}
+}
 
-	DYN_INIT(uf_nodes);
+// worker thread matching image pairs; takes the next pair from the shared cursor, 
+// but doesn't run more than job->window pairs ahead of the merging thread
+void matching_match_pairs_worker(void * arg, const size_t item, const size_t thread_id)
+{
+	Matching_Pairs_Job * const job = (Matching_Pairs_Job *)arg;
 
-	// find maximum number of detected features
-	int max_features_count = 0; 
-	for ALL(shots, i) 
+	while (true)
 	{
-		if (max_features_count < shots.data[i].keypoints_count)
+		const size_t p = core_parallel_fetch_and_add(&job->next, 1);
+		if (p >= job->pairs_count) return;
+
+		pthread_mutex_lock(&job->lock);
+		while (p >= job->merged + job->window)
 		{
-			max_features_count = shots.data[i].keypoints_count;
+			pthread_cond_wait(&job->merged_changed, &job->lock);
 		}
+		pthread_mutex_unlock(&job->lock);
+
+		matching_match_pairs_job(job, p, thread_id);
+
+		pthread_mutex_lock(&job->lock);
+		job->pairs[p].finished = true;
+		pthread_cond_signal(&job->finished);
+		pthread_mutex_unlock(&job->lock);
+	}
+}
+
+// find similar shots for every shot using vocabulary tree, returns shots.count x retrieved_count 
+// array with ids of retrieved shots (padded by -1)
+int * matching_retrieve_similar_shots(const int retrieved_count, const size_t threads_count)
+{
+	// take all shots with extracted features 
+	const Keypoints * * keypoints = ALLOC(const Keypoints *, shots.count > 0 ? shots.count : 1);
+	size_t * shot_ids = ALLOC(size_t, shots.count > 0 ? shots.count : 1);
+	int images_count = 0;
+	for ALL(shots, i)
+	{
+		if (!shots.data[i].descriptor_index) continue;
+		keypoints[images_count] = &shots.data[i].keypoints;
+		shot_ids[images_count] = i;
+		images_count++;
 	}
 
-	if (max_features_count == 0) return;
+	// train the vocabulary and query it with every shot
+	printf("building vocabulary tree\n");
+	fflush(stdout);
+	Vocabulary * vocabulary = mvg_vocabulary_build(keypoints, images_count, MATCHING_VOCABULARY_BRANCHING, MATCHING_VOCABULARY_DEPTH, MATCHING_VOCABULARY_SAMPLES, threads_count);
+	int * similar = ALLOC(int, images_count > 0 ? images_count * retrieved_count : 1);
+	mvg_retrieve_similar(vocabulary, keypoints, images_count, retrieved_count, similar, threads_count);
 
-	// allocate memory to store matches 
-	int * matches = ALLOC(int, 2 * max_features_count);
+	// translate the results into shot ids 
+	int * retrieved = ALLOC(int, shots.count > 0 ? shots.count * retrieved_count : 1);
+	for (size_t i = 0; i < shots.count * retrieved_count; i++)
+	{
+		retrieved[i] = -1;
+	}
 
-	// count image pairs 
-	size_t image_pairs_count = 0; 
-	for ALL(shots, i) 
+	for (int i = 0; i < images_count; i++)
 	{
-		for ALL(shots, j) 
+		for (int k = 0; k < retrieved_count; k++)
 		{
-			image_pairs_count++; 
+			const int image = similar[i * retrieved_count + k];
+			retrieved[shot_ids[i] * retrieved_count + k] = image >= 0 ? (int)shot_ids[image] : -1;
 		}
 	}
 
-	// match all image-pairs 
-	tool_start_progressbar();
-	int ith = 0;
-	size_t image_pair_no = 0;
-	for ALL(shots, i) 
+	mvg_vocabulary_release(vocabulary);
+	FREE(similar);
+	FREE(shot_ids);
+	FREE(keypoints);
+	return retrieved;
+}
+
+// should this pair be matched, i.e., was one of the shots retrieved for the other one
+bool matching_is_retrieved(const int * retrieved, const int retrieved_count, const size_t i, const size_t j)
+{
+	for (int k = 0; k < retrieved_count; k++)
 	{
-		printf("matching");
-		fflush(stdout);
-		ith++;
-		Shot * const first_shot = shots.data + i; 
-		if (!first_shot->kd_tree) continue;
-		ASSERT(first_shot->matching, "metadata not loaded");
-		Matching_Shot * first_meta = (Matching_Shot *)first_shot->matching;
-
-		int jth = 0;
-		for ALL(shots, j) 
-		{
-			jth++;
-			image_pair_no++;
-			tool_show_progress((image_pair_no - 1) * (1.0 / image_pairs_count));
-			// printf("%f(%d, %d) ", (image_pair_no - 1) / (1.0 / image_pairs_count), image_pair_no, image_pairs_count);
-
-			if (topology == MATCHING_TOPOLOGY_SEQUENCE && abs(ith - jth) > neighbours) continue;
-			if (i == j) continue; 
-			Shot * const second_shot = shots.data + j;
-			if (!second_shot->kd_tree) continue; 
-			Matching_Shot * second_meta = (Matching_Shot *)second_shot->matching;
-
-			// consider all keypoints in the first image and match them against keypoints from the second image 
-			double * debug_dist = ALLOC(double, 2 * first_shot->keypoints_count);
-			size_t correspondences = 0;
-			printf("{");
-			fflush(stdout);
-			for (size_t keypoint = 0; keypoint < first_shot->keypoints_count; keypoint++)
-			// for (size_t tries = 0; tries < 2000; tries++) // todo this causes overflow because the number of matches can now be greater that the number of features 
-			{
-				// size_t keypoint = rand() % first_shot->keypoints_count;
+		if (retrieved[i * retrieved_count + k] == (int)j || retrieved[j * retrieved_count + k] == (int)i) return true;
+	}
 
-				feature * first_feature = first_shot->keypoints + keypoint;
-				feature ** neighbours; 
-				const int found = kdtree_bbf_knn(second_shot->kd_tree, first_feature, 2, &neighbours, 200);
+	return false;
+}
 
-				if (found == 2) 
-				{
-					const double 
-						d1 = descr_dist_sq(first_feature, neighbours[0]), 
-						d2 = descr_dist_sq(first_feature, neighbours[1])
-					; 
-
-					if (d1 < fsor_limit_sq * d2)
-					{
-						matches[2 * correspondences + 0] = keypoint;
-						matches[2 * correspondences + 1] = neighbours[0] - second_shot->keypoints;
-						debug_dist[2 * keypoint + 0] = d1;
-						debug_dist[2 * keypoint + 1] = d2;
-						correspondences++;
-					}
-				}
-			}
-			printf("}");
-			fflush(stdout);
+// extract tracks
+Tracks * matching_extract_tracks(const double fsor_limit, const bool use_ransac, const bool include_unverified, const bool symmetric, const double epipolar_distance_threshold, const int topology, const int neighbours, const int retrieved_count, const Descriptor_Index_Parameters & index_parameters, const size_t threads_count)
+{
+	// every keypoint of shots which will be matched starts as a singleton track 
+	size_t * features_counts = ALLOC(size_t, shots.count > 0 ? shots.count : 1);
+	int max_features_count = 0;
+	for (size_t i = 0; i < shots.count; i++)
+	{
+		features_counts[i] = 0;
+		if (!IS_SET(shots, i) || !shots.data[i].descriptor_index) continue;
+		features_counts[i] = shots.data[i].keypoints.count;
+		if (max_features_count < shots.data[i].keypoints.count)
+		{
+			max_features_count = shots.data[i].keypoints.count;
+		}
+	}
 
-			// optional RANSAC filtering 
-			if (use_ransac && correspondences >= 18) 
-			{
-				// allocate structures
-				CvMat * first_points = cvCreateMat(2, correspondences, CV_64F), * second_points = cvCreateMat(2, correspondences, CV_64F);
-				CvMat * status = cvCreateMat(1, correspondences, CV_8U);
-				cvZero(status);
-				CvMat * F = cvCreateMat(3, 3, CV_64F);
-
-				// fill in the data
-				for (size_t k = 0; k < correspondences; k++) 
-				{
-					feature 
-						* const first_feature = first_shot->keypoints + matches[2 * k + 0],
-						* const second_feature = second_shot->keypoints + matches[2 * k + 1];
-
-					OPENCV_ELEM(first_points, 0, k) = first_feature->x / first_meta->width * first_shot->width;
-					OPENCV_ELEM(first_points, 1, k) = first_feature->y / first_meta->height * first_shot->height;
-					OPENCV_ELEM(second_points, 0, k) = second_feature->x / second_meta->width * second_shot->width;
-					OPENCV_ELEM(second_points, 1, k) = second_feature->y / second_meta->height * second_shot->height;
-				}
+	Tracks * const tracks = mvg_tracks_create(features_counts, shots.count);
+	FREE(features_counts);
+	if (max_features_count == 0) return tracks;
 
-				// calculate the fundamental matrix
-				cvFindFundamentalMat(first_points, second_points, F, CV_FM_RANSAC, epipolar_distance_threshold, 0.99, status);
+	// if guided matching is used, sort keypoints into buckets once for all pairs; 
+	// descriptor indices are shared by all pairs too 
+	for ALL(shots, i)
+	{
+		Shot * const shot = shots.data + i; 
+		if (!shot->descriptor_index) continue;
+		ASSERT(shot->matching, "metadata not loaded");
+		Matching_Shot * const meta = (Matching_Shot *)shot->matching;
 
-				// export into om, calculate average translation
-				int * om = ALLOC(int, first_shot->keypoints_count);
-				double tx = 0, ty = 0;
-				size_t inliers_count = 0;
-				memset(om, -1, first_shot->keypoints_count * sizeof(int));
-				for (size_t k = 0; k < correspondences; k++) 
-				{
-					if (CV_MAT_ELEM(*status, signed char, 0, k) == 1)
-					{
-						om[matches[2 * k + 0]] = matches[2 * k + 1]; 
-						tx += first_shot->keypoints[matches[2 * k + 0]].x - second_shot->keypoints[matches[2 * k + 1]].x;
-						ty += first_shot->keypoints[matches[2 * k + 0]].y - second_shot->keypoints[matches[2 * k + 1]].y;
-						inliers_count++;
-					}
-				}
+		// if feature extraction was skipped, the index might have different parameters 
+		if (shot->descriptor_index->parameters.trees_count != index_parameters.trees_count)
+		{
+			mvg_descriptor_index_release(shot->descriptor_index);
+			shot->descriptor_index = mvg_descriptor_index_build(shot->keypoints, index_parameters);
+			ASSERT(shot->descriptor_index, "failed to rebuild descriptor index");
+		}
 
-				tx *= (second_shot->width / (double)second_meta->width) / inliers_count;
-				ty *= (second_shot->width / (double)second_meta->width) / inliers_count;
+		shot->descriptor_index->parameters.checks = index_parameters.checks;
 
-				// duplicate the features 
-				feature
-					* features1_copy = ALLOC(feature, first_shot->keypoints_count),
-					* features2_copy = ALLOC(feature, second_shot->keypoints_count)
-				;
+		mvg_release_grid(meta->grid);
+		meta->grid = use_ransac ? mvg_build_grid(shot->keypoints, shot->width / (double)meta->width, shot->width, shot->height, MATCHING_BUCKET_SIZE) : NULL;
+	}
 
-				memcpy(features1_copy, first_shot->keypoints, sizeof(feature) * first_shot->keypoints_count); 
-				memcpy(features2_copy, second_shot->keypoints, sizeof(feature) * second_shot->keypoints_count); 
+	// for large sets, match only pairs of similar shots 
+	int * retrieved = topology == MATCHING_TOPOLOGY_RETRIEVAL ? matching_retrieve_similar_shots(retrieved_count, threads_count) : NULL;
 
-				for (size_t k = 0; k < first_shot->keypoints_count; k++)
-				{
-					features1_copy[k].feature_data = (void *)(first_shot->keypoints + k);
-				}
+	// schedule image pairs (in the same order in which they would be matched serially), 
+	// first pass only counts them; symmetric matching needs each unordered pair only once 
+	Matching_Pair * pairs = NULL;
+	size_t pairs_count = 0;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		if (pass == 1) 
+		{
+			pairs = ALLOC(Matching_Pair, pairs_count > 0 ? pairs_count : 1);
+			pairs_count = 0;
+		}
 
-				for (size_t k = 0; k < second_shot->keypoints_count; k++)
-				{
-					features2_copy[k].feature_data = (void *)(second_shot->keypoints + k);
-				}
+		int ith = 0;
+		for ALL(shots, i)
+		{
+			ith++;
+			const Shot * const first_shot = shots.data + i;
+			if (!first_shot->descriptor_index) continue;
+			ASSERT(first_shot->matching, "metadata not loaded");
 
-				// improve the number of correspondences using guided matching 
-				printf("[");
-				fflush(stdout);
-				correspondences = mvg_guided_matching(
-					features1_copy, first_shot->keypoints_count, first_shot->width, first_shot->height, first_shot->width / (double)first_meta->width, 
-					features2_copy, second_shot->keypoints_count, second_shot->width, second_shot->height, second_shot->width / (double)second_meta->width, 
-					F,
-					epipolar_distance_threshold,
-					fsor_limit,
-					matches
-				);
-				/*correspondences = mvg_guided_matching_translation(
-					features1_copy, first_shot->keypoints_count, first_shot->width, first_shot->height, first_shot->width / (double)first_meta->width, 
-					features2_copy, second_shot->keypoints_count, second_shot->width, second_shot->height, second_shot->width / (double)second_meta->width, 
-					tx, ty,
-					100,
-					fsor_limit,
-					matches
-				);*/
-				printf("]");
-				fflush(stdout);
-
-				// save inliers
-				for (size_t k = 0; k < correspondences; k++) 
+			int jth = 0;
+			for ALL(shots, j)
+			{
+				jth++;
+				if (topology == MATCHING_TOPOLOGY_SEQUENCE && abs(ith - jth) > neighbours) continue;
+				if (i == j || (symmetric && j < i)) continue;
+				if (retrieved && !matching_is_retrieved(retrieved, retrieved_count, i, j)) continue;
+				const Shot * const second_shot = shots.data + j;
+				if (!second_shot->descriptor_index) continue;
+				ASSERT(second_shot->matching, "metadata not loaded");
+
+				if (pass == 1)
 				{
-					matching_features_union(
-						uf_nodes, 
-						(feature *)(features1_copy[matches[2 * k + 0]].feature_data), 
-						(feature *)(features2_copy[matches[2 * k + 1]].feature_data)
-					);
+					pairs[pairs_count].first_shot_id = i;
+					pairs[pairs_count].second_shot_id = j;
+					pairs[pairs_count].matches = NULL;
+					pairs[pairs_count].matches_count = 0;
+					pairs[pairs_count].finished = false;
 				}
-
-				FREE(features1_copy);
-				FREE(features2_copy);
+				pairs_count++;
 			}
-			else if (!use_ransac || include_unverified)
+		}
+	}
+
+	// allocate per-thread memory to store matches
+	Matching_Pairs_Job job;
+	job.pairs = pairs;
+	job.pairs_count = pairs_count;
+	job.fsor_limit = fsor_limit;
+	job.epipolar_distance_threshold = epipolar_distance_threshold;
+	job.use_ransac = use_ransac;
+	job.include_unverified = include_unverified;
+	job.symmetric = symmetric;
+	job.buffers = ALLOC(int *, threads_count);
+	for (size_t t = 0; t < threads_count; t++)
+	{
+		job.buffers[t] = ALLOC(int, 2 * max_features_count);
+	}
+	job.next = 0;
+	job.merged = 0;
+	job.window = MATCHING_PAIRS_PER_THREAD * threads_count;
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_cond_init(&job.finished, NULL);
+	pthread_cond_init(&job.merged_changed, NULL);
+
+	// worker threads match image pairs while this thread merges them into tracks 
+	// in the scheduled order, so that the result doesn't depend on the number of 
+	// threads; if no worker can be started, pairs are matched here
+	printf("matching %d image pairs using %d threads (%s descriptor kernels)\n", (int)pairs_count, (int)threads_count, mvg_descriptor_kernels_name());
+	fflush(stdout);
+	tool_start_progressbar();
+	Core_Parallel_Threads threads; 
+	const bool parallel = core_parallel_start(&threads, threads_count, matching_match_pairs_worker, &job) > 0;
+	for (size_t p = 0; p < pairs_count; p++)
+	{
+		Matching_Pair * const pair = pairs + p;
+		if (parallel)
+		{
+			pthread_mutex_lock(&job.lock);
+			while (!pair->finished)
 			{
-				// save all correspondences
-				// note we could also remove these altogether
-				for (size_t k = 0; k < 2 * correspondences; k += 2) 
-				{
-					matching_features_union(uf_nodes, first_shot->keypoints + matches[k + 0], second_shot->keypoints + matches[k + 1]);
-				}
+				pthread_cond_wait(&job.finished, &job.lock);
 			}
+			pthread_mutex_unlock(&job.lock);
+		}
+		else
+		{
+			matching_match_pairs_job(&job, p, 0);
+		}
 
+		// save inliers
+		for (size_t k = 0; k < 2 * pair->matches_count; k += 2)
+		{
+			mvg_tracks_union(
+				tracks, 
+				mvg_tracks_node(tracks, pair->first_shot_id, pair->matches[k + 0]), 
+				mvg_tracks_node(tracks, pair->second_shot_id, pair->matches[k + 1])
+			);
 		}
 
-		printf("\n");
-		fflush(stdout);
+		if (pair->matches) FREE(pair->matches);
+
+		// let the workers move on 
+		pthread_mutex_lock(&job.lock);
+		job.merged = p + 1;
+		pthread_cond_broadcast(&job.merged_changed);
+		pthread_mutex_unlock(&job.lock);
+
+		tool_show_progress((p + 1) * (1.0 / pairs_count));
 	}
 
+	core_parallel_join(&threads);
+	pthread_cond_destroy(&job.merged_changed);
+	pthread_cond_destroy(&job.finished);
+	pthread_mutex_destroy(&job.lock);
 	tool_end_progressbar();
 
-	// release memory 
-	FREE(matches);
+	// release memory
+	for (size_t t = 0; t < threads_count; t++)
+	{
+		FREE(job.buffers[t]);
+	}
+	FREE(job.buffers);
+	FREE(pairs);
+	if (retrieved) FREE(retrieved);
+
+	return tracks;
 }
 
-// remove tracks occuring on a single shot more than once
-void matching_remove_conflicting_tracks()
+// find out if the vertex is visible on some shot more than once, called from worker threads 
+void matching_conflicts_job(void * arg, const size_t item, const size_t thread_id)
 {
-	// create array used to count occurences 
-	bool * is_there = ALLOC(bool, shots.count);
-
-	// go through all vertices 
-	for ALL(vertices_incidence, i) 
+	Matching_Conflicts_Job * const job = (Matching_Conflicts_Job *)arg;
+	job->conflicting[item] = false;
+	if (!IS_SET(vertices_incidence, item)) return;
+
+	// shot is already used by this vertex if it's stamped with the vertex's 
+	// id, so the stamps never have to be cleared 
+	size_t * const stamps = job->stamps[thread_id];
+	const size_t stamp = item + 1;
+	const Vertex_Incidence * const incidence = vertices_incidence.data + item; 
+	for ALL(incidence->shot_point_ids, j)
 	{
-		const Vertex_Incidence * const incidence = vertices_incidence.data + i; 
+		const size_t shot_id = incidence->shot_point_ids.data[j].primary; 
+		ASSERT(shot_id < shots.count, "incidence refers to invalid shot");
 
-		// for every vertex, check it's validity 
-		memset(is_there, 0, sizeof(bool) * shots.count);
-		bool valid = true; 
-		for ALL(incidence->shot_point_ids, j)
+		if (stamps[shot_id] == stamp) 
 		{
-			const Double_Index * const index = incidence->shot_point_ids.data + j; 
-
-			if (is_there[index->primary]) 
-			{
-				valid = false; 
-				break; 
-			}
-
-			is_there[index->primary] = true;
+			job->conflicting[item] = true;
+			return;
 		}
 
-		// if it's not valid, remove it
-		if (!valid) geometry_delete_vertex(i);
+		stamps[shot_id] = stamp;
 	}
 }
 
-// find parent node
-size_t matching_find_parent_node(Matching_UF_Nodes & nodes, feature * node, bool & found) 
+// remove tracks occuring on a single shot more than once
+void matching_remove_conflicting_tracks(const size_t threads_count)
 {
-	if (!node->feature_data) 
+	// check vertices in parallel, each thread has it's own stamps for all shots 
+	Matching_Conflicts_Job job; 
+	job.conflicting = ALLOC(bool, vertices_incidence.count > 0 ? vertices_incidence.count : 1);
+	job.stamps = ALLOC(size_t *, threads_count);
+	for (size_t t = 0; t < threads_count; t++) 
 	{
-		found = false; 
-		return SIZE_MAX;
+		job.stamps[t] = ALLOC(size_t, shots.count > 0 ? shots.count : 1);
+		memset(job.stamps[t], 0, sizeof(size_t) * shots.count);
 	}
 
-	size_t id = (Matching_UF_Node *)(node->feature_data) - (Matching_UF_Node *)(NULL) - 1;
-	ASSERT_IS_SET(nodes, id);
-	while (!nodes.data[id].root) 
-	{
-		id = nodes.data[id].i;
-		ASSERT_IS_SET(nodes, id);
-	}
-
-	found = true; 
-	return id;
-}
-
-// merge two tracks
-void matching_features_union(Matching_UF_Nodes & nodes, feature * first, feature * second)
-{
-	// get corresponding root nodes 
-	bool first_root_found, second_root_found; 
-	size_t first_root_id, second_root_id; 
-	first_root_id = matching_find_parent_node(nodes, first, first_root_found);
-	second_root_id = matching_find_parent_node(nodes, second, second_root_found);
-	size_t first_size = first_root_found ? nodes.data[first_root_id].i : 0; 
-	size_t second_size = second_root_found ? nodes.data[second_root_id].i : 0; 
-	ASSERT(first_size == 0 || IS_SET(nodes, first_root_id), "non-empty class of equivalence must have valid id");
-	ASSERT(second_size == 0 || IS_SET(nodes, second_root_id), "non-empty class of equivalence must have valid id");
-
-	// if these two already are in the same class of equivalence, we're done immediately 
-	if (first_root_found && second_root_found && first_root_id == second_root_id) return;
+	core_parallel_for(vertices_incidence.count, threads_count, matching_conflicts_job, &job);
 
-	// swap the pointers so that the first feature is at least as big/valuable as the second 
-	if (first_size < second_size)
+	// delete all invalid vertices at once 
+	size_t * invalid = ALLOC(size_t, vertices_incidence.count > 0 ? vertices_incidence.count : 1);
+	size_t invalid_count = 0;
+	for (size_t i = 0; i < vertices_incidence.count; i++) 
 	{
-		feature * t = first; first = second; second = t;
-		swap_bool(first_root_found, second_root_found); 
-		swap_size_t(first_root_id, second_root_id);
-		swap_size_t(first_size, second_size);
+		if (job.conflicting[i] && IS_SET(vertices, i)) invalid[invalid_count++] = i;
 	}
 
-	// if both of them are singletons, create brand new class of equivalence for this lucky pair 
-	if (first_size == 0) 
-	{
-		ASSERT(second_size == 0, "logical inconsistency");
-		ADD(nodes); 
-		LAST(nodes).i = 2; 
-		LAST(nodes).root = true; 
-		first->feature_data = (void *)((Matching_UF_Node *)NULL + LAST_INDEX(nodes) + 1); // little bit hacky... 
-		second->feature_data = first->feature_data;
-		return;
-	}
+	geometry_delete_vertices(invalid, invalid_count);
+	printf("removed %d conflicting vertices\n", (int)invalid_count);
+	fflush(stdout);
 
-	// if only the second one is a singleton, merge it with the first one 
-	if (second_size == 0) 
+	FREE(invalid);
+	for (size_t t = 0; t < threads_count; t++) 
 	{
-		nodes.data[first_root_id].i++;
-		second->feature_data = first->feature_data;
-		return; 
+		FREE(job.stamps[t]);
 	}
-
-	// if both of them are not singletons, join the smaller one under the larger 
-	nodes.data[first_root_id].i += nodes.data[second_root_id].i;
-	nodes.data[second_root_id].root = false; 
-	nodes.data[second_root_id].i = first_root_id;
+	FREE(job.stamps);
+	FREE(job.conflicting);
 }
-
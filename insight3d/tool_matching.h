@@ -28,6 +28,11 @@
 #include "tool_typical_includes.h"
 #include "ui_list.h"
 #include "mvg_matching.h"
+#include "mvg_descriptor_index.h"
+#include "mvg_retrieval.h"
+#include "mvg_tracks.h"
+#include "core_parallel.h"
+#include "geometry_features_cache.h"
 
 // tool registration and public routines
 void tool_matching_create();
@@ -38,6 +43,7 @@ void tool_matching_remove_conflicts();
 struct Matching_Shot
 {
 	int width, height; // size of loaded shot 
+	Keypoints_Grid * grid; // keypoints sorted into buckets for guided matching 
 };
 
 #endif
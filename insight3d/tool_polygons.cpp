@@ -103,14 +103,13 @@ bool tool_polygons_mouse_down(double x, double y, int button)
 		{
 			if (sdl_shift_pressed())
 			{
-				polygons.data[polygon_id].vertices.data[polygon_iter].set = false;
+				geometry_polygon_remove_vertex(polygon_id, polygon_iter);
 			}
 		}
 		else
 		{
 			// otherwise, add it to the polygon
-			ADD(polygons.data[polygon_id].vertices); 
-			LAST(polygons.data[polygon_id].vertices).value = vertex_id;
+			geometry_polygon_add_vertex(polygon_id, vertex_id);
 		}
 	}
 	/*else // if there is no focused point, pass the event to points tool 
@@ -262,12 +262,9 @@ void tool_triangulate_surface_reconstruction()
 										{
 											size_t polygon_id;
 											geometry_new_polygon(polygon_id);
-											ADD(polygons.data[polygon_id].vertices);
-											LAST(polygons.data[polygon_id].vertices).value = shot->points.data[edge_i1->first].vertex;
-											ADD(polygons.data[polygon_id].vertices);
-											LAST(polygons.data[polygon_id].vertices).value = shot->points.data[edge_i2->first].vertex;
-											ADD(polygons.data[polygon_id].vertices);
-											LAST(polygons.data[polygon_id].vertices).value = shot->points.data[edge_i1i->first].vertex;
+											geometry_polygon_add_vertex(polygon_id, shot->points.data[edge_i1->first].vertex);
+											geometry_polygon_add_vertex(polygon_id, shot->points.data[edge_i2->first].vertex);
+											geometry_polygon_add_vertex(polygon_id, shot->points.data[edge_i1i->first].vertex);
 										}
 										else
 										{
@@ -612,12 +609,9 @@ void tool_triangulate_compute_normals()
 
 									size_t polygon_id;
 									geometry_new_polygon(polygon_id);
-									ADD(polygons.data[polygon_id].vertices);
-									LAST(polygons.data[polygon_id].vertices).value = edge_i1->first;
-									ADD(polygons.data[polygon_id].vertices);
-									LAST(polygons.data[polygon_id].vertices).value = edge_i2->first;
-									ADD(polygons.data[polygon_id].vertices);
-									LAST(polygons.data[polygon_id].vertices).value = edge_i1i->first;
+									geometry_polygon_add_vertex(polygon_id, edge_i1->first);
+									geometry_polygon_add_vertex(polygon_id, edge_i2->first);
+									geometry_polygon_add_vertex(polygon_id, edge_i1i->first);
 								}
 							}
 						}